@@ -200,6 +200,7 @@ void structure_chunk::set_chi1inv(component c,
  breakout: npixels += loop_npixels;
   double last_output_time = wall_time();
 
+  expand_chi1inv(c);
   FOR_FT_COMPONENTS(ft,c2) if (gv.has_field(c2)) {
     direction d = component_direction(c2);
     if (!chi1inv[c][d]) chi1inv[c][d] = new realnum[gv.ntot()];
@@ -257,6 +258,7 @@ void structure_chunk::set_chi1inv(component c,
     delete[] chi1inv[c][dc];
     chi1inv[c][dc] = 0;
   }
+  compress_chi1inv(c);
   medium.unset_volume();
 }
 
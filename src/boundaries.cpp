@@ -16,6 +16,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include <complex>
 
 #include "meep.hpp"
@@ -95,6 +96,9 @@ void fields::disconnect_chunks() {
 	  for (int io=0;io<2;io++) {
 	    delete[] chunks[i]->connections[f][ip][io];
 	    chunks[i]->connections[f][ip][io] = NULL;
+	    delete[] chunks[i]->connection_runs[f][ip][io];
+	    chunks[i]->connection_runs[f][ip][io] = NULL;
+	    chunks[i]->num_connection_runs[f][ip][io] = 0;
 	  }
     }
     FOR_FIELD_TYPES(f) {
@@ -104,14 +108,23 @@ void fields::disconnect_chunks() {
 	for (int io=0;io<2;io++)
 	  chunks[i]->num_connections[f][ip][io] = 0;
     }
+    FOR_DIRECTIONS(d)
+      chunks[i]->halo_depth[d][High] = chunks[i]->halo_depth[d][Low] = 0;
   }
-  FOR_FIELD_TYPES(ft)
+  free_boundary_communications();
+  FOR_FIELD_TYPES(ft) {
     for (int i=0;i<num_chunks*num_chunks;i++) {
       delete[] comm_blocks[ft][i];
       comm_blocks[ft][i] = 0;
       for (int ip=0;ip<3;++ip)
 	comm_sizes[ft][ip][i] = 0;
     }
+    for (int io=0;io<2;io++) {
+      delete[] comm_pairs[ft][io];
+      comm_pairs[ft][io] = NULL;
+      num_comm_pairs[ft][io] = 0;
+    }
+  }
 }
 
 void fields::connect_chunks() {
@@ -120,9 +133,35 @@ void fields::connect_chunks() {
     disconnect_chunks();
     find_metals();
     connect_the_chunks();
+    plan_boundary_communications();
     finished_working();
     chunk_connections_valid = true;
+
+    /* Decide once, collectively, whether the time stepping may still
+       allocate fields lazily (which requires reconnecting the chunks,
+       and hence agreement between the processes on each half step);
+       once everything is allocated, stepping needs no collectives. */
+    bool may = false;
+    for (int i=0;i<num_chunks && !may;i++)
+      if (chunks[i]->is_mine()) may = chunks[i]->may_allocate();
+    may_allocate_fields = or_to_all(may);
+  }
+}
+
+/* Called on every process after stepping that may have lazily
+   allocated fields (allocated is whether this process did), so that
+   chunk_connections_valid stays the same on every process and
+   connect_chunks cannot deadlock.  This only needs a collective while
+   may_allocate_fields; an allocation that connect_chunks did not
+   foresee is a bug in fields_chunk::may_allocate. */
+void fields::sync_chunk_connections(bool allocated) {
+  if (allocated) {
+    if (chunk_connections_valid && !may_allocate_fields)
+      abort("bug: unexpected allocation of fields while time stepping");
+    chunk_connections_valid = false;
   }
+  if (may_allocate_fields)
+    chunk_connections_valid = and_to_all(chunk_connections_valid);
 }
 
 inline bool fields::on_metal_boundary(const ivec &here) {
@@ -478,6 +517,8 @@ void fields::connect_the_chunks() {
 		      [wh[f][ip][Outgoing][j]++] = 
 		      chunks[j]->f[c][cmp] + m;
 		  }
+		  if (f == B_stuff || f == D_stuff)
+		    chunks[j]->extend_halo(c, here);
 		}
 		
 		if (needs_W_notowned[corig]) {
@@ -552,6 +593,152 @@ void fields::connect_the_chunks() {
       for (int io=0;io<2;io++)
 	delete[] wh[f][ip][io];
   delete[] B_redundant;
+
+  /* Finally, list the nonempty pairs for step_boundaries, in the same
+     order as the connections of each chunk (by i for a sending chunk j,
+     and by j for a receiving chunk i). */
+  FOR_FIELD_TYPES(ft) for (int io=0;io<2;io++) {
+    int num = 0;
+    for (int k=0;k<num_chunks*num_chunks;k++)
+      if (comm_size_tot(ft, k) > 0
+	  && chunks[io == Outgoing ? k % num_chunks : k / num_chunks]->is_mine())
+	++num;
+    comm_pairs[ft][io] = new comm_pair[num];
+    num_comm_pairs[ft][io] = num;
+    num = 0;
+    for (int c=0;c<num_chunks;c++)
+      if (chunks[c]->is_mine()) {
+	int start[3] = {0,0,0};
+	for (int other=0;other<num_chunks;other++) {
+	  const int pair = io == Outgoing ? c+other*num_chunks
+	    : other+c*num_chunks;
+	  if (comm_size_tot(ft, pair) > 0) {
+	    comm_pair &p = comm_pairs[ft][io][num++];
+	    p.pair = pair;
+	    p.chunk = c;
+	    for (int ip=0;ip<3;ip++) p.start[ip] = start[ip];
+	  }
+	  for (int ip=0;ip<3;ip++) start[ip] += comm_sizes[ft][ip][pair];
+	}
+      }
+  }
+
+  /* ...and compress each pair's connections into runs, after which the
+     pointer arrays are no longer needed. */
+  FOR_FIELD_TYPES(ft) for (int io=0;io<2;io++) for (int ip=0;ip<3;ip++)
+    for (int c=0;c<num_chunks;c++)
+      if (chunks[c]->is_mine()) {
+	fields_chunk *fc = chunks[c];
+	connection_run *runs =
+	  new connection_run[fc->num_connections[ft][ip][io]];
+	int nruns = 0;
+	for (int k=0;k<num_comm_pairs[ft][io];k++) {
+	  comm_pair &p = comm_pairs[ft][io][k];
+	  if (p.chunk != c) continue;
+	  p.run_start[ip] = nruns;
+	  p.num_runs[ip] = fc->compress_connections(
+	    fc->connections[ft][ip][io] + p.start[ip],
+	    comm_sizes[ft][ip][p.pair], ip == CONNECT_PHASE, runs + nruns);
+	  nruns += p.num_runs[ip];
+	}
+	fc->connection_runs[ft][ip][io] = new connection_run[nruns];
+	memcpy(fc->connection_runs[ft][ip][io], runs,
+	       nruns * sizeof(connection_run));
+	fc->num_connection_runs[ft][ip][io] = nruns;
+	delete[] runs;
+      }
+  for (int c=0;c<num_chunks;c++)
+    FOR_FIELD_TYPES(ft) for (int ip=0;ip<3;ip++) for (int io=0;io<2;io++) {
+      delete[] chunks[c]->connections[ft][ip][io];
+      chunks[c]->connections[ft][ip][io] = NULL;
+    }
+}
+
+/* Compress the connection pointers conn[0..n-1] into at most n runs,
+   returning the number of runs.  If pairs, the connections are all
+   (real, imaginary) pairs, as for CONNECT_PHASE; otherwise, we use
+   pairs where consecutive connections are the real and imaginary
+   parts of the same point.  Runs are only extended for pointers into
+   the f and f_w arrays; others (e.g. into polarization data) get a
+   run of their own. */
+int fields_chunk::compress_connections(realnum **conn, int n, bool pairs,
+				       connection_run *runs) const {
+  const int ntot = gv.ntot();
+  int nruns = 0;
+  bool extendable = false; // whether runs[nruns-1] may be extended
+  realnum *last[2] = {NULL, NULL}; // arrays of the last pointer found
+  for (int k = 0; k < n; ) {
+    // find the f or f_w array containing conn[k], if any
+    realnum *a[2] = {NULL, NULL};
+    if (last[0] && conn[k] >= last[0] && conn[k] < last[0] + ntot) {
+      a[0] = last[0]; a[1] = last[1];
+    }
+    else
+      FOR_COMPONENTS(c) {
+	for (int w = 0; w < 2 && !a[0]; ++w) {
+	  realnum * const *fw = w ? f_w[c] : f[c];
+	  if (fw[0] && conn[k] >= fw[0] && conn[k] < fw[0] + ntot) {
+	    a[0] = fw[0]; a[1] = fw[1];
+	  }
+	}
+	if (a[0]) break;
+      }
+    last[0] = a[0]; last[1] = a[1];
+    const int offset = a[0] ? int(conn[k] - a[0]) : 0;
+    const bool pair = pairs || (a[0] && a[1] && k + 1 < n
+				&& conn[k+1] == a[1] + offset);
+    if (pair && !(a[0] && a[1] && conn[k+1] == a[1] + offset))
+      a[0] = NULL; // a pair, but not in the f or f_w arrays
+
+    connection_run *r = runs + nruns - 1;
+    if (a[0] && extendable && r->f[0] == a[0] && r->f[1] == (pair ? a[1] : NULL)
+	&& (r->count == 1 || offset == r->offset + r->count * r->stride)) {
+      if (r->count == 1) r->stride = offset - r->offset;
+      r->count++;
+    }
+    else {
+      r = runs + nruns++;
+      r->f[0] = a[0] ? a[0] : conn[k];
+      r->f[1] = pair ? (a[0] ? a[1] : conn[k+1]) : NULL;
+      r->offset = offset;
+      r->stride = 1;
+      r->count = 1;
+      extendable = a[0] != NULL;
+    }
+    k += pair ? 2 : 1;
+  }
+  return nruns;
+}
+
+/* Make sure that the halo (see fields_chunk::in_halo) includes the
+   owned point here, by extending it from the nearest face.  Distances
+   from the High face are measured from the last point of the loop
+   over the owned points, as in split_halo (step_db.cpp). */
+void fields_chunk::extend_halo(component c, const ivec &here) {
+  const ivec is = gv.little_owned_corner0(c), ie = gv.big_corner();
+  direction dmin = NO_DIRECTION;
+  boundary_side bmin = Low;
+  int dist = 0;
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    const int lo = here.in_direction(d) - is.in_direction(d);
+    const int hi = ie.in_direction(d) - here.in_direction(d)
+      - ((ie.in_direction(d) - is.in_direction(d)) & 1);
+    if (dmin == NO_DIRECTION || lo < dist) { dmin = d; bmin = Low; dist = lo; }
+    if (hi < dist) { dmin = d; bmin = High; dist = hi; }
+  }
+  if (dmin != NO_DIRECTION && dist + 1 > halo_depth[dmin][bmin])
+    halo_depth[dmin][bmin] = dist + 1;
+}
+
+bool fields_chunk::in_halo(component c, const ivec &here) const {
+  const ivec is = gv.little_owned_corner0(c), ie = gv.big_corner();
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    const int lo = here.in_direction(d) - is.in_direction(d);
+    const int hi = ie.in_direction(d) - here.in_direction(d)
+      - ((ie.in_direction(d) - is.in_direction(d)) & 1);
+    if (lo < halo_depth[d][Low] || hi < halo_depth[d][High]) return true;
+  }
+  return false;
 }
 
 void fields_chunk::alloc_extra_connections(field_type f, connect_phase ip,
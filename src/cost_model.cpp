@@ -0,0 +1,286 @@
+/* Copyright (C) 2005-2015 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* The cost model used by structure::choose_chunkdivision to balance
+   the work between the chunks, and a micro-benchmark to calibrate it. */
+
+#include <math.h>
+
+#include "meep.hpp"
+#include "meep_internals.hpp"
+
+using namespace std;
+
+namespace meep {
+
+cost_model::cost_model() :
+  pml(1.6), conductivity(0.35), nonlinear(2.0), susceptibility(1.2),
+  dft(0.3), source(0.55), boundary(1.0), resolution(8),
+  sigmas(NULL), volumes(NULL), dft_volumes(NULL), source_volumes(NULL) {}
+
+cost_model::~cost_model() {
+  while (sigmas) {
+    sigma_list *next = sigmas->next;
+    if (sigmas->owned) delete sigmas->sigma;
+    delete sigmas;
+    sigmas = next;
+  }
+  delete volumes;
+  delete dft_volumes;
+  delete source_volumes;
+}
+
+void cost_model::add_susceptibility(material_function &sigma, int npoles) {
+  sigma_list *s = new sigma_list;
+  s->sigma = &sigma;
+  s->owned = false;
+  s->npoles = npoles;
+  s->next = sigmas;
+  sigmas = s;
+}
+
+void cost_model::add_susceptibility(double sigma(const vec &), int npoles) {
+  add_susceptibility(*new simple_material_function(sigma), npoles);
+  sigmas->owned = true;
+}
+
+void cost_model::add_dft_volume(const volume &where, int Nfreq,
+				int num_components) {
+  dft_volumes = new volume_list(where, 0, Nfreq * num_components,
+				dft_volumes);
+}
+
+void cost_model::add_source_volume(const volume &where, int num_components) {
+  source_volumes = new volume_list(where, 0, num_components, source_volumes);
+}
+
+void cost_model::add_volume(const volume &where, double cost) {
+  volumes = new volume_list(where, 0, cost, volumes);
+}
+
+double cost_model::point_cost(material_function &mat, const vec &r) {
+  double cost = 0;
+  bool cond = false, nonlin = false;
+  FOR_COMPONENTS(c) {
+    if (!cond && mat.has_conductivity(c) && mat.conductivity(c, r) != 0)
+      cond = true;
+    if (!nonlin && ((mat.has_chi3(c) && mat.chi3(c, r) != 0)
+		    || (mat.has_chi2(c) && mat.chi2(c, r) != 0)))
+      nonlin = true;
+  }
+  if (cond) cost += conductivity;
+  if (nonlin) cost += nonlinear;
+  for (sigma_list *s = sigmas; s; s = s->next) {
+    bool nonzero = false;
+    FOR_E_AND_H(c) {
+      double sigrow[3];
+      s->sigma->sigma_row(c, sigrow, r);
+      if (sigrow[0] != 0 || sigrow[1] != 0 || sigrow[2] != 0) {
+	nonzero = true;
+	break;
+      }
+    }
+    if (nonzero) cost += susceptibility * s->npoles;
+  }
+  return cost;
+}
+
+/* The smallest grid_volume of the points of gv (at least one cell
+   thick) covering where, returning false if there are none. */
+static bool covering_volume(const grid_volume &gv, const volume &where,
+			    grid_volume *vol) {
+  *vol = gv;
+  const ivec lo = gv.round_vec(where.get_min_corner());
+  const ivec hi = gv.round_vec(where.get_max_corner());
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    const int lc = gv.little_corner().in_direction(d);
+    const int bc = gv.big_corner().in_direction(d);
+    int l = lc + 2 * int(floor((lo.in_direction(d) - lc) * 0.5));
+    int h = lc + 2 * int(ceil((hi.in_direction(d) - lc) * 0.5));
+    if (h <= l) h = l + 2;
+    l = max(l, lc);
+    h = min(h, bc);
+    if (l >= h) return false;
+    vol->set_origin(d, l);
+    vol->set_num_direction(d, (h - l) / 2);
+  }
+  return true;
+}
+
+int cost_model::get_effort_volumes(const grid_volume &gv,
+				   material_function *mat,
+				   grid_volume **vols, double **effort) {
+  int nmax = 0;
+  for (volume_list *v = volumes; v; v = v->next) ++nmax;
+  for (volume_list *v = dft_volumes; v; v = v->next) ++nmax;
+  for (volume_list *v = source_volumes; v; v = v->next) ++nmax;
+  int nblocks[5] = {1,1,1,1,1}, ntotblocks = 1;
+  if (mat)
+    LOOP_OVER_DIRECTIONS(gv.dim, d) {
+      nblocks[d] = max(1, min(resolution, gv.num_direction(d)));
+      ntotblocks *= nblocks[d];
+    }
+  else
+    ntotblocks = 0;
+  *vols = new grid_volume[nmax + ntotblocks];
+  *effort = new double[nmax + ntotblocks];
+  int n = 0;
+
+  for (int k = 0; k < 3; ++k) {
+    volume_list *vl = k == 0 ? volumes : (k == 1 ? dft_volumes : source_volumes);
+    const double unit_cost = k == 0 ? 1.0 : (k == 1 ? dft : source);
+    for (; vl; vl = vl->next)
+      if (covering_volume(gv, vl->v, *vols + n)) {
+	(*effort)[n] = real(vl->weight) * unit_cost;
+	if ((*effort)[n] != 0) ++n;
+      }
+  }
+
+  /* Sample the material in blocks of gv, at 3 points per direction (or
+     the number of cells, if smaller) in each block: */
+  if (mat) {
+    mat->set_volume(gv.surroundings());
+    for (int b = 0; b < ntotblocks; ++b) {
+      grid_volume bv = gv;
+      int start[5], len[5], ns[5], nsamples = 1, bb = b;
+      LOOP_OVER_DIRECTIONS(gv.dim, d) {
+	const int k = bb % nblocks[d];
+	bb /= nblocks[d];
+	start[d] = (k * gv.num_direction(d)) / nblocks[d];
+	len[d] = ((k+1) * gv.num_direction(d)) / nblocks[d] - start[d];
+	ns[d] = min(3, len[d]);
+	nsamples *= ns[d];
+	bv.set_origin(d, gv.little_corner().in_direction(d) + 2*start[d]);
+	bv.set_num_direction(d, len[d]);
+      }
+      double cost = 0;
+      for (int i = 0; i < nsamples; ++i) {
+	vec r = gv.get_origin();
+	int ii = i;
+	LOOP_OVER_DIRECTIONS(gv.dim, d) {
+	  const int m = ii % ns[d];
+	  ii /= ns[d];
+	  r.set_direction(d, r.in_direction(d)
+			  + (start[d] + (m + 0.5) * len[d] / ns[d]) / gv.a);
+	}
+	cost += point_cost(*mat, r);
+      }
+      if (cost != 0) {
+	(*vols)[n] = bv;
+	(*effort)[n++] = cost / nsamples;
+      }
+    }
+    mat->unset_volume();
+  }
+  return n;
+}
+
+static double cost_one(const vec &) { return 1.0; }
+static double cost_small(const vec &) { return 1e-3; }
+static complex<double> cost_field(const vec &r) {
+  return cos(6 * r.x()) * cos(4 * r.y()) * cos(2 * r.z());
+}
+
+enum calibration_feature { BASE, PML, CONDUCTIVITY, NONLINEAR, SUSCEPTIBILITY,
+			   DFT, SOURCE, NUM_CALIBRATION_FEATURES };
+
+/* Seconds per time step (on the master process) of a small 3d cell
+   with the given feature covering the cell.  *units is set to the
+   number of units of the feature per grid point.  The fields are
+   initialized everywhere, so that they are all stepped and so that
+   the timing is not spoiled by denormalized numbers ahead of a
+   wavefront. */
+static double time_feature(calibration_feature which, double *units) {
+  const grid_volume gv = vol3d(1, 1, 1, 24);
+  const volume cell = gv.surroundings();
+  const continuous_src_time src(1.0);
+  *units = 1;
+
+  cost_model unit; // with which the PML effort is the number of PML points
+  unit.pml = 1;
+  structure s(gv, cost_one,
+	      which == PML ? meep::pml(0.25, X) : meep::no_pml(),
+	      meep::identity(), 0, 0.5, false, DEFAULT_SUBPIXEL_TOL,
+	      DEFAULT_SUBPIXEL_MAXEVAL, &unit);
+  switch (which) {
+  case PML: { // the PML can't fill the whole cell
+    double npml = 0;
+    for (int j = 0; j < s.num_effort_volumes; ++j)
+      npml += (s.effort[j] - 1) * s.effort_volumes[j].ntot();
+    *units = npml / s.gv.ntot();
+    break;
+  }
+  case CONDUCTIVITY:
+    s.set_conductivity(Dx, cost_small);
+    s.set_conductivity(Dy, cost_small);
+    s.set_conductivity(Dz, cost_small);
+    break;
+  case NONLINEAR: s.set_chi3(cost_small); break;
+  case SUSCEPTIBILITY:
+    s.add_susceptibility(cost_one, E_stuff,
+			 lorentzian_susceptibility(1.0, 0.1));
+    break;
+  default: break;
+  }
+
+  fields f(&s);
+  FOR_E_AND_H(c) if (gv.has_field(c)) f.initialize_field(c, cost_field);
+  if (which == DFT) {
+    const int Nfreq = 4;
+    f.add_dft(Ex, cell, 0.5, 1.5, Nfreq);
+    *units = Nfreq;
+  }
+  else if (which == SOURCE)
+    f.add_volume_source(Ex, src, cell);
+
+  for (int n = 0; n < 5; ++n) f.step(); // allocate and warm up everything
+  const int nsteps = 20;
+  const double t0 = wall_time();
+  for (int n = 0; n < nsteps; ++n) f.step();
+  return broadcast(0, (wall_time() - t0) / nsteps);
+}
+
+/* Measure the costs as the extra time per step of each feature,
+   taking the fastest of a few interleaved repetitions to reduce the
+   noise.  boundary is not measured, since it mostly depends on the
+   communication between the processes. */
+void cost_model::calibrate() {
+  const bool was_quiet = quiet;
+  quiet = true;
+  double t[NUM_CALIBRATION_FEATURES], units[NUM_CALIBRATION_FEATURES];
+  for (int k = 0; k < NUM_CALIBRATION_FEATURES; ++k) t[k] = infinity;
+  for (int rep = 0; rep < 3; ++rep)
+    for (int k = 0; k < NUM_CALIBRATION_FEATURES; ++k)
+      t[k] = min(t[k], time_feature(calibration_feature(k), units + k));
+  quiet = was_quiet;
+
+  double cost[NUM_CALIBRATION_FEATURES];
+  for (int k = 0; k < NUM_CALIBRATION_FEATURES; ++k)
+    cost[k] = max(0.0, t[k] / t[BASE] - 1) / units[k];
+  pml = cost[PML];
+  conductivity = cost[CONDUCTIVITY];
+  nonlinear = cost[NONLINEAR];
+  susceptibility = cost[SUSCEPTIBILITY];
+  dft = cost[DFT];
+  source = cost[SOURCE];
+  if (!quiet)
+    master_printf("cost model: pml %g, conductivity %g, nonlinear %g, "
+		  "susceptibility %g, dft %g, source %g\n", pml, conductivity,
+		  nonlinear, susceptibility, dft, source);
+}
+
+} // namespace meep
@@ -17,15 +17,31 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
+#include "config.h"
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  include <errno.h>
+#  define DFT_MMAP 1
+#endif
 
 using namespace std;
 
 namespace meep {
 
+#define DGEMM F77_FUNC(dgemm,DGEMM)
+extern "C" void DGEMM(const char *transa, const char *transb,
+		      const int *m, const int *n, const int *k,
+		      const double *alpha, const double *A, const int *lda,
+		      const double *B, const int *ldb,
+		      const double *beta, double *C, const int *ldc);
+
 struct dft_chunk_data { // for passing to field::loop_in_chunks as void*
   double omega_min, domega;
   int Nomega;
@@ -34,9 +50,25 @@ struct dft_chunk_data { // for passing to field::loop_in_chunks as void*
   complex<double> weight, extra_weight;
   bool include_dV_and_interp_weights;
   bool sqrt_dV_and_interp_weights;
+  const int *have_c; // components allocated on any process
+  int batch;
+  int decimation;
+  bool average;
+  double dt;
+  const char *mmap_dir;
   dft_chunk *dft_chunks;
 };
 
+/* the decimation k for a DFT up to frequency freq_max: the largest k
+   for which the sampling rate 1/(k dt) is at least
+   nyquist_margin * 2 * freq_max (see fields::use_dft_decimation) */
+static int decimation_factor(double nyquist_margin, double freq_max,
+			     double dt) {
+  if (nyquist_margin <= 0 || freq_max <= 0) return 1;
+  const double k = 1 / (nyquist_margin * 2 * freq_max * dt);
+  return k >= 2 ? int(k) : 1;
+}
+
 dft_chunk::dft_chunk(fields_chunk *fc_,
 		     ivec is_, ivec ie_,
 		     vec s0_, vec s1_, vec e0_, vec e1_,
@@ -48,7 +80,7 @@ dft_chunk::dft_chunk(fields_chunk *fc_,
                      ivec shift_, const symmetry &S_, int sn_, int vc_,
 		     const void *data_) {
   dft_chunk_data *data = (dft_chunk_data *) data_;
-  if (!fc_->f[c_][0])
+  if (fc_->is_mine() && !fc_->f[c_][0])
     abort("invalid fields_chunk/component combination in dft_chunk");
   
   fc = fc_;
@@ -93,14 +125,28 @@ dft_chunk::dft_chunk(fields_chunk *fc_,
   omega_min = data->omega_min;
   domega = data->domega;
   Nomega = data->Nomega;
-  dft_phase = new complex<realnum>[Nomega];
+  batch = data->batch > 1 ? data->batch : 1;
+  nbuf = buf_cmp = 0;
+  fbuf = NULL; // allocated by update_dft
+  dft_phase = new double[batch * 4 * Nomega];
+  sample_now = false;
+  numcmp_now = 0;
+  decimation = 1;
+  favg = NULL;
+  dec_weight = NULL;
+  set_decimation(data->decimation, data->average, data->dt);
   
   N = 1;
   LOOP_OVER_DIRECTIONS(is.dim, d)
     N *= (ie.in_direction(d) - is.in_direction(d)) / 2 + 1;
-  dft = new complex<realnum>[N * Nomega];
-  for (int i = 0; i < N * Nomega; ++i)
-    dft[i] = 0.0;
+  mmap_dir = NULL;
+  if (data->mmap_dir) {
+    mmap_dir = new char[strlen(data->mmap_dir) + 1];
+    strcpy(mmap_dir, data->mmap_dir);
+  }
+  // only a placeholder (for fields::move_chunks) if not our chunk
+  dft = NULL;
+  if (fc->is_mine()) alloc_dft();
   
   next_in_chunk = fc->dft_chunks;
   fc->dft_chunks = this;
@@ -108,8 +154,12 @@ dft_chunk::dft_chunk(fields_chunk *fc_,
 }
 
 dft_chunk::~dft_chunk() {
-  delete[] dft;
+  free_dft();
+  delete[] mmap_dir;
   delete[] dft_phase;
+  delete[] fbuf;
+  delete[] favg;
+  delete[] dec_weight;
 
   // delete from fields_chunk list
   dft_chunk *cur = fc->dft_chunks;
@@ -123,6 +173,54 @@ dft_chunk::~dft_chunk() {
   }
 }
 
+/* With mmap_dir, dft is mapped from a temporary file that is unlinked
+   right away (so that it disappears with the process); the file is
+   created with ftruncate, so it reads as zeros and occupies no disk
+   space until the pages are written back. */
+void dft_chunk::alloc_dft() {
+  const size_t n = size_t(N) * 2 * Nomega;
+  if (!mmap_dir) {
+    dft = new double[n];
+    for (size_t i = 0; i < n; ++i)
+      dft[i] = 0.0;
+    return;
+  }
+#ifdef DFT_MMAP
+  char *fname = new char[strlen(mmap_dir) + 32];
+  sprintf(fname, "%s/meep-dft-XXXXXX", mmap_dir);
+  int fd = mkstemp(fname);
+  if (fd < 0)
+    abort("error creating DFT file %s: %s", fname, strerror(errno));
+  unlink(fname);
+  delete[] fname;
+  if (ftruncate(fd, n * sizeof(double)))
+    abort("error allocating %g bytes of DFT file in %s: %s",
+	  double(n * sizeof(double)), mmap_dir, strerror(errno));
+  void *p = mmap(NULL, n * sizeof(double), PROT_READ | PROT_WRITE,
+		 MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps the file
+  if (p == MAP_FAILED)
+    abort("error mapping DFT file in %s: %s", mmap_dir, strerror(errno));
+#  ifdef MADV_SEQUENTIAL
+  madvise(p, n * sizeof(double), MADV_SEQUENTIAL);
+#  endif
+  dft = (double *) p;
+#else
+  abort("fields::use_dft_mmap requires mmap");
+#endif
+}
+
+void dft_chunk::free_dft() {
+  if (!dft) return;
+#ifdef DFT_MMAP
+  if (mmap_dir)
+    munmap(dft, size_t(N) * 2 * Nomega * sizeof(double));
+  else
+#endif
+    delete[] dft;
+  dft = NULL;
+}
+
 void dft_flux::remove()
 {
   while (E) {
@@ -149,7 +247,8 @@ static void add_dft_chunkloop(fields_chunk *fc, int ichunk, component cgrid,
   (void) ichunk; // unused
 
   component c = S.transform(data->c, -sn);
-  if (c >= NUM_FIELD_COMPONENTS || !fc->f[c][0])
+  if (c >= NUM_FIELD_COMPONENTS
+      || !(fc->is_mine() ? fc->f[c][0] != NULL : data->have_c[c]))
        return; // this chunk doesn't have component c
 
   data->dft_chunks = new dft_chunk(fc,is,ie,s0,s1,e0,e1,dV0,dV1,
@@ -183,8 +282,29 @@ dft_chunk *fields::add_dft(component c, const volume &where,
   data.dft_chunks = chunk_next;
   data.weight = weight * (dt/sqrt(2*pi));
   data.extra_weight = extra_weight;
+  data.batch = dft_batch;
+  data.decimation = decimation_factor(dft_nyquist_margin,
+				      max(fabs(freq_min), fabs(freq_max)), dt);
+  data.average = dft_average;
+  data.dt = dt;
+  data.mmap_dir = dft_mmap_dir;
+
+  /* With rebalancing, every process gets a placeholder for the DFT
+     chunks of the other processes, so that a chunk can be moved
+     without changing the dft_chunk lists held by the caller.  The
+     field components are allocated for all chunks or for none. */
+  const bool all_chunks = rebalance_interval > 0;
+  int have_c[NUM_FIELD_COMPONENTS], mine_c[NUM_FIELD_COMPONENTS];
+  if (all_chunks) {
+    for (int ic = 0; ic < NUM_FIELD_COMPONENTS; ++ic) mine_c[ic] = 0;
+    for (int i = 0; i < num_chunks; ++i)
+      if (chunks[i]->is_mine())
+	FOR_COMPONENTS(ci) if (chunks[i]->f[ci][0]) mine_c[ci] = 1;
+    or_to_all(mine_c, have_c, NUM_FIELD_COMPONENTS);
+  }
+  data.have_c = have_c;
   loop_in_chunks(add_dft_chunkloop, (void *) &data, where,
-		 use_centered_grid ? Centered : c);
+		 use_centered_grid ? Centered : c, true, false, all_chunks);
 
   return data.dft_chunks;
 }
@@ -208,11 +328,64 @@ dft_chunk *fields::add_dft_pt(component c, const vec &where,
   return add_dft(c, where, freq_min, freq_max, Nfreq, false);
 }
 
+/* The DFTs of all our chunks are updated in three passes: start_update
+   of every dft_chunk (which computes the phases), then update_points
+   for tasks of up to block points of a dft_chunk each, which are
+   independent and are divided among the threads, then finish_update. */
 void fields::update_dfts() {
   am_now_working_on(FourierTransforming);
+  const double timeE = time(), timeH = time() - 0.5 * dt;
+
+  int npts = 0;
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+	if (cur->start_update(is_magnetic(cur->c) ? timeH : timeE))
+	  npts += cur->N;
+
+  if (npts > 0) {
+    // a few tasks per thread, but not too small, to balance the load
+    const int nthreads = count_threads();
+    const int block = nthreads > 1 ? max(256, npts / (4 * nthreads) + 1)
+      : npts;
+    int ntasks = 0;
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine())
+	for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+	  if (cur->numcmp_now) ntasks += (cur->N + block - 1) / block;
+    dft_chunk **task_dft = new dft_chunk*[ntasks];
+    int *task_p0 = new int[ntasks];
+    ntasks = 0;
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine())
+	for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+	  if (cur->numcmp_now)
+	    for (int p0 = 0; p0 < cur->N; p0 += block) {
+	      task_dft[ntasks] = cur;
+	      task_p0[ntasks++] = p0;
+	    }
+
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1)
+#endif
+    for (int t = 0; t < ntasks; t++) {
+      const double start = wall_time();
+      dft_chunk *cur = task_dft[t];
+      cur->update_points(task_p0[t], min(task_p0[t] + block, cur->N));
+      const double elapsed = wall_time() - start;
+#ifdef _OPENMP
+#  pragma omp atomic
+#endif
+      cur->fc->work_time += elapsed;
+    }
+    delete[] task_p0;
+    delete[] task_dft;
+  }
+
   for (int i = 0; i < num_chunks; i++)
     if (chunks[i]->is_mine())
-      chunks[i]->update_dfts(time(), time() - 0.5 * dt);
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+	cur->finish_update();
   finished_working();
 }
 
@@ -223,21 +396,81 @@ void fields_chunk::update_dfts(double timeE, double timeH) {
 }
 
 void dft_chunk::update_dft(double time) {
-  if (!fc->f[c][0]) return;
+  if (start_update(time)) update_points(0, N);
+  finish_update();
+}
 
-  for (int i = 0; i < Nomega; ++i)
-    dft_phase[i] = polar(1.0, (omega_min + i*domega)*time) * scale;
+bool dft_chunk::start_update(double time) {
+  sample_now = false;
+  numcmp_now = 0; // nothing to do
+  if (!dft || !fc->f[c][0]) return false;
+
+  const int numcmp = fc->f[c][1] ? 2 : 1;
+
+  bool sample = true; // whether this step is added to the DFT
+  if (decimation > 1) {
+    if (nstep++ == 0) t_first = time;
+    const bool last = nstep == decimation;
+    if (last) nstep = 0;
+    if (average) {
+      sample = last;
+      time = 0.5 * (t_first + time);
+      if (!favg) {
+	favg = new double[size_t(N) * 2];
+	for (int i = 0; i < N * 2; ++i) favg[i] = 0;
+      }
+    }
+    else if (nstep != 1) // sample the first of each k steps
+      return false;
+  }
 
-  int numcmp = fc->f[c][1] ? 2 : 1;
+  if (sample) {
+    if (batch > 1) {
+      if (nbuf > 0 && numcmp != buf_cmp) flush_dft();
+      if (!fbuf) fbuf = new double[size_t(N) * 2 * batch];
+      buf_cmp = numcmp;
+    }
 
-  int idx_dft = 0;
-  LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
+    /* exp(i omega_min t) * exp(i domega t)^i * scale, by recurrence in
+       i rather than calling polar for every frequency */
+    double *pr = dft_phase + nbuf * 2*Nomega, *pi = pr + Nomega;
+    complex<double> ph = polar(1.0, omega_min*time) * scale;
+    const complex<double> dph = polar(1.0, domega*time);
+    for (int i = 0; i < Nomega; ++i) {
+      const complex<double> p = dec_weight ? ph * dec_weight[i] : ph;
+      pr[i] = real(p);
+      pi[i] = imag(p);
+      ph *= dph;
+    }
+    if (batch > 1 && numcmp == 2) { // i * phase, for the imaginary parts
+      double *qr = dft_phase + (batch + nbuf) * 2*Nomega, *qi = qr + Nomega;
+      for (int i = 0; i < Nomega; ++i) {
+	qr[i] = -pi[i];
+	qi[i] = pr[i];
+      }
+    }
+  }
+
+  sample_now = sample;
+  numcmp_now = numcmp;
+  return true;
+}
+
+/* Only touches the points p0 <= p < p1 of dft, fbuf and favg, so that
+   different ranges can be updated by different threads. */
+void dft_chunk::update_points(int p0, int p1) {
+  const int numcmp = numcmp_now;
+  const bool sample = sample_now;
+  const double *pr = dft_phase + nbuf * 2*Nomega, *pi = pr + Nomega;
+
+  LOOP_OVER_IVECS_PART(fc->gv, is, ie, idx, p0, p1) {
+    const size_t idx_dft = loop_p; // size_t: N * 2 * Nomega may overflow int
     double w = IVEC_LOOP_WEIGHT(s0, s1, e0, e1, dV0 + dV1 * loop_i2);
     if (sqrt_dV_and_interp_weights) w = sqrt(w);
     double f[2]; // real/imag field value at epsilon point
     if (avg2)
       for (int cmp=0; cmp < numcmp; ++cmp)
-	f[cmp] = (w * 0.25) * 
+	f[cmp] = (w * 0.25) *
 	  (fc->f[c][cmp][idx] + fc->f[c][cmp][idx+avg1]
 	   + fc->f[c][cmp][idx+avg2] + fc->f[c][cmp][idx+(avg1+avg2)]);
     else if (avg1)
@@ -246,33 +479,185 @@ void dft_chunk::update_dft(double time) {
     else
       for (int cmp=0; cmp < numcmp; ++cmp)
 	f[cmp] = w * fc->f[c][cmp][idx];
-    
-    if (numcmp == 2) {
-      complex<realnum> fc(f[0], f[1]);
-      for (int i = 0; i < Nomega; ++i)
-	dft[Nomega * idx_dft + i] += dft_phase[i] * fc;
+
+    if (favg && decimation > 1) { // mean of f over the k steps
+      for (int cmp=0; cmp < numcmp; ++cmp) {
+	favg[idx_dft * 2 + cmp] += f[cmp];
+	if (sample) {
+	  f[cmp] = favg[idx_dft * 2 + cmp] / decimation;
+	  favg[idx_dft * 2 + cmp] = 0;
+	}
+      }
+      if (!sample) continue;
     }
+
+    if (batch > 1)
+      for (int cmp=0; cmp < numcmp; ++cmp)
+	fbuf[(idx_dft * 2 + cmp) * batch + nbuf] = f[cmp];
     else {
-      realnum fr = f[0];
-      for (int i = 0; i < Nomega; ++i)
-	dft[Nomega * idx_dft + i] += dft_phase[i] * fr;
+      // real arithmetic on the split re/im arrays, so that this vectorizes
+      double *dr = dft + idx_dft * 2*Nomega, *di = dr + Nomega;
+      if (numcmp == 2) {
+	const double fr = f[0], fi = f[1];
+	for (int i = 0; i < Nomega; ++i) {
+	  dr[i] += pr[i] * fr - pi[i] * fi;
+	  di[i] += pi[i] * fr + pr[i] * fi;
+	}
+      }
+      else {
+	const double fr = f[0];
+	for (int i = 0; i < Nomega; ++i) {
+	  dr[i] += pr[i] * fr;
+	  di[i] += pi[i] * fr;
+	}
+      }
     }
-    idx_dft++;
   }
+
+  if (sample && batch > 1 && nbuf + 1 == batch) flush_rows(p0, p1, batch);
+}
+
+void dft_chunk::finish_update() {
+  if (sample_now && batch > 1 && ++nbuf == batch)
+    nbuf = 0; // already flushed by update_points
+  sample_now = false;
+  numcmp_now = 0;
+}
+
+/* dft += the first nsteps buffered steps, for the points p0 <= p < p1:
+   the 2Nomega row of dft of each point gets fbuf(point, cmp, step)
+   times the row of dft_phase for that step, where the rows for cmp = 1
+   (the imaginary parts of the fields) are i times those for cmp = 0.
+   In column-major order, as for BLAS, this is dft^T += phase^T * f^T
+   for each cmp, with phase nsteps x 2Nomega and f (p1-p0) x nsteps. */
+void dft_chunk::flush_rows(int p0, int p1, int nsteps) const {
+  if (!dft || nsteps == 0 || p1 <= p0) return;
+  const int m = 2 * Nomega, n = p1 - p0, ldf = 2 * batch;
+  const double *fb = fbuf + size_t(p0) * ldf;
+  double *d = dft + size_t(p0) * m;
+#ifdef HAVE_BLAS
+  const double one = 1.0;
+  DGEMM("N", "N", &m, &n, &nsteps, &one, dft_phase, &m,
+	fb, &ldf, &one, d, &m);
+  if (buf_cmp == 2)
+    DGEMM("N", "N", &m, &n, &nsteps, &one, dft_phase + batch * m, &m,
+	  fb + batch, &ldf, &one, d, &m);
+#else
+  for (int k = 0; k < n; ++k, d += m, fb += ldf)
+    for (int cmp = 0; cmp < buf_cmp; ++cmp)
+      for (int b = 0; b < nsteps; ++b) {
+	const double *phase = dft_phase + (cmp * batch + b) * m;
+	const double f = fb[cmp * batch + b];
+	for (int j = 0; j < m; ++j) d[j] += phase[j] * f;
+      }
+#endif
+}
+
+void dft_chunk::flush_dft() const {
+  if (nbuf == 0) return;
+  flush_rows(0, N, nbuf);
+  nbuf = 0;
+}
+
+void dft_chunk::set_batch(int batch_) {
+  flush_dft();
+  batch = batch_ > 1 ? batch_ : 1;
+  delete[] dft_phase;
+  dft_phase = new double[batch * 4 * Nomega];
+  delete[] fbuf;
+  fbuf = NULL;
+}
+
+/* k = decimation: dec_weight is k, divided (with average) by the
+   response sin(k omega dt/2) / (k sin(omega dt/2)) of the mean over k
+   steps at frequency omega.  Any partially summed k steps are dropped.
+   A nyquist_margin >= 1 keeps k omega dt/2 <= pi/2, where the response
+   is at least 2/pi; a k too large for the DFT band is an error rather
+   than a division by a vanishing (or negative) response. */
+void dft_chunk::set_decimation(int k, bool average_, double dt) {
+  flush_dft();
+  decimation = k > 1 ? k : 1;
+  average = average_;
+  nstep = 0;
+  delete[] favg;
+  favg = NULL;
+  delete[] dec_weight;
+  dec_weight = NULL;
+  if (decimation > 1) {
+    dec_weight = new double[Nomega];
+    for (int i = 0; i < Nomega; ++i) {
+      const double omega = omega_min + i * domega;
+      const double s = sin(omega * dt * 0.5);
+      const double H = (average && s != 0) ?
+	sin(decimation * omega * dt * 0.5) / (decimation * s) : 1.0;
+      if (H < 0.5)
+	abort("DFT decimation %d is too large for frequency %g",
+	      decimation, omega / (2*pi));
+      dec_weight[i] = decimation / H;
+    }
+  }
+}
+
+void fields::use_dft_decimation(double nyquist_margin, bool average) {
+  if (nyquist_margin > 0 && nyquist_margin < 1)
+    abort("use_dft_decimation needs nyquist_margin >= 1, not %g",
+	  nyquist_margin);
+  dft_nyquist_margin = nyquist_margin;
+  dft_average = average;
+  for (int i = 0; i < num_chunks; i++)
+    for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk) {
+      const double omega_max = max(fabs(cur->omega_min),
+				   fabs(cur->omega_min
+					+ (cur->Nomega - 1) * cur->domega));
+      cur->set_decimation(decimation_factor(nyquist_margin,
+					    omega_max / (2*pi), dt),
+			  average, dt);
+    }
+}
+
+void fields::use_dft_mmap(const char *dir) {
+  delete[] dft_mmap_dir;
+  dft_mmap_dir = NULL;
+  if (dir) {
+#ifndef DFT_MMAP
+    abort("fields::use_dft_mmap requires mmap");
+#endif
+    dft_mmap_dir = new char[strlen(dir) + 1];
+    strcpy(dft_mmap_dir, dir);
+  }
+}
+
+void fields::use_dft_batching(int batch) {
+  dft_batch = batch;
+  for (int i = 0; i < num_chunks; i++)
+    for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+      cur->set_batch(batch);
 }
 
 void dft_chunk::scale_dft(complex<double> scale) {
-  for (int i = 0; i < N * Nomega; ++i)
-    dft[i] *= scale;
+  flush_dft();
+  if (dft)
+    for (int n = 0; n < N; ++n) {
+      double *dr = dft + size_t(n) * 2*Nomega, *di = dr + Nomega;
+      for (int i = 0; i < Nomega; ++i) {
+	const double re = dr[i], im = di[i];
+	dr[i] = real(scale) * re - imag(scale) * im;
+	di[i] = real(scale) * im + imag(scale) * re;
+      }
+    }
   if (next_in_dft)
     next_in_dft->scale_dft(scale);
 }
 
 void dft_chunk::operator-=(const dft_chunk &chunk) {
-  if (c != chunk.c || N * Nomega != chunk.N * chunk.Nomega) abort("Mismatched chunks in dft_chunk::operator-=");
+  const size_t n = size_t(N) * 2 * Nomega;
+  if (c != chunk.c || n != size_t(chunk.N) * 2 * chunk.Nomega) abort("Mismatched chunks in dft_chunk::operator-=");
 
-  for (int i = 0; i < N * Nomega; ++i)
-    dft[i] -= chunk.dft[i];
+  flush_dft();
+  chunk.flush_dft();
+  if (dft && chunk.dft)
+    for (size_t i = 0; i < n; ++i)
+      dft[i] -= chunk.dft[i];
 
   if (next_in_dft) {
     if (!chunk.next_in_dft) abort("Mismatched chunk lists in dft_chunk::operator-=");
@@ -283,11 +668,42 @@ void dft_chunk::operator-=(const dft_chunk &chunk) {
 static int dft_chunks_Ntotal(dft_chunk *dft_chunks, int *my_start) {
   int n = 0;
   for (dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_dft)
-    n += cur->N * cur->Nomega * 2;
+    if (cur->dft) n += cur->N * cur->Nomega * 2;
   *my_start = partial_sum_to_all(n) - n; // sum(n) for processes before this
   return sum_to_all(n);
 }
 
+/* the HDF5 files store the DFT of each point as Nomega interleaved
+   (real, imaginary) pairs, i.e. as complex numbers, rather than in the
+   split layout of dft_chunk::dft; the points n0 <= n < n1 are converted
+   to/from buf */
+static void dft_to_interleaved(const dft_chunk *cur, int n0, int n1,
+			       double *buf) {
+  const int Nomega = cur->Nomega;
+  for (int n = n0; n < n1; ++n, buf += 2*Nomega)
+    for (int i = 0; i < Nomega; ++i) {
+      buf[i*2] = cur->dft[2*size_t(n)*Nomega + i];
+      buf[i*2 + 1] = cur->dft[(2*size_t(n)+1)*Nomega + i];
+    }
+}
+
+static void interleaved_to_dft(const double *buf, int n0, int n1,
+			       dft_chunk *cur) {
+  const int Nomega = cur->Nomega;
+  for (int n = n0; n < n1; ++n, buf += 2*Nomega)
+    for (int i = 0; i < Nomega; ++i) {
+      cur->dft[2*size_t(n)*Nomega + i] = buf[i*2];
+      cur->dft[(2*size_t(n)+1)*Nomega + i] = buf[i*2 + 1];
+    }
+}
+
+/* the number of points converted and written/read at a time by
+   save/load_dft_hdf5, so that a (possibly memory-mapped) dft is
+   streamed through a buffer of about 1MB rather than copied whole */
+static int dft_io_points(const dft_chunk *cur) {
+  return max(1, min(cur->N, (1 << 17) / (2 * cur->Nomega)));
+}
+
 // Note: the file must have been created in parallel mode, typically via fields::open_h5file.
 void save_dft_hdf5(dft_chunk *dft_chunks, const char *name, h5file *file,
 		   const char *dprefix) {
@@ -300,9 +716,18 @@ void save_dft_hdf5(dft_chunk *dft_chunks, const char *name, h5file *file,
   file->create_data(dataname, 1, &n);
 
   for (dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_dft) {
-    int Nchunk = cur->N * cur->Nomega * 2;
-    file->write_chunk(1, &istart, &Nchunk, (realnum *) cur->dft);
-    istart += Nchunk;
+    if (!cur->dft) continue;
+    cur->flush_dft();
+    const int np = dft_io_points(cur);
+    double *buf = new double[np * 2 * cur->Nomega];
+    for (int n0 = 0; n0 < cur->N; n0 += np) {
+      const int n1 = min(n0 + np, cur->N);
+      int Nblock = (n1 - n0) * 2 * cur->Nomega;
+      dft_to_interleaved(cur, n0, n1, buf);
+      file->write_chunk(1, &istart, &Nblock, buf);
+      istart += Nblock;
+    }
+    delete[] buf;
   }
   file->done_writing_chunks();
 }
@@ -326,9 +751,18 @@ void load_dft_hdf5(dft_chunk *dft_chunks, const char *name, h5file *file,
     abort("incorrect dataset size (%d vs. %d) in load_dft_hdf5 %s:%s", file_dims, n, file->file_name(), dataname);
   
   for (dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_dft) {
-    int Nchunk = cur->N * cur->Nomega * 2;
-    file->read_chunk(1, &istart, &Nchunk, (realnum *) cur->dft);
-    istart += Nchunk;
+    if (!cur->dft) continue;
+    cur->flush_dft();
+    const int np = dft_io_points(cur);
+    double *buf = new double[np * 2 * cur->Nomega];
+    for (int n0 = 0; n0 < cur->N; n0 += np) {
+      const int n1 = min(n0 + np, cur->N);
+      int Nblock = (n1 - n0) * 2 * cur->Nomega;
+      file->read_chunk(1, &istart, &Nblock, buf);
+      interleaved_to_dft(buf, n0, n1, cur);
+      istart += Nblock;
+    }
+    delete[] buf;
   }
 }
 
@@ -360,10 +794,16 @@ double *dft_flux::flux() {
   for (int i = 0; i < Nfreq; ++i) F[i] = 0;
   for (dft_chunk *curE = E, *curH = H; curE && curH;
        curE = curE->next_in_dft, curH = curH->next_in_dft)
-    for (int k = 0; k < curE->N; ++k)
-      for (int i = 0; i < Nfreq; ++i)
-	F[i] += real(curE->dft[k*Nfreq + i]
-		     * conj(curH->dft[k*Nfreq + i]));
+    if (curE->dft) { // else a placeholder for another process's chunk
+      curE->flush_dft();
+      curH->flush_dft();
+      for (int k = 0; k < curE->N; ++k) {
+	const double *e = curE->dft + size_t(k) * 2*Nfreq;
+	const double *h = curH->dft + size_t(k) * 2*Nfreq;
+	for (int i = 0; i < Nfreq; ++i) // Re(e conj(h))
+	  F[i] += e[i] * h[i] + e[Nfreq + i] * h[Nfreq + i];
+      }
+    }
   double *Fsum = new double[Nfreq];
   sum_to_all(F, Fsum, Nfreq);
   delete[] F;
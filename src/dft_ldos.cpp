@@ -34,8 +34,8 @@ dft_ldos::dft_ldos(double freq_min, double freq_max, int Nfreq)
     domega = (freq_max - freq_min) * 2*pi / Nfreq;
     Nomega = Nfreq;
   }
-  Fdft = new complex<realnum>[Nomega];
-  Jdft = new complex<realnum>[Nomega];
+  Fdft = new complex<double>[Nomega];
+  Jdft = new complex<double>[Nomega];
   for (int i = 0; i < Nomega; ++i) Fdft[i] = Jdft[i] = 0.0;
   Jsum = 1.0;
 }
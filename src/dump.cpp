@@ -0,0 +1,625 @@
+/* Copyright (C) 2005-2015 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* Checkpointing: dumping the complete state of a structure or of a
+   fields object to an HDF5 file, and loading it back into an object
+   with the same chunk layout, i.e. created by the same calls.  By
+   default the number of chunks is the number of processes, so to load
+   a dump with a different number of processes, the number of chunks
+   must be passed explicitly to the structure constructor.
+
+   The per-chunk arrays of a given kind are stored, in chunk order, in
+   a single 1d dataset, which the owner of each chunk writes (or reads)
+   its part of with h5file::write_chunk (read_chunk), so that all
+   processes do their I/O concurrently.  Which arrays are allocated is
+   stored in a separate, much smaller, dataset of flags, which every
+   process reads, from which every process can compute where the data
+   of each chunk lies.  The data are stored with the precision of
+   realnum, so that a dump/load cycle is exact.
+
+   The sources, DFTs and susceptibilities themselves (and, for
+   fields, the structure) are not stored: they must be set up in the
+   same way, and in the same order, before calling load, which then
+   overwrites their state (the accumulated DFTs and their partially
+   summed decimation steps, the polarizations, and the current time,
+   from which the current source amplitudes follow). */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "meep.hpp"
+#include "meep_internals.hpp"
+
+using namespace std;
+
+namespace meep {
+
+/* Compute the start of the data of every chunk, given the size of
+   the data of the chunks owned by this process (0 for the others),
+   returning the total size, which must fit in the int dimensions of
+   h5file (so that the size of the data of any one chunk does too). */
+static int chunk_starts(int num_chunks, const double *size_mine, int *start) {
+  double *size = new double[num_chunks];
+  sum_to_all(size_mine, size, num_chunks);
+  int n = 0;
+  for (int i = 0; i < num_chunks; ++i) {
+    if (n + size[i] > INT_MAX)
+      abort("too much data (more than %d numbers) for one dataset", INT_MAX);
+    start[i] = n;
+    n += int(size[i]);
+  }
+  delete[] size;
+  return n;
+}
+
+/* Write the flags (nflags per chunk, set on the owner of each chunk
+   and zero elsewhere) to dataset name, returning the flags of all
+   chunks. */
+static int *write_flags(h5file *file, const char *name,
+			int num_chunks, int nflags, const int *flags_mine) {
+  const int n = num_chunks * nflags;
+  double *fl_mine = new double[n], *fl = new double[n];
+  for (int i = 0; i < n; ++i) fl_mine[i] = flags_mine[i];
+  sum_to_all(fl_mine, fl, n);
+  int *flags = new int[n];
+  realnum *data = new realnum[n];
+  for (int i = 0; i < n; ++i) data[i] = flags[i] = int(fl[i]);
+  int dims[2] = {num_chunks, nflags};
+  file->write(name, 2, dims, data, false);
+  file->prevent_deadlock(); // hackery
+  delete[] data;
+  delete[] fl;
+  delete[] fl_mine;
+  return flags;
+}
+
+static int *read_flags(h5file *file, const char *name,
+		       int num_chunks, int nflags) {
+  int rank, dims[2];
+  realnum *data = file->read(name, &rank, dims, 2);
+  if (!data || rank != 2 || dims[0] != num_chunks || dims[1] != nflags)
+    abort("%s:%s does not match the chunk layout", file->file_name(), name);
+  const int n = num_chunks * nflags;
+  int *flags = new int[n];
+  for (int i = 0; i < n; ++i) flags[i] = int(data[i]);
+  delete[] data;
+  file->prevent_deadlock(); // hackery
+  return flags;
+}
+
+/* Open dataset name for reading, and check that it has n elements. */
+static void read_data_size(h5file *file, const char *name, int n) {
+  int rank, dims;
+  file->read_size(name, &rank, &dims, 1);
+  if (rank != 1 || dims != n)
+    abort("incorrect dataset size (%d vs. %d) in %s:%s",
+	  dims, n, file->file_name(), name);
+}
+
+/* Allocate or deallocate the array a according to flag (bit 0 means
+   allocated) on loading; n is the array length. */
+template<class T> static void load_alloc(T *&a, int flag, int n) {
+  if (!(flag & 1)) {
+    delete[] a;
+    a = NULL;
+  }
+  else if (!a)
+    a = new T[n];
+}
+
+/* The number of words that internal polarization data of sz bytes
+   take up in the dataset. */
+static int pol_words(size_t sz) {
+  return int((sz + sizeof(realnum) - 1) / sizeof(realnum));
+}
+
+/* Size of the decimation state of a DFT chunk (see
+   dft_chunk::set_decimation): the step nstep within the current k
+   steps, their start time t_first and, with average, the sums favg. */
+static int decimation_words(const dft_chunk *cur) {
+  if (!cur->dft || cur->decimation <= 1) return 0;
+  return 2 + (cur->average ? cur->N * 2 : 0);
+}
+
+/****************************************************************/
+/* structure dump/load */
+
+/* The material arrays of a structure_chunk, numbered as: chi1inv[c][d],
+   conductivity[c][d], chi2[c], chi3[c], then sigma[c][d] of each
+   susceptibility of chiP[E_stuff], chiP[H_stuff]... in turn.  The
+   condinv cache is recomputed and the PML profiles are determined by
+   the boundary regions, so they are not stored. */
+#define NUM_STRUCTURE_ARRAYS (NUM_FIELD_COMPONENTS * 12)
+
+static int count_susceptibilities(const structure_chunk *s) {
+  int n = 0;
+  FOR_FIELD_TYPES(ft)
+    for (const susceptibility *sus = s->chiP[ft]; sus; sus = sus->next) ++n;
+  return n;
+}
+
+/* Return the array number k of s and set *trivial to its trivial_*
+   flag, or to NULL if it has none. */
+static realnum *&structure_array(structure_chunk *s, int k, bool **trivial) {
+  *trivial = NULL;
+  if (k >= NUM_STRUCTURE_ARRAYS) {
+    k -= NUM_STRUCTURE_ARRAYS;
+    const int isus = k / (NUM_FIELD_COMPONENTS * 5);
+    k %= NUM_FIELD_COMPONENTS * 5;
+    susceptibility *sus = NULL;
+    int i = 0;
+    FOR_FIELD_TYPES(ft)
+      for (susceptibility *cur = s->chiP[ft]; cur; cur = cur->next)
+	if (i++ == isus) sus = cur;
+    if (!sus) abort("bug: invalid susceptibility in structure_array");
+    *trivial = &sus->trivial_sigma[k / 5][k % 5];
+    return sus->sigma[k / 5][k % 5];
+  }
+  if (k < NUM_FIELD_COMPONENTS * 5) {
+    *trivial = &s->trivial_chi1inv[k / 5][k % 5];
+    return s->chi1inv[k / 5][k % 5];
+  }
+  k -= NUM_FIELD_COMPONENTS * 5;
+  if (k < NUM_FIELD_COMPONENTS * 5)
+    return s->conductivity[k / 5][k % 5];
+  k -= NUM_FIELD_COMPONENTS * 5;
+  if (k < NUM_FIELD_COMPONENTS) return s->chi2[k];
+  return s->chi3[k - NUM_FIELD_COMPONENTS];
+}
+
+static int structure_narrays(structure_chunk *s) {
+  return NUM_STRUCTURE_ARRAYS
+    + count_susceptibilities(s) * NUM_FIELD_COMPONENTS * 5;
+}
+
+/* The flags of the structure arrays are 1 if allocated, plus 2 if
+   trivial (e.g. chi1inv is 1 or 0 everywhere). */
+void structure::dump(h5file *file) {
+  const int na = structure_narrays(chunks[0]);
+  for (int i = 1; i < num_chunks; ++i)
+    if (structure_narrays(chunks[i]) != na)
+      abort("bug: chunks with different susceptibilities in structure::dump");
+  for (int i = 0; i < num_chunks; ++i) // dump the full chi1inv arrays
+    chunks[i]->expand_chi1inv();
+
+  int *flags_mine = new int[num_chunks * na];
+  for (int i = 0; i < num_chunks; ++i)
+    for (int k = 0; k < na; ++k) {
+      bool *trivial;
+      realnum *a = structure_array(chunks[i], k, &trivial);
+      flags_mine[i*na + k] = chunks[i]->is_mine() ?
+	(a ? 1 : 0) + (trivial && *trivial ? 2 : 0) : 0;
+    }
+  int *flags = write_flags(file, "structure_flags", num_chunks, na,
+			   flags_mine);
+  delete[] flags_mine;
+
+  double *size_mine = new double[num_chunks];
+  int *start = new int[num_chunks];
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    if (chunks[i]->is_mine())
+      for (int k = 0; k < na; ++k)
+	if (flags[i*na + k] & 1) size_mine[i] += chunks[i]->gv.ntot();
+  }
+  int n = chunk_starts(num_chunks, size_mine, start);
+
+  file->create_data("structure_data", 1, &n, false, false);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine()) {
+      int ntot = chunks[i]->gv.ntot();
+      for (int k = 0; k < na; ++k)
+	if (flags[i*na + k] & 1) {
+	  bool *trivial;
+	  file->write_chunk(1, &start[i], &ntot,
+			    structure_array(chunks[i], k, &trivial));
+	  start[i] += ntot;
+	}
+    }
+  file->done_writing_chunks();
+  file->prevent_deadlock(); // hackery
+  for (int i = 0; i < num_chunks; ++i) chunks[i]->compress_chi1inv();
+
+  delete[] start;
+  delete[] size_mine;
+  delete[] flags;
+}
+
+/* The structure must have the same chunk layout and susceptibilities
+   as the dumped one, and should be loaded before any fields are
+   created for it. */
+void structure::load(h5file *file) {
+  changing_chunks();
+  const int na = structure_narrays(chunks[0]);
+  int *flags = read_flags(file, "structure_flags", num_chunks, na);
+  for (int i = 0; i < num_chunks; ++i) chunks[i]->expand_chi1inv();
+
+  double *size_mine = new double[num_chunks];
+  int *start = new int[num_chunks];
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    for (int k = 0; k < na; ++k) {
+      bool *trivial;
+      realnum *&a = structure_array(chunks[i], k, &trivial);
+      const int flag = flags[i*na + k];
+      if (trivial) *trivial = flag & 2;
+      if (!chunks[i]->is_mine()) continue;
+      load_alloc(a, flag, chunks[i]->gv.ntot());
+      if (flag & 1) size_mine[i] += chunks[i]->gv.ntot();
+    }
+    chunks[i]->condinv_stale = true;
+  }
+  int n = chunk_starts(num_chunks, size_mine, start);
+
+  read_data_size(file, "structure_data", n);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine()) {
+      int ntot = chunks[i]->gv.ntot();
+      for (int k = 0; k < na; ++k)
+	if (flags[i*na + k] & 1) {
+	  bool *trivial;
+	  file->read_chunk(1, &start[i], &ntot,
+			   structure_array(chunks[i], k, &trivial));
+	  start[i] += ntot;
+	}
+    }
+  file->prevent_deadlock(); // hackery
+  for (int i = 0; i < num_chunks; ++i) chunks[i]->compress_chi1inv();
+
+  delete[] start;
+  delete[] size_mine;
+  delete[] flags;
+}
+
+/****************************************************************/
+/* fields dump/load */
+
+/* The field arrays of a fields_chunk, numbered as f[c][cmp], f_u,
+   f_w, f_cond, f_minus_p and f_w_prev in turn.  Their flags are 1 if
+   allocated, or 2 if a magnetic field is stored in the same array as
+   B (see alloc_f), in which case the array is stored only once. */
+#define NUM_FIELDS_ARRAYS (NUM_FIELD_COMPONENTS * 2 * 6)
+
+static realnum *&fields_array(fields_chunk *fc, int k) {
+  const int cmp = k % 2, c = (k / 2) % NUM_FIELD_COMPONENTS;
+  switch (k / (2 * NUM_FIELD_COMPONENTS)) {
+  case 0: return fc->f[c][cmp];
+  case 1: return fc->f_u[c][cmp];
+  case 2: return fc->f_w[c][cmp];
+  case 3: return fc->f_cond[c][cmp];
+  case 4: return fc->f_minus_p[c][cmp];
+  default: return fc->f_w_prev[c][cmp];
+  }
+}
+
+// the B component whose array f[c][cmp] may share, or c itself
+static component alias_component(component c) {
+  return is_magnetic(c) ? direction_component(Bx, component_direction(c)) : c;
+}
+
+static int count_pols(const fields_chunk *fc) {
+  int n = 0;
+  FOR_FIELD_TYPES(ft)
+    for (polarization_state *p = fc->pol[ft]; p; p = p->next) ++n;
+  return n;
+}
+
+/* Write the field arrays, internal polarization data and DFTs of each
+   chunk, as described at the top of this file; if the current time
+   is needed to compute the state of anything else (e.g. a custom
+   source), that is up to the caller.  The fields must not be
+   synchronized (see synchronize_magnetic_fields). */
+void fields::dump(h5file *file) {
+  if (synchronized_magnetic_fields || is_phasing())
+    abort("can't dump fields while they are synchronized or phasing");
+  am_now_working_on(FieldOutput);
+
+  file->write_int("fields_t", t);
+  file->prevent_deadlock(); // hackery
+
+  // field arrays
+  int *flags_mine = new int[num_chunks * NUM_FIELDS_ARRAYS];
+  for (int i = 0; i < num_chunks; ++i)
+    for (int k = 0; k < NUM_FIELDS_ARRAYS; ++k) {
+      int &flag = flags_mine[i*NUM_FIELDS_ARRAYS + k];
+      flag = 0;
+      if (!chunks[i]->is_mine() || !fields_array(chunks[i], k)) continue;
+      flag = 1;
+      if (k < NUM_FIELD_COMPONENTS * 2) {
+	const component c = component(k / 2), bc = alias_component(c);
+	if (bc != c && chunks[i]->f[c][k % 2] == chunks[i]->f[bc][k % 2])
+	  flag = 2;
+      }
+    }
+  int *flags = write_flags(file, "fields_flags", num_chunks,
+			   NUM_FIELDS_ARRAYS, flags_mine);
+  delete[] flags_mine;
+
+  double *size_mine = new double[num_chunks];
+  int *start = new int[num_chunks];
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    if (chunks[i]->is_mine())
+      for (int k = 0; k < NUM_FIELDS_ARRAYS; ++k)
+	if (flags[i*NUM_FIELDS_ARRAYS + k] == 1)
+	  size_mine[i] += chunks[i]->gv.ntot();
+  }
+  int n = chunk_starts(num_chunks, size_mine, start);
+  file->create_data("fields_data", 1, &n, false, false);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine()) {
+      int ntot = chunks[i]->gv.ntot();
+      for (int k = 0; k < NUM_FIELDS_ARRAYS; ++k)
+	if (flags[i*NUM_FIELDS_ARRAYS + k] == 1) {
+	  file->write_chunk(1, &start[i], &ntot, fields_array(chunks[i], k));
+	  start[i] += ntot;
+	}
+    }
+  file->done_writing_chunks();
+  file->prevent_deadlock(); // hackery
+  delete[] flags;
+
+  /* internal polarization data, stored as a raw block (pointers
+     and all) that copy_internal_data can turn back into a copy */
+  const int npols = count_pols(chunks[0]);
+  flags_mine = new int[num_chunks * npols];
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    int ip = 0;
+    FOR_FIELD_TYPES(ft)
+      for (polarization_state *p = chunks[i]->pol[ft]; p; p = p->next, ++ip) {
+	flags_mine[i*npols + ip] = 0;
+	if (!chunks[i]->is_mine() || !p->data) continue;
+	const size_t sz = p->s->size_internal_data(p->data);
+	if (!sz) abort("can't dump the polarization of this susceptibility");
+	flags_mine[i*npols + ip] = 1;
+	size_mine[i] += pol_words(sz);
+      }
+  }
+  flags = write_flags(file, "pol_flags", num_chunks, npols, flags_mine);
+  delete[] flags_mine;
+  delete[] flags;
+  n = chunk_starts(num_chunks, size_mine, start);
+  file->create_data("pol_data", 1, &n, false, false);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine())
+      FOR_FIELD_TYPES(ft)
+	for (polarization_state *p = chunks[i]->pol[ft]; p; p = p->next)
+	  if (p->data) {
+	    const size_t sz = p->s->size_internal_data(p->data);
+	    int nw = pol_words(sz);
+	    realnum *buf = (realnum *) p->data;
+	    if (sz % sizeof(realnum)) { // pad the last word
+	      buf = new realnum[nw];
+	      buf[nw - 1] = 0;
+	      memcpy(buf, p->data, sz);
+	    }
+	    file->write_chunk(1, &start[i], &nw, buf);
+	    start[i] += nw;
+	    if (buf != (realnum *) p->data) delete[] buf;
+	  }
+  file->done_writing_chunks();
+  file->prevent_deadlock(); // hackery
+
+  // DFTs, in the order of each chunk's dft_chunks list
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur;
+	   cur = cur->next_in_chunk)
+	if (cur->dft) size_mine[i] += double(cur->N) * cur->Nomega * 2;
+  }
+  n = chunk_starts(num_chunks, size_mine, start);
+  file->create_data("dft_data", 1, &n, false, false);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur;
+	   cur = cur->next_in_chunk)
+	if (cur->dft) {
+	  int ndft = int(size_t(cur->N) * cur->Nomega * 2); // see chunk_starts
+	  cur->flush_dft();
+	  file->write_chunk(1, &start[i], &ndft, cur->dft);
+	  start[i] += ndft;
+	}
+  file->done_writing_chunks();
+  file->prevent_deadlock(); // hackery
+
+  // partially summed decimation steps of the DFTs
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur;
+	   cur = cur->next_in_chunk)
+	size_mine[i] += decimation_words(cur);
+  }
+  n = chunk_starts(num_chunks, size_mine, start);
+  file->create_data("dft_decimation", 1, &n, false, false);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur;
+	   cur = cur->next_in_chunk) {
+	int nw = decimation_words(cur);
+	if (!nw) continue;
+	double *buf = new double[nw];
+	buf[0] = cur->nstep;
+	buf[1] = cur->t_first;
+	for (int k = 2; k < nw; ++k)
+	  buf[k] = cur->favg ? cur->favg[k - 2] : 0.0;
+	file->write_chunk(1, &start[i], &nw, buf);
+	start[i] += nw;
+	delete[] buf;
+      }
+  file->done_writing_chunks();
+  file->prevent_deadlock(); // hackery
+
+  delete[] start;
+  delete[] size_mine;
+  finished_working();
+}
+
+/* Load fields dumped by fields::dump into fields with the same chunk
+   layout, sources, DFTs and susceptibilities, replacing the current
+   fields, polarizations, DFTs and time. */
+void fields::load(h5file *file) {
+  if (synchronized_magnetic_fields || is_phasing())
+    abort("can't load fields while they are synchronized or phasing");
+  am_now_working_on(FieldOutput);
+
+  t = file->read_int("fields_t");
+  file->prevent_deadlock(); // hackery
+
+  disconnect_chunks(); // the connections point into the fields
+
+  // field arrays
+  int *flags = read_flags(file, "fields_flags", num_chunks, NUM_FIELDS_ARRAYS);
+  double *size_mine = new double[num_chunks];
+  int *start = new int[num_chunks];
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    fields_chunk *fc = chunks[i];
+    if (!fc->is_mine()) continue;
+    const int ntot = fc->gv.ntot();
+    FOR_COMPONENTS(c) DOCMP2 { // unshare H from B before (de)allocating
+      const component bc = alias_component(c);
+      if (bc != c && fc->f[c][cmp] == fc->f[bc][cmp]) fc->f[c][cmp] = NULL;
+    }
+    for (int k = 0; k < NUM_FIELDS_ARRAYS; ++k) {
+      const int flag = flags[i*NUM_FIELDS_ARRAYS + k];
+      load_alloc(fields_array(fc, k), flag == 1, ntot);
+      if (flag == 1) size_mine[i] += ntot;
+    }
+    FOR_COMPONENTS(c) DOCMP2
+      if (flags[i*NUM_FIELDS_ARRAYS + c*2 + cmp] == 2)
+	fc->f[c][cmp] = fc->f[alias_component(c)][cmp];
+  }
+  int n = chunk_starts(num_chunks, size_mine, start);
+  read_data_size(file, "fields_data", n);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine()) {
+      int ntot = chunks[i]->gv.ntot();
+      for (int k = 0; k < NUM_FIELDS_ARRAYS; ++k)
+	if (flags[i*NUM_FIELDS_ARRAYS + k] == 1) {
+	  file->read_chunk(1, &start[i], &ntot, fields_array(chunks[i], k));
+	  start[i] += ntot;
+	}
+      chunks[i]->figure_out_step_plan();
+    }
+  file->prevent_deadlock(); // hackery
+  delete[] flags;
+
+  /* internal polarization data: allocated as usual (now that the
+     fields are), then replaced by a copy of the stored block */
+  const int npols = count_pols(chunks[0]);
+  flags = read_flags(file, "pol_flags", num_chunks, npols);
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    fields_chunk *fc = chunks[i];
+    if (!fc->is_mine()) continue;
+    int ip = 0;
+    FOR_FIELD_TYPES(ft)
+      for (polarization_state *p = fc->pol[ft]; p; p = p->next, ++ip)
+	if (!flags[i*npols + ip]) {
+	  p->s->delete_internal_data(p->data);
+	  p->data = NULL;
+	}
+	else {
+	  if (!p->data) {
+	    p->data = p->s->new_internal_data(fc->f, fc->gv);
+	    if (!p->data) abort("no polarization data to load into");
+	    p->s->init_internal_data(fc->f, fc->dt, fc->gv, p->data);
+	  }
+	  const size_t sz = p->s->size_internal_data(p->data);
+	  if (!sz) abort("can't load the polarization of this susceptibility");
+	  size_mine[i] += pol_words(sz);
+	}
+  }
+  n = chunk_starts(num_chunks, size_mine, start);
+  read_data_size(file, "pol_data", n);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine())
+      FOR_FIELD_TYPES(ft)
+	for (polarization_state *p = chunks[i]->pol[ft]; p; p = p->next)
+	  if (p->data) {
+	    int nw = pol_words(p->s->size_internal_data(p->data));
+	    realnum *buf = new realnum[nw];
+	    file->read_chunk(1, &start[i], &nw, buf);
+	    start[i] += nw;
+	    p->s->delete_internal_data(p->data);
+	    p->data = p->s->copy_internal_data(buf);
+	    delete[] buf;
+	  }
+  file->prevent_deadlock(); // hackery
+  delete[] flags;
+
+  // DFTs
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur;
+	   cur = cur->next_in_chunk)
+	if (cur->dft) size_mine[i] += double(cur->N) * cur->Nomega * 2;
+  }
+  n = chunk_starts(num_chunks, size_mine, start);
+  read_data_size(file, "dft_data", n);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur;
+	   cur = cur->next_in_chunk)
+	if (cur->dft) {
+	  int ndft = int(size_t(cur->N) * cur->Nomega * 2); // see chunk_starts
+	  cur->flush_dft();
+	  file->read_chunk(1, &start[i], &ndft, cur->dft);
+	  start[i] += ndft;
+	}
+  file->prevent_deadlock(); // hackery
+
+  for (int i = 0; i < num_chunks; ++i) {
+    size_mine[i] = 0;
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur;
+	   cur = cur->next_in_chunk)
+	size_mine[i] += decimation_words(cur);
+  }
+  n = chunk_starts(num_chunks, size_mine, start);
+  read_data_size(file, "dft_decimation", n);
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur;
+	   cur = cur->next_in_chunk) {
+	int nw = decimation_words(cur);
+	if (!nw) continue;
+	double *buf = new double[nw];
+	file->read_chunk(1, &start[i], &nw, buf);
+	start[i] += nw;
+	cur->nstep = int(buf[0]);
+	cur->t_first = buf[1];
+	if (cur->average) {
+	  if (!cur->favg) cur->favg = new double[cur->N * 2];
+	  for (int k = 2; k < nw; ++k) cur->favg[k - 2] = buf[k];
+	}
+	delete[] buf;
+      }
+  file->prevent_deadlock(); // hackery
+
+  delete[] start;
+  delete[] size_mine;
+  calc_sources(time()); // the current amplitudes of the sources
+  finished_working();
+}
+
+} // namespace meep
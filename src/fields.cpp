@@ -50,6 +50,7 @@ fields::fields(structure *s, double m, double beta,
   working_on = Other;
   for (int i=0;i<=Other;i++) times_spent[i] = 0.0;
   last_wall_time = last_step_output_wall_time = -1;
+  comm_overlap_time = 0;
   am_now_working_on(Other);
 
   num_chunks = s->num_chunks;
@@ -67,11 +68,25 @@ fields::fields(structure *s, double m, double beta,
     comm_blocks[ft] = new realnum_ptr[num_chunks*num_chunks];
     for (int i=0;i<num_chunks*num_chunks;i++)
       comm_blocks[ft][i] = 0;
+    for (int io=0;io<2;io++) {
+      comm_pairs[ft][io] = NULL;
+      num_comm_pairs[ft][io] = 0;
+    }
+    comm_plan[ft] = NULL;
   }
   for (int b=0;b<2;b++) FOR_DIRECTIONS(d)
     if (gv.has_boundary((boundary_side)b, d)) boundaries[b][d] = Metallic;
     else boundaries[b][d] = None;
   chunk_connections_valid = false;
+  may_allocate_fields = true;
+  pending_comms = NULL;
+  overlap_comm = false;
+  rebalance_threshold = 1.2;
+  rebalance_interval = 0;
+  dft_batch = 1;
+  dft_nyquist_margin = 0;
+  dft_average = true;
+  dft_mmap_dir = NULL;
   
   // unit directions are periodic by default:
   FOR_DIRECTIONS(d)
@@ -102,6 +117,7 @@ fields::fields(const fields &thef) :
   working_on = Other;
   for (int i=0;i<=Other;i++) times_spent[i] = 0.0;
   last_wall_time = -1;
+  comm_overlap_time = 0;
   am_now_working_on(Other);
 
   num_chunks = thef.num_chunks;
@@ -118,19 +134,36 @@ fields::fields(const fields &thef) :
     comm_blocks[ft] = new realnum_ptr[num_chunks*num_chunks];
     for (int i=0;i<num_chunks*num_chunks;i++)
       comm_blocks[ft][i] = 0;
+    for (int io=0;io<2;io++) {
+      comm_pairs[ft][io] = NULL;
+      num_comm_pairs[ft][io] = 0;
+    }
+    comm_plan[ft] = NULL;
   }
   for (int b=0;b<2;b++) FOR_DIRECTIONS(d)
     boundaries[b][d] = thef.boundaries[b][d];
   chunk_connections_valid = false;
+  may_allocate_fields = true;
+  pending_comms = NULL;
+  overlap_comm = thef.overlap_comm;
+  rebalance_threshold = thef.rebalance_threshold;
+  rebalance_interval = thef.rebalance_interval;
+  dft_batch = thef.dft_batch;
+  dft_nyquist_margin = thef.dft_nyquist_margin;
+  dft_average = thef.dft_average;
+  dft_mmap_dir = NULL;
+  use_dft_mmap(thef.dft_mmap_dir);
 }
 
 fields::~fields() {
+  free_boundary_communications();
   for (int i=0;i<num_chunks;i++) delete chunks[i];
   delete[] chunks;
   FOR_FIELD_TYPES(ft) {
     for (int i=0;i<num_chunks*num_chunks;i++)
       delete[] comm_blocks[ft][i];
     delete[] comm_blocks[ft];
+    for (int io=0;io<2;io++) delete[] comm_pairs[ft][io];
     for (int ip=0;ip<3;ip++)
       delete[] comm_sizes[ft][ip];
   }
@@ -138,6 +171,7 @@ fields::~fields() {
   delete fluxes;
   delete bands;
   delete[] outdir;
+  delete[] dft_mmap_dir;
   if (!quiet) print_times();
 }
 
@@ -183,8 +217,10 @@ fields_chunk::~fields_chunk() {
   delete[] f_rderiv_int;
   FOR_FIELD_TYPES(ft)
     for (int ip=0;ip<3;ip++)
-      for (int io=0;io<2;io++)
+      for (int io=0;io<2;io++) {
 	delete[] connections[ft][ip][io];
+	delete[] connection_runs[ft][ip][io];
+      }
   FOR_FIELD_TYPES(ft) delete[] connection_phases[ft];
   while (dft_chunks) {
     dft_chunk *nxt = dft_chunks->next_in_chunk;
@@ -212,6 +248,8 @@ fields_chunk::fields_chunk(structure_chunk *the_s, const char *od,
   new_s = NULL;
   bands = NULL;
   is_real = 0;
+  tile_size = 0;
+  work_time = 0;
   a = s->a;
   Courant = s->Courant;
   dt = s->dt;
@@ -250,11 +288,19 @@ fields_chunk::fields_chunk(structure_chunk *the_s, const char *od,
       num_connections[ft][ip][Incoming] 
 	= num_connections[ft][ip][Outgoing] = 0;
     connection_phases[ft] = 0;
-    for (int ip=0;ip<3;ip++) for (int io=0;io<2;io++)
+    for (int ip=0;ip<3;ip++) for (int io=0;io<2;io++) {
       connections[ft][ip][io] = NULL;
+      connection_runs[ft][ip][io] = NULL;
+      num_connection_runs[ft][ip][io] = 0;
+    }
     zeroes[ft] = NULL;
     num_zeroes[ft] = 0;
   }
+  FOR_DIRECTIONS(d) halo_depth[d][High] = halo_depth[d][Low] = 0;
+  for (int i = 0; i < 2; ++i) {
+    skip_lo[i] = ivec(gv.dim, 1);
+    skip_hi[i] = ivec(gv.dim, 0);
+  }
   figure_out_step_plan();
 }
 
@@ -269,6 +315,8 @@ fields_chunk::fields_chunk(const fields_chunk &thef)
   new_s = thef.new_s; new_s->refcount++;
   bands = NULL;
   is_real = thef.is_real;
+  tile_size = thef.tile_size;
+  work_time = 0;
   a = thef.a;
   Courant = thef.Courant;
   dt = thef.dt;
@@ -330,11 +378,19 @@ fields_chunk::fields_chunk(const fields_chunk &thef)
       num_connections[ft][ip][Incoming] 
 	= num_connections[ft][ip][Outgoing] = 0;
     connection_phases[ft] = 0;
-    for (int ip=0;ip<3;ip++) for (int io=0;io<2;io++)
+    for (int ip=0;ip<3;ip++) for (int io=0;io<2;io++) {
       connections[ft][ip][io] = NULL;
+      connection_runs[ft][ip][io] = NULL;
+      num_connection_runs[ft][ip][io] = 0;
+    }
     zeroes[ft] = NULL;
     num_zeroes[ft] = 0;
   }
+  FOR_DIRECTIONS(d) halo_depth[d][High] = halo_depth[d][Low] = 0;
+  for (int i = 0; i < 2; ++i) {
+    skip_lo[i] = ivec(gv.dim, 1);
+    skip_hi[i] = ivec(gv.dim, 0);
+  }
   FOR_COMPONENTS(c) DOCMP2 {
     if (thef.f_minus_p[c][cmp]) {
       f_minus_p[c][cmp] = new realnum[gv.ntot()];
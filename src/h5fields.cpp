@@ -166,9 +166,11 @@ static void h5_output_chunkloop(fields_chunk *fc, int ichnk, component cgrid,
       if (cS[i] == Dielectric) {
 	double tr = 0.0;
 	for (int k = 0; k < data->ninveps; ++k) {
-	  const realnum *ie = fc->s->chi1inv[iecs[k]][ieds[k]];
-	  if (ie) tr += (ie[idx] + ie[idx+ieos[2*k]] + ie[idx+ieos[1+2*k]]
-			 + ie[idx+ieos[2*k]+ieos[1+2*k]]);
+	  const component c = iecs[k]; const direction d = ieds[k];
+	  if (fc->s->chi1inv[c][d])
+	    tr += (fc->s->chi1inv_at(c, d, idx) + fc->s->chi1inv_at(c, d, idx+ieos[2*k])
+		 + fc->s->chi1inv_at(c, d, idx+ieos[1+2*k])
+		 + fc->s->chi1inv_at(c, d, idx+ieos[2*k]+ieos[1+2*k]));
 	  else tr += 4; // default inveps == 1
 	}
 	fields[i] = (4 * data->ninveps) / tr;
@@ -176,9 +178,11 @@ static void h5_output_chunkloop(fields_chunk *fc, int ichnk, component cgrid,
       else if (cS[i] == Permeability) {
 	double tr = 0.0;
 	for (int k = 0; k < data->ninvmu; ++k) {
-	  const realnum *im = fc->s->chi1inv[imcs[k]][imds[k]];
-	  if (im) tr += (im[idx] + im[idx+imos[2*k]] + im[idx+imos[1+2*k]]
-			 + im[idx+imos[2*k]+imos[1+2*k]]);
+	  const component c = imcs[k]; const direction d = imds[k];
+	  if (fc->s->chi1inv[c][d])
+	    tr += (fc->s->chi1inv_at(c, d, idx) + fc->s->chi1inv_at(c, d, idx+imos[2*k])
+		 + fc->s->chi1inv_at(c, d, idx+imos[1+2*k])
+		 + fc->s->chi1inv_at(c, d, idx+imos[2*k]+imos[1+2*k]));
 	  else tr += 4; // default invmu == 1
 	}
 	fields[i] = (4 * data->ninvmu) / tr;
@@ -436,6 +436,68 @@ char *h5file::read(const char *dataname)
 #endif
 }
 
+/* A single integer, stored as an integer dataset (e.g. a time step,
+   which a realnum dataset might not store exactly). */
+void h5file::write_int(const char *dataname, int data)
+{
+#ifdef HAVE_HDF5
+  if (IF_EXCLUSIVE(am_master(), parallel || am_master())) {
+    hid_t file_id = HID(get_id()), data_id, space_id;
+
+    CHECK(file_id >= 0, "error opening HDF5 output file");
+
+    remove_data(dataname); // HDF5 gives error if we H5Dcreate existing dataset
+
+    space_id = H5Screate(H5S_SCALAR);
+    data_id = H5Dcreate(file_id, dataname, H5T_NATIVE_INT, space_id,
+			H5P_DEFAULT);
+    if (am_master())
+      H5Dwrite(data_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data);
+
+    H5Sclose(space_id);
+    H5Dclose(data_id);
+  }
+#else
+  abort("not compiled with HDF5, required for HDF5 output");
+#endif
+}
+
+int h5file::read_int(const char *dataname)
+{
+#ifdef HAVE_HDF5
+  int data = 0;
+  if (parallel || am_master()) {
+    hid_t file_id = HID(get_id()), space_id, data_id;
+
+    CHECK(file_id >= 0, "error opening HDF5 input file");
+
+    if (is_cur(dataname))
+      unset_cur();
+
+    CHECK(dataset_exists(file_id, dataname),
+	  "missing dataset in HDF5 file");
+
+    data_id = H5Dopen(file_id, dataname);
+    space_id = H5Dget_space(data_id);
+
+    CHECK(H5Sget_simple_extent_npoints(space_id) == 1,
+	  "expected single integer in HDF5 file, but didn't get one");
+
+    H5Dread(data_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data);
+
+    H5Sclose(space_id);
+    H5Dclose(data_id);
+  }
+
+  if (!parallel)
+    data = broadcast(0, data);
+
+  return data;
+#else
+  return 0;
+#endif
+}
+
 /*****************************************************************************/
 
 /* Delete a dataset, if it exists.  In parallel mode, should be called
@@ -643,7 +705,21 @@ void h5file::create_or_extend_data(const char *dataname, int rank,
 */
 void h5file::write_chunk(int rank,
 			 const int *chunk_start, const int *chunk_dims,
-			 realnum *data)
+			 float *data)
+{
+  write_chunk(rank, chunk_start, chunk_dims, (void *) data, true);
+}
+
+void h5file::write_chunk(int rank,
+			 const int *chunk_start, const int *chunk_dims,
+			 double *data)
+{
+  write_chunk(rank, chunk_start, chunk_dims, (void *) data, false);
+}
+
+void h5file::write_chunk(int rank,
+			 const int *chunk_start, const int *chunk_dims,
+			 void *data, bool single_precision)
 {
 #ifdef HAVE_HDF5
   int i;
@@ -709,8 +785,8 @@ void h5file::write_chunk(int rank,
   
   if (do_write)
     H5Dwrite(data_id,
-	     REALNUM_H5T, mem_space_id, space_id, H5P_DEFAULT, 
-	     (void *) data);
+	     single_precision ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE,
+	     mem_space_id, space_id, H5P_DEFAULT, data);
   
   H5Sclose(mem_space_id);
   H5Sclose(space_id);
@@ -780,8 +856,21 @@ void h5file::write(const char *dataname, const char *data)
    (which also opens the dataset for reading). */
 void h5file::read_chunk(int rank,
 			const int *chunk_start, const int *chunk_dims,
-			realnum *data)
+			float *data)
+{
+  read_chunk(rank, chunk_start, chunk_dims, (void *) data, true);
+}
+
+void h5file::read_chunk(int rank,
+			const int *chunk_start, const int *chunk_dims,
+			double *data)
+{
+  read_chunk(rank, chunk_start, chunk_dims, (void *) data, false);
+}
 
+void h5file::read_chunk(int rank,
+			const int *chunk_start, const int *chunk_dims,
+			void *data, bool single_precision)
 {
 #ifdef HAVE_HDF5
   bool do_read = true;
@@ -838,8 +927,8 @@ void h5file::read_chunk(int rank,
   /* Read the data, then free all the stuff we've allocated. */
   
   if (do_read)
-    H5Dread(data_id, REALNUM_H5T, mem_space_id, space_id, H5P_DEFAULT,
-	    (void *) data);
+    H5Dread(data_id, single_precision ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE,
+	    mem_space_id, space_id, H5P_DEFAULT, data);
   
   H5Sclose(mem_space_id);
   H5Sclose(space_id);
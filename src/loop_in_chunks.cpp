@@ -249,12 +249,20 @@ static inline int iabs(int i) { return (i < 0 ? -i : i); }
    intersect WHERE; we only use chunks that, untransformed, already
    intersect the grid_volume.  If SNAP_EMPTY_DIMS is true, then for empty
    (min = max) dimensions of WHERE, instead of interpolating, we
-   "snap" them to the nearest grid point.  */
+   "snap" them to the nearest grid point.
+
+   Normally we only loop over the chunks owned by this process.  If
+   ALL_CHUNKS (default = false) is true, we loop over the chunks of
+   every process, e.g. to set up the bookkeeping (but not the data)
+   of DFT chunks that may later be moved here by fields::move_chunks;
+   the chunkloop must not touch the fields of chunks that aren't
+   is_mine(). */
 
 void fields::loop_in_chunks(field_chunkloop chunkloop, void *chunkloop_data,
 			    const volume &where, 
 			    component cgrid,
-			    bool use_symmetry, bool snap_empty_dims)
+			    bool use_symmetry, bool snap_empty_dims,
+			    bool all_chunks)
 {
   if (coordinate_mismatch(gv.dim, cgrid))
     abort("Invalid fields::loop_in_chunks grid type %s for dimensions %s\n",
@@ -372,7 +380,7 @@ void fields::loop_in_chunks(field_chunkloop chunkloop, void *chunkloop_data,
       }
 
       for (int i = 0; i < num_chunks; ++i) {
-	if (!chunks[i]->is_mine()) continue;
+	if (!all_chunks && !chunks[i]->is_mine()) continue;
 	// Chunk looping boundaries:
 	volume vS(gv.dim);
 
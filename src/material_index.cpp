@@ -0,0 +1,154 @@
+/* Copyright (C) 2005-2015 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* Material-index storage of chi1inv (see structure::use_material_index).
+
+   A structure usually contains only a handful of distinct materials,
+   so apart from the interface points, where the subpixel averaging
+   gives every point a chi1inv row of its own, most of the chi1inv
+   arrays of a component are copies of a few rows.  Here we replace
+   the chi1inv[c][d] arrays of a component c by tables of its
+   distinct rows (chi1inv[c][d] for all d at once), plus a per-point
+   index into the tables (1 byte per point with up to 256 rows, 2
+   bytes with up to 65536).  A component with more distinct rows than
+   that is left alone.
+
+   The index is only a different way of storing the same values, so
+   the time stepping (step_update_EDHB) gives bit-identical results.
+   Anything that changes the chi1inv arrays expands them first and
+   compresses them again afterwards. */
+
+#include <string.h>
+
+#include "meep.hpp"
+#include "meep_internals.hpp"
+
+using namespace std;
+
+namespace meep {
+
+#define MAX_MATERIAL_ROWS 65536
+
+void structure::use_material_index(bool use) {
+  for (int i = 0; i < num_chunks; ++i) {
+    chunks[i]->use_material_index = use;
+    if (use) chunks[i]->compress_chi1inv();
+    else chunks[i]->expand_chi1inv();
+  }
+}
+
+/* Returns the row of the distinct rows (nd values each) in rows[]
+   that is bitwise identical to row, adding it if it is new (or -1 if
+   there are already maxrows rows).  The rows
+   are found by an open-addressing hash table of nhash (a power of 2)
+   entries, holding row numbers + 1 (0 = empty). */
+static int find_row(const realnum *row, int nd, realnum *rows, int &nrows,
+		    int maxrows, int *hash, int nhash) {
+  unsigned int h = 2166136261U; // FNV-1a hash of the bytes of row
+  const unsigned char *b = (const unsigned char *) row;
+  for (size_t j = 0; j < nd * sizeof(realnum); ++j) {
+    h ^= b[j];
+    h *= 16777619U;
+  }
+  for (int k = h & (nhash - 1); ; k = (k + 1) & (nhash - 1)) {
+    if (!hash[k]) {
+      if (nrows == maxrows) return -1;
+      memcpy(rows + nd * nrows, row, nd * sizeof(realnum));
+      hash[k] = ++nrows;
+      return nrows - 1;
+    }
+    if (!memcmp(rows + nd * (hash[k] - 1), row, nd * sizeof(realnum)))
+      return hash[k] - 1;
+  }
+}
+
+void structure_chunk::compress_chi1inv(component c) {
+  if (!use_material_index || !is_mine() || chi1inv_rows[c]) return;
+  direction ds[5];
+  int nd = 0;
+  FOR_DIRECTIONS(d) if (chi1inv[c][d]) ds[nd++] = d;
+  if (!nd) return;
+
+  const int ntot = gv.ntot();
+  const int maxrows = min(ntot, MAX_MATERIAL_ROWS);
+  int nhash = 1;
+  while (nhash < 2 * maxrows) nhash *= 2;
+  int *hash = new int[nhash];
+  memset(hash, 0, nhash * sizeof(int));
+  realnum *rows = new realnum[nd * maxrows];
+  unsigned short *index = new unsigned short[ntot];
+  /* Only the points of c in gv are set by set_chi1inv etcetera; the
+     remaining entries of the arrays are never used, and point to the
+     first row. */
+  memset(index, 0, ntot * sizeof(unsigned short));
+  int nrows = 0;
+  bool ok = true;
+  LOOP_OVER_VOL(gv, c, i) if (ok) {
+    realnum row[5];
+    for (int j = 0; j < nd; ++j) row[j] = chi1inv[c][ds[j]][i];
+    const int r = find_row(row, nd, rows, nrows, maxrows, hash, nhash);
+    ok = r >= 0; // else too many distinct rows: leave c alone
+    index[i] = r;
+  }
+  delete[] hash;
+  ok = ok && nrows > 0;
+
+  if (ok) {
+    for (int j = 0; j < nd; ++j) {
+      delete[] chi1inv[c][ds[j]];
+      chi1inv[c][ds[j]] = new realnum[nrows];
+      for (int r = 0; r < nrows; ++r) chi1inv[c][ds[j]][r] = rows[nd*r + j];
+    }
+    if (nrows <= 256) {
+      chi1inv_index8[c] = new unsigned char[ntot];
+      for (int i = 0; i < ntot; ++i) chi1inv_index8[c][i] = index[i];
+      delete[] index;
+    }
+    else
+      chi1inv_index16[c] = index;
+    chi1inv_rows[c] = nrows;
+  }
+  else
+    delete[] index;
+  delete[] rows;
+}
+
+void structure_chunk::expand_chi1inv(component c) {
+  if (!chi1inv_rows[c]) return;
+  const int ntot = gv.ntot();
+  FOR_DIRECTIONS(d) if (chi1inv[c][d]) {
+    realnum *u = new realnum[ntot];
+    for (int i = 0; i < ntot; ++i) u[i] = chi1inv_at(c, d, i);
+    delete[] chi1inv[c][d];
+    chi1inv[c][d] = u;
+  }
+  delete[] chi1inv_index8[c];
+  delete[] chi1inv_index16[c];
+  chi1inv_index8[c] = NULL;
+  chi1inv_index16[c] = NULL;
+  chi1inv_rows[c] = 0;
+}
+
+void structure_chunk::compress_chi1inv() {
+  FOR_COMPONENTS(c) compress_chi1inv(c);
+}
+
+void structure_chunk::expand_chi1inv() {
+  FOR_COMPONENTS(c) expand_chi1inv(c);
+}
+
+} // namespace meep
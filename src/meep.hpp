@@ -31,8 +31,15 @@ namespace meep {
    single precision (since the errors are not dominated by roundoff). 
    However, we will default to using double-precision for large 
    arrays, as the factor of two in memory and the moderate increase
-   in speed currently don't seem worth the loss of precision. */
+   in speed currently don't seem worth the loss of precision.
+   Accumulators that are summed over many timesteps (the DFT arrays
+   of dft_chunk and dft_ldos) are always double precision, so that
+   MEEP_SINGLE gives single-precision timestepping without noisy
+   spectra and flux differences.  Configure --enable-single to
+   compile with -DMEEP_SINGLE=1. */
+#ifndef MEEP_SINGLE
 #define MEEP_SINGLE 0 // 1 for single precision, 0 for double
+#endif
 #if MEEP_SINGLE
 typedef float realnum;
 #else
@@ -88,6 +95,16 @@ public:
     (void) ft; (void) f_minus_p; (void) P_internal_data;
   }
 
+  /* If subtract_P just subtracts one array of the internal data from
+     the f_minus_p of each component, set P[c][cmp] to the array
+     subtracted from the D/B component of c (or NULL) and return true,
+     so that update_eh can subtract it on the fly instead.  Otherwise
+     return false. */
+  virtual bool get_P_arrays(realnum *P[NUM_FIELD_COMPONENTS][2],
+			    void *P_internal_data) const {
+    (void) P; (void) P_internal_data; return false;
+  }
+
   // whether, for the given field W, Meep needs to allocate P[c]
   virtual bool needs_P(component c, int cmp,
 		       realnum *W[NUM_FIELD_COMPONENTS][2]) const;
@@ -115,6 +132,12 @@ public:
 			 double dt, const grid_volume &gv, void *data) const {
     (void) W; (void) dt; (void) gv; (void) data; }
   virtual void *copy_internal_data(void *data) const { (void)data; return 0; }
+  /* the size in bytes of the internal data, which must be a single
+     block that copy_internal_data can rebuild (e.g. after it was sent
+     to another process by fields::move_chunks), or 0 if it can't be
+     moved that way */
+  virtual size_t size_internal_data(void *data) const {
+    (void) data; return 0; }
 
   /* The following methods are used in boundaries.cpp to set up any
      extra communications that may be necessary at chunk boundaries
@@ -184,12 +207,15 @@ public:
   virtual void subtract_P(field_type ft,
 			  realnum *f_minus_p[NUM_FIELD_COMPONENTS][2], 
 			  void *P_internal_data) const;
+  virtual bool get_P_arrays(realnum *P[NUM_FIELD_COMPONENTS][2],
+			    void *P_internal_data) const;
 
   virtual void *new_internal_data(realnum *W[NUM_FIELD_COMPONENTS][2],
 				  const grid_volume &gv) const;
   virtual void init_internal_data(realnum *W[NUM_FIELD_COMPONENTS][2],
 			  double dt, const grid_volume &gv, void *data) const;
   virtual void *copy_internal_data(void *data) const;
+  virtual size_t size_internal_data(void *data) const;
 
   virtual int num_cinternal_notowned_needed(component c,
 					    void *P_internal_data) const;
@@ -199,6 +225,7 @@ public:
 protected:
   double omega_0, gamma;
   bool no_omega_0_denominator;
+  friend class multipole_susceptibility;
 };
 
 /* like a Lorentzian susceptibility, but the polarization equation
@@ -218,9 +245,60 @@ protected:
   double noise_amp;
 };
 
+/* a sum of Lorentzian (or Drude) susceptibilities with a common sigma,
+   \chi(\omega) = \sum_k strength_k * (\chi of lorentzian_susceptibility k),
+   whose update_P updates the polarizations of all the poles at a point
+   in one sweep over W.  structure::add_susceptibility merges Lorentzian
+   susceptibilities with proportional sigma arrays into one of these. */
+#define MAX_POLES 8
+class multipole_susceptibility : public susceptibility {
+public:
+  multipole_susceptibility() : npoles(0) {}
+  multipole_susceptibility(const lorentzian_susceptibility &l) : npoles(0) {
+    add_pole(l); }
+  virtual susceptibility *clone() const { return new multipole_susceptibility(*this); }
+  virtual ~multipole_susceptibility() {}
+
+  // add a pole, or return false if there are already MAX_POLES poles
+  bool add_pole(double omega_0, double gamma,
+		bool no_omega_0_denominator = false, double strength = 1.0);
+  bool add_pole(const lorentzian_susceptibility &l, double strength = 1.0) {
+    return add_pole(l.omega_0, l.gamma, l.no_omega_0_denominator, strength);
+  }
+  int num_poles() const { return npoles; }
+
+  virtual void update_P(realnum *W[NUM_FIELD_COMPONENTS][2], 
+			realnum *W_prev[NUM_FIELD_COMPONENTS][2], 
+			double dt, const grid_volume &gv,
+			void *P_internal_data) const;
+
+  virtual void subtract_P(field_type ft,
+			  realnum *f_minus_p[NUM_FIELD_COMPONENTS][2], 
+			  void *P_internal_data) const;
+  virtual bool get_P_arrays(realnum *P[NUM_FIELD_COMPONENTS][2],
+			    void *P_internal_data) const;
+
+  virtual void *new_internal_data(realnum *W[NUM_FIELD_COMPONENTS][2],
+				  const grid_volume &gv) const;
+  virtual void init_internal_data(realnum *W[NUM_FIELD_COMPONENTS][2],
+			  double dt, const grid_volume &gv, void *data) const;
+  virtual void *copy_internal_data(void *data) const;
+  virtual size_t size_internal_data(void *data) const;
+
+  virtual int num_cinternal_notowned_needed(component c,
+					    void *P_internal_data) const;
+  virtual realnum *cinternal_notowned_ptr(int inotowned, component c, int cmp, 
+					  int n, 
+					  void *P_internal_data) const;
+protected:
+  int npoles;
+  double omega_0[MAX_POLES], gamma[MAX_POLES], strength[MAX_POLES];
+  bool no_omega_0_denominator[MAX_POLES];
+};
+
 class multilevel_susceptibility : public susceptibility {
 public:
-  multilevel_susceptibility() : L(0), T(0), Gamma(0), N0(0), alpha(0), omega(0), gamma(0) {}
+  multilevel_susceptibility() : batched(true), L(0), T(0), Gamma(0), N0(0), alpha(0), omega(0), gamma(0) {}
   multilevel_susceptibility(int L, int T,
 			    const realnum *Gamma,
 			    const realnum *N0,
@@ -247,6 +325,7 @@ public:
 				  double dt, const grid_volume &gv, 
 				  void *data) const;
   virtual void *copy_internal_data(void *data) const;
+  virtual size_t size_internal_data(void *data) const;
   virtual void delete_internal_data(void *data) const;
 
   virtual int num_cinternal_notowned_needed(component c,
@@ -263,6 +342,10 @@ public:
   }
   virtual bool needs_W_prev() const { return true; }
 
+  // whether to use the unrolled, many-voxels-at-a-time population
+  // update for L = 2, 3, 4 (default); false forces the generic loop
+  bool batched;
+
 protected:
   int L; // number of atom levels
   int T; // number of optical transitions
@@ -296,6 +379,8 @@ public:
   
   char *read(const char *dataname);
   void write(const char *dataname, const char *data);
+  int read_int(const char *dataname);
+  void write_int(const char *dataname, int data);
   
   void create_data(const char *dataname, int rank, const int *dims,
 		   bool append_data = false,
@@ -305,12 +390,16 @@ public:
 			     const int *dims,
 			     bool append_data, bool single_precision);
   void write_chunk(int rank, const int *chunk_start, const int *chunk_dims,
-		   realnum *data);
+		   float *data);
+  void write_chunk(int rank, const int *chunk_start, const int *chunk_dims,
+		   double *data);
   void done_writing_chunks();
   
   void read_size(const char *dataname, int *rank, int *dims, int maxrank);
   void read_chunk(int rank, const int *chunk_start, const int *chunk_dims,
-		  realnum *data);
+		  float *data);
+  void read_chunk(int rank, const int *chunk_start, const int *chunk_dims,
+		  double *data);
   
   void remove();
   void remove_data(const char *dataname);
@@ -346,6 +435,12 @@ private:
 
   void *get_id(); // get current (file) id, opening/creating file if needed
   void close_id();
+
+  // write_chunk and read_chunk for float or double data
+  void write_chunk(int rank, const int *chunk_start, const int *chunk_dims,
+		   void *data, bool single_precision);
+  void read_chunk(int rank, const int *chunk_start, const int *chunk_dims,
+		  void *data, bool single_precision);
 };
 
 typedef double (*pml_profile_func)(double u, void *func_data);
@@ -438,6 +533,16 @@ class structure_chunk {
   realnum *chi3[NUM_FIELD_COMPONENTS], *chi2[NUM_FIELD_COMPONENTS];
   realnum *chi1inv[NUM_FIELD_COMPONENTS][5];
   bool trivial_chi1inv[NUM_FIELD_COMPONENTS][5];
+  /* With use_material_index (see structure::use_material_index), the
+     chi1inv[c][d] of a component c with chi1inv_rows[c] > 0 are not
+     per-point arrays but tables of chi1inv_rows[c] distinct rows,
+     indexed by the material index of each point, chi1inv_index8[c][i]
+     or (if there are more than 256 rows) chi1inv_index16[c][i].  Use
+     chi1inv_at to get the value at a point. */
+  unsigned char *chi1inv_index8[NUM_FIELD_COMPONENTS];
+  unsigned short *chi1inv_index16[NUM_FIELD_COMPONENTS];
+  int chi1inv_rows[NUM_FIELD_COMPONENTS];
+  bool use_material_index;
   realnum *conductivity[NUM_FIELD_COMPONENTS][5];
   realnum *condinv[NUM_FIELD_COMPONENTS][5]; // cache of 1/(1+conduct*dt/2)
   bool condinv_stale; // true if condinv needs to be recomputed
@@ -478,6 +583,19 @@ class structure_chunk {
 
   void remove_susceptibilities();
 
+  // rebalance.cpp
+  void move_to(int proc);
+
+  // material_index.cpp
+  void compress_chi1inv(component c);
+  void compress_chi1inv();
+  void expand_chi1inv(component c);
+  void expand_chi1inv();
+  double chi1inv_at(component c, direction d, int i) const {
+    return chi1inv[c][d][chi1inv_index8[c] ? chi1inv_index8[c][i]
+			 : (chi1inv_index16[c] ? chi1inv_index16[c][i] : i)];
+  }
+
   // monitor.cpp
   double get_chi1inv(component, direction, const ivec &iloc) const;
   double get_inveps(component c, direction d, const ivec &iloc) const {
@@ -531,7 +649,7 @@ public:
     return r;
   }
 
-  void apply(structure *s) const;
+  void apply(structure *s, double pml_effort) const;
   void apply(const structure *s, structure_chunk *sc) const;
   bool check_ok(const grid_volume &gv) const;
 
@@ -554,6 +672,57 @@ boundary_region pml(double thickness,
 		    double Rasymptotic = 1e-15, double mean_stretch = 1.0);
 #define no_pml() boundary_region()
 
+/* Model of the relative computational cost of the grid points, used by
+   structure::choose_chunkdivision to balance the work between chunks.
+   All costs are per grid point and time step, relative to a point with
+   a plain (diagonal) dielectric.  The defaults were measured with
+   calibrate(), which you can call to measure them on your machine.
+   Without a cost_model, choose_chunkdivision uses these defaults
+   except for pml, where it keeps the traditional effort of 0.6: the
+   calibrated pml cost is only used if you pass a cost_model.
+
+   Conductivity and nonlinearities are taken from the structure's
+   material_function, but susceptibilities, DFTs and sources are only
+   added after the structure is created, so they must be described
+   in advance with the add_* functions if they are to be balanced. */
+class cost_model {
+  cost_model(const cost_model &cm) {(void)cm;} // prevent copying
+public:
+  double pml, conductivity, nonlinear, susceptibility, dft, source;
+  double boundary; // cost per point of the interface between two chunks
+  int resolution; // max. number of material samples per direction
+
+  cost_model();
+  virtual ~cost_model();
+
+  void calibrate(); // collective; results are the same on all processes
+  void add_susceptibility(material_function &sigma, int npoles = 1);
+  void add_susceptibility(double sigma(const vec &), int npoles = 1);
+  void add_dft_volume(const volume &where, int Nfreq, int num_components=1);
+  void add_source_volume(const volume &where, int num_components = 1);
+  void add_volume(const volume &where, double cost);
+
+  /* cost (in addition to 1) of the point r in the material mat, not
+     counting PML or the volumes added above */
+  virtual double point_cost(material_function &mat, const vec &r);
+
+  /* extra effort volumes (see grid_volume::split_by_effort) for the
+     material mat (may be NULL) and the added volumes within gv; the
+     caller must delete[] the returned arrays */
+  int get_effort_volumes(const grid_volume &gv, material_function *mat,
+			 grid_volume **vols, double **effort);
+
+private:
+  struct sigma_list {
+    material_function *sigma;
+    bool owned;
+    int npoles;
+    sigma_list *next;
+  } *sigmas;
+  // weight = cost per point, or the number of DFT/source components
+  volume_list *volumes, *dft_volumes, *source_volumes;
+};
+
 class structure {
  public:
   structure_chunk **chunks;
@@ -575,14 +744,16 @@ class structure {
 	    int num_chunks = 0, double Courant = 0.5,
 	    bool use_anisotropic_averaging=false,
 	    double tol=DEFAULT_SUBPIXEL_TOL,
-	    int maxeval=DEFAULT_SUBPIXEL_MAXEVAL);
+	    int maxeval=DEFAULT_SUBPIXEL_MAXEVAL,
+	    cost_model *costs = NULL);
   structure(const grid_volume &gv, double eps(const vec &), 
 	    const boundary_region &br = boundary_region(),
 	    const symmetry &s = meep::identity(),
 	    int num_chunks = 0, double Courant = 0.5,
 	    bool use_anisotropic_averaging=false,
 	    double tol=DEFAULT_SUBPIXEL_TOL,
-	    int maxeval=DEFAULT_SUBPIXEL_MAXEVAL);
+	    int maxeval=DEFAULT_SUBPIXEL_MAXEVAL,
+	    cost_model *costs = NULL);
   structure(const structure *);
   structure(const structure &);
 
@@ -630,6 +801,13 @@ class structure {
   bool equal_layout(const structure &) const;
   void print_layout(void) const;
 
+  // dump.cpp: checkpointing of the material arrays
+  void dump(h5file *file);
+  void load(h5file *file);
+
+  // material_index.cpp: store chi1inv as a per-point material index
+  void use_material_index(bool use = true);
+
   // monitor.cpp
   double get_chi1inv(component, direction, const ivec &origloc) const;
   double get_chi1inv(component, direction, const vec &loc) const;
@@ -644,11 +822,13 @@ class structure {
   friend class boundary_region;
 
  private:
-  void use_pml(direction d, boundary_side b, double dx);
+  void merge_poles(field_type ft);
+  void use_pml(direction d, boundary_side b, double dx, double effort);
   void add_to_effort_volumes(const grid_volume &new_effort_volume, 
 			     double extra_effort);
   void choose_chunkdivision(const grid_volume &gv, int num_chunks,
-			    const boundary_region &br, const symmetry &s);
+			    const boundary_region &br, const symmetry &s,
+			    material_function *mat, cost_model *costs);
   void check_chunks();
   void changing_chunks();
 };
@@ -657,6 +837,8 @@ class src_vol;
 class bandsdata;
 class fields;
 class fields_chunk;
+class plane_metals;
+struct comm_requests;
 class flux_vol;
 
 // Time-dependence of a current source, intended to be overridden by
@@ -850,6 +1032,18 @@ public:
   ~dft_chunk();
   
   void update_dft(double time);
+  /* update_dft(time) in three parts, so that the points can be split
+     among threads: start_update (returns false if there is nothing to
+     do), then update_points for ranges covering 0 <= p < N, then
+     finish_update (see fields::update_dfts) */
+  bool start_update(double time);
+  void update_points(int p0, int p1);
+  void finish_update();
+  void flush_dft() const; // add any buffered timesteps into dft
+  void set_batch(int batch); // see fields::use_dft_batching
+  void set_decimation(int k, bool average, double dt);
+  void alloc_dft(); // allocates the zeroed dft (see fields::use_dft_mmap)
+  void free_dft();
 
   void scale_dft(std::complex<double> scale);
 
@@ -862,7 +1056,14 @@ public:
   component c; // component to DFT (possibly transformed by symmetry)
 
   int N; // number of spatial points (on epsilon grid)
-  std::complex<realnum> *dft; // N x Nomega array of DFT values.
+  /* N x 2 x Nomega array of DFT values: for each point, the Nomega
+     real parts followed by the Nomega imaginary parts (so that the
+     loops over frequency vectorize); see also dft_at */
+  double *dft;
+  std::complex<double> dft_at(int k, int i) const { // point k, frequency i
+    return std::complex<double>(dft[2*size_t(k)*Nomega + i],
+				dft[(2*size_t(k)+1)*Nomega + i]);
+  }
 
   struct dft_chunk *next_in_chunk; // per-fields_chunk list of DFT chunks
   struct dft_chunk *next_in_dft; // next for this particular DFT vol./component
@@ -886,11 +1087,37 @@ public:
   ivec shift;
   symmetry S; int sn;
 
-  // cache of exp(iwt) * scale, of length Nomega
-  std::complex<realnum> *dft_phase;
+  /* cache of exp(iwt) * scale, one row of Nomega real parts followed
+     by Nomega imaginary parts per buffered step, followed by batch rows
+     for i exp(iwt) * scale (the phases for the imaginary field parts) */
+  double *dft_phase;
+
+  /* With batch > 1, update_dft only stores the (weighted) field values
+     of each timestep in fbuf, N x numcmp x batch, and every batch steps
+     flush_dft adds them all to dft with matrix multiplications. */
+  int batch;
+  mutable int nbuf; // number of buffered steps; flush_dft is const
+  int buf_cmp; // numcmp of the buffered values
+  double *fbuf;
+  void flush_rows(int p0, int p1, int nsteps) const; // points p0 <= p < p1
+  bool sample_now; // state between start_update and finish_update:
+  int numcmp_now; // (0 if update_points has nothing to do)
+
+  /* With decimation k > 1, the fields are only sampled every k steps
+     (see fields::use_dft_decimation), or with average their mean over
+     each k steps is, at the middle of the k steps; dec_weight is then
+     the Nomega per-frequency weights (k, divided by the frequency
+     response of the average) multiplying dft_phase. */
+  int decimation, nstep;
+  bool average;
+  double t_first; // time of the first step of the current k steps
+  double *favg; // N x 2 sums of the fields over the current k steps
+  double *dec_weight;
 
   int avg1, avg2; // index offsets for average to get epsilon grid
 
+  char *mmap_dir; // dft is mapped from a file in this dir (NULL if in RAM)
+
   int vc; // component descriptor from the original volume
 };
 
@@ -983,6 +1210,18 @@ public:
   void save_farfields(const char *fname, const char *prefix,
                       const volume &where, double resolution);
 
+  /* return an array (Ex,Ey,Ez,Hx,Hy,Hz) x Nfreq of the radiation pattern
+     in the direction (theta,phi): the far fields at r*rhat in the limit
+     r -> infinity, divided by the outgoing wave exp(ikr)/r in 3d, or
+     exp(ikr)/sqrt(r) in 2d (where theta is ignored and taken as pi/2) */
+  std::complex<double> *radiation(double theta, double phi);
+
+  /* output the radiation pattern on a regular Ntheta x Nphi grid of
+     angles (from min to max, inclusive) to an HDF5 file */
+  void save_radiation(const char *fname, const char *prefix,
+                      double theta_min, double theta_max, int Ntheta,
+                      double phi_min, double phi_max, int Nphi);
+
   void save_hdf5(h5file *file, const char *dprefix = 0);
   void load_hdf5(h5file *file, const char *dprefix = 0);
 
@@ -1020,8 +1259,8 @@ public:
   std::complex<double> *J() const; // returns Jdft
 
 private:
-  std::complex<realnum> *Fdft; // Nomega array of field * J*(x) DFT values
-  std::complex<realnum> *Jdft; // Nomega array of J(t) DFT values
+  std::complex<double> *Fdft; // Nomega array of field * J*(x) DFT values
+  std::complex<double> *Jdft; // Nomega array of J(t) DFT values
   double Jsum; // sum of |J| over all points
 public:
   double omega_min, domega;
@@ -1030,6 +1269,27 @@ public:
 
 enum in_or_out { Incoming=0, Outgoing };
 enum connect_phase { CONNECT_PHASE = 0, CONNECT_NEGATE=1, CONNECT_COPY=2 };
+/* A chunk pair j+i*num_chunks (j sending, i receiving) whose
+   comm_blocks are nonempty, where chunk is our end of the pair (j or i),
+   start[ip] is the index of the pair's first element in the
+   connections[ft][ip] of that chunk, and its elements are the num_runs[ip]
+   connection_runs[ft][ip] starting at run_start[ip]. */
+struct comm_pair {
+  int pair, chunk;
+  int start[CONNECT_COPY+1];
+  int run_start[CONNECT_COPY+1], num_runs[CONNECT_COPY+1];
+};
+
+/* count consecutive connections, at f[0][offset + k*stride] for
+   k = 0..count-1 or, if f[1] is non-NULL, the (real, imaginary) pairs
+   f[0][offset + k*stride], f[1][offset + k*stride] */
+struct connection_run {
+  realnum *f[2];
+  int offset, stride, count;
+};
+
+// which points of a chunk to update, for overlapping communication
+enum halo_part { ALL_POINTS = 0, HALO_POINTS, INTERIOR_POINTS };
 
 // data for each susceptibility
 typedef struct polarization_state_s {
@@ -1067,9 +1327,24 @@ class fields_chunk {
 
   realnum **zeroes[NUM_FIELD_TYPES]; // Holds pointers to metal points.
   int num_zeroes[NUM_FIELD_TYPES];
+  /* connections are only used while connecting the chunks, after which
+     they are compressed into connection_runs and deleted */
   realnum **connections[NUM_FIELD_TYPES][CONNECT_COPY+1][Outgoing+1];
   int num_connections[NUM_FIELD_TYPES][CONNECT_COPY+1][Outgoing+1];
+  connection_run *connection_runs[NUM_FIELD_TYPES][CONNECT_COPY+1][Outgoing+1];
+  int num_connection_runs[NUM_FIELD_TYPES][CONNECT_COPY+1][Outgoing+1];
   std::complex<realnum> *connection_phases[NUM_FIELD_TYPES];
+  /* owned points within halo_depth[d][side] (ivec units) of the
+     High/Low side in direction d are sent to other chunks in the
+     B/D communication; see fields::use_comm_overlap */
+  int halo_depth[5][2];
+  bool in_halo(component c, const ivec &here) const;
+  /* while fields::step_wavefront steps the shell around the blocked
+     interior of the chunk, the boxes (ivec coordinates) of the points
+     that the sweep has already updated, which step_db and update_eh
+     leave alone: index 0 for B/H and 1 for D/E, empty (lo > hi) else */
+  ivec skip_lo[2], skip_hi[2];
+  bool skip_box(field_type ft, ivec &lo, ivec &hi) const;
 
   int npol[NUM_FIELD_TYPES]; // only E_stuff and H_stuff are used
   polarization_state *pol[NUM_FIELD_TYPES]; // array of npol[i] polarization_state structures
@@ -1081,6 +1356,8 @@ class fields_chunk {
   bool zero_fields_near_cylorigin; // fields=0 m pixels near r=0 for stability
   double beta;
   int is_real;
+  int tile_size; // block size for cache-tiled step_db (0 = no tiling)
+  double work_time; // wall time spent updating this chunk, for rebalance
   bandsdata *bands;
   src_vol *sources[NUM_FIELD_TYPES];
   structure_chunk *new_s;
@@ -1139,10 +1416,24 @@ class fields_chunk {
   // update_eh.cpp
   bool needs_W_prev(component c) const;
   bool update_eh(field_type ft, bool skip_w_components = false);
+  bool may_allocate();
 
   bool alloc_f(component c);
   void figure_out_step_plan();
 
+  // step_wavefront.cpp
+  bool can_step_wavefront();
+  bool wavefront_box(bool sources_on, int nblock, ivec &lo, ivec &hi,
+		     ivec &dlo, ivec &dhi) const;
+  void step_wavefront(int nblock, const ivec &lo, const ivec &hi,
+		      const ivec &dlo, const ivec &dhi);
+  void skip_wavefront(int s, const ivec &lo, const ivec &hi,
+		      const ivec &dlo, const ivec &dhi);
+
+  // rebalance.cpp
+  bool can_move() const;
+  void move_to(int proc, src_time *all_sources);
+
   void set_solve_cw_omega(std::complex<double> omega) {
     doing_solve_cw = true;
     solve_cw_omega = omega;
@@ -1169,8 +1460,12 @@ class fields_chunk {
   // step.cpp
   void phase_in_material(structure_chunk *s);
   void phase_material(int phasein_time);
-  bool step_db(field_type ft);
-  void step_source(field_type ft, bool including_integrated);
+  bool step_db(field_type ft, halo_part part = ALL_POINTS);
+  void step_source(field_type ft, bool including_integrated,
+		   halo_part part = ALL_POINTS);
+  void step_plane(field_type ft, direction dw, int p,
+		  const ivec &lo, const ivec &hi,
+		  plane_metals *metals[NUM_FIELD_TYPES]);
   bool update_pols(field_type ft);
   void calc_sources(double time);
 
@@ -1180,6 +1475,9 @@ class fields_chunk {
   void initialize_with_nth_tm(int n, double kz);
   // boundaries.cpp
   void alloc_extra_connections(field_type, connect_phase, in_or_out, int);
+  int compress_connections(realnum **conn, int n, bool pairs,
+			   connection_run *runs) const;
+  void extend_halo(component c, const ivec &here);
   // dft.cpp
   void update_dfts(double timeE, double timeH);
 
@@ -1225,6 +1523,12 @@ class fields {
     int sum = 0; for (int ip=0; ip<3; ++ip) sum+=comm_sizes[f][ip][pair];
     return sum;
   }
+  // The pairs with nonzero comm_blocks that involve our chunks, computed
+  // in connect_the_chunks so that step_boundaries needn't loop over all
+  // num_chunks^2 pairs: our sending chunks for [Outgoing], and our
+  // receiving chunks for [Incoming].
+  comm_pair *comm_pairs[NUM_FIELD_TYPES][Outgoing+1];
+  int num_comm_pairs[NUM_FIELD_TYPES][Outgoing+1];
 
   double a, dt; // The resolution a and timestep dt=Courant/a
   grid_volume gv, user_volume;
@@ -1245,6 +1549,32 @@ class fields {
   ~fields();
   bool equal_layout(const fields &f) const;
   void use_real_fields();
+  // step_db.cpp: update B/D in tile_size^2 blocks (3d only; 0 = no tiling)
+  void use_tiling(int tile_size = 16);
+  // step_db.cpp: overlap the B/D communication with the interior update
+  void use_comm_overlap(bool overlap = true);
+  // dft.cpp: accumulate DFTs batch timesteps at a time (1 = every step)
+  void use_dft_batching(int batch = 32);
+  /* dft.cpp: sample each DFT only every k steps, with k chosen so that
+     the sampling rate is nyquist_margin * 2 * freq_max of that DFT
+     (nyquist_margin <= 0 samples every step; it must otherwise be >= 1).  With average, the mean
+     of the fields over the k steps is sampled, which suppresses the
+     frequencies aliased onto the DFT band. */
+  void use_dft_decimation(double nyquist_margin = 2.0, bool average = true);
+  /* dft.cpp: keep the DFT arrays of subsequently added DFTs in (unlinked)
+     memory-mapped temporary files in directory dir rather than in RAM
+     (dir = NULL: in RAM), for DFT surfaces too large for memory; the
+     operating system then pages them in and out.  Best combined with
+     use_dft_batching, so that each array is swept through sequentially
+     only once every batch steps. */
+  void use_dft_mmap(const char *dir);
+  /* rebalance.cpp: every interval steps, move chunks between processes
+     if the busiest process spent more than threshold times the mean
+     time updating its chunks.  Call this before adding any DFTs, so
+     that their chunks can be moved too. */
+  void use_rebalancing(double threshold = 1.2, int interval = 100);
+  bool rebalance(double threshold = 1.2);
+  void move_chunks(const int *chunk_procs); // chunk i to chunk_procs[i]
   void zero_fields();
   void remove_sources();
   void remove_susceptibilities();
@@ -1309,10 +1639,17 @@ class fields {
   const char *h5file_name(const char *name,
 			  const char *prefix = NULL, bool timestamp = false);
 
+  // dump.cpp: checkpointing of the complete fields state
+  void dump(h5file *file);
+  void load(h5file *file);
+
   // step.cpp methods:
   double last_step_output_wall_time;
   int last_step_output_t;
   void step();
+  // step_wavefront.cpp: nsteps steps, up to block at a time per sweep
+  void step_wavefront(int nsteps, int block = 8);
+  bool can_step_wavefront();
 
   // when comparing times, e.g. for source cutoffs, it
   // is useful to round to float to avoid gratuitous sensitivity
@@ -1365,7 +1702,8 @@ class fields {
 		      const volume &where,
 		      component cgrid = Centered,
 		      bool use_symmetry = true,
-		      bool snap_unit_dims = false);
+		      bool snap_unit_dims = false,
+		      bool all_chunks = false);
   
   // integrate.cpp
   std::complex<double> integrate(int num_fields, const component *components,
@@ -1509,6 +1847,15 @@ class fields {
 #define MEEP_TIMING_STACK_SZ 10
   time_sink working_on, was_working_on[MEEP_TIMING_STACK_SZ];
   double times_spent[Other+1];
+  double comm_overlap_time; // time spent stepping while communicating
+  double rebalance_threshold;
+  int rebalance_interval; // 0 if not rebalancing automatically
+  int dft_batch; // see use_dft_batching
+  double dft_nyquist_margin; // see use_dft_decimation
+  bool dft_average;
+  char *dft_mmap_dir; // see use_dft_mmap (NULL if none)
+  // rebalance.cpp
+  void movable_chunks(int *movable);
   // fields.cpp
   void figure_out_step_plan();
   // time.cpp
@@ -1516,6 +1863,9 @@ class fields {
   void finished_working();
   // boundaries.cpp
   bool chunk_connections_valid;
+  // whether step_db etc. may still allocate fields; see connect_chunks
+  bool may_allocate_fields;
+  void sync_chunk_connections(bool allocated);
   void find_metals();
   void disconnect_chunks();
   void connect_chunks();
@@ -1526,11 +1876,22 @@ class fields {
   void locate_volume_source_in_user_volume(const vec p1, const vec p2, vec newp1[8], vec newp2[8],
                                            std::complex<double> kphase[8], int &ncopies) const;
   // mympi.cpp
+  comm_requests *comm_plan[NUM_FIELD_TYPES]; // persistent MPI requests
+  comm_requests *pending_comms; // started, but not finished
+  void plan_boundary_communications();
+  void free_boundary_communications();
   void boundary_communications(field_type);
+  void start_boundary_communications(field_type);
+  void finish_boundary_communications(field_type);
   // step.cpp
   void phase_material();
-  void step_db(field_type ft);
-  void step_source(field_type ft, bool including_integrated = false);
+  void step_db(field_type ft, halo_part part = ALL_POINTS);
+  bool overlap_comm;
+  void step_db_overlapped(field_type ft);
+  void step_source(field_type ft, bool including_integrated = false,
+		   halo_part part = ALL_POINTS);
+  void start_step_boundaries(field_type);
+  void finish_step_boundaries(field_type);
   void update_pols(field_type ft);
   void calc_sources(double tim);
   int cluster_some_bands_cleverly(double *tf, double *td, std::complex<double> *ta,
@@ -1625,6 +1986,7 @@ std::complex<double> *make_casimir_gfunc_kz(double T, double dt, double sigma, f
 
 #if MEEP_SINGLE
 // in mympi.cpp ... must be here in order to use realnum type
+void send(int from, int to, realnum *data, int size=1);
 void broadcast(int from, realnum *data, int size);
 #endif
 
@@ -46,11 +46,16 @@ class initialize {
 void abort(const char *fmt, ...) NORETURN_ATTR PRINTF_ATTR(1,2);
 void all_wait();
 int count_processors();
+int count_threads(); // threads used per process to step chunks (1 w/o OpenMP)
+void set_num_threads(int n);
 int my_rank();
 bool am_really_master();
 inline int am_master() { return my_rank() == 0; }
 
 void send(int from, int to, double *data, int size=1);
+void send(int from, int to, int *data, int size=1);
+void send(int from, int to, char *data, int size=1);
+void send_to_next(double *data, int size);
 void broadcast(int from, double *data, int size);
 void broadcast(int from, char *data, int size);
 void broadcast(int from, int *data, int size);
@@ -66,6 +71,7 @@ double sum_to_master(double); // Only returns the correct value to proc 0.
 double sum_to_all(double);
 void sum_to_all(const double *in, double *out, int size);
 void sum_to_master(const double *in, double *out, int size);
+void sum_to_master(const float *in, float *out, int size);
 void sum_to_all(const float *in, double *out, int size);
 void sum_to_all(const std::complex<float> *in, std::complex<double> *out, int size);
 void sum_to_all(const std::complex<double> *in, std::complex<double> *out, int size);
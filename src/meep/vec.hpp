@@ -139,6 +139,58 @@ component first_field_component(field_type ft);
       for (int idx = idx0 + loop_i1*loop_s1 + loop_i2*loop_s2, \
            loop_i3 = 0; loop_i3 < loop_n3; loop_i3++, idx+=loop_s3)
 
+/* like LOOP_OVER_IVECS, but loop only over the "rows" of the innermost
+   loop: idx is the first index of each row, which has loop_n3 points
+   (at stride loop_s3) */
+#define LOOP_OVER_IVEC_ROWS(gv, is, ie, idx) \
+  for (int loop_is1 = (is).yucky_val(0), \
+           loop_is2 = (is).yucky_val(1), \
+           loop_is3 = (is).yucky_val(2), \
+           loop_n1 = ((ie).yucky_val(0) - loop_is1) / 2 + 1, \
+           loop_n2 = ((ie).yucky_val(1) - loop_is2) / 2 + 1, \
+           loop_n3 = ((ie).yucky_val(2) - loop_is3) / 2 + 1, \
+	   loop_s1 = (gv).stride((gv).yucky_direction(0)),		\
+	   loop_s2 = (gv).stride((gv).yucky_direction(1)),		\
+	   loop_s3 = (gv).stride((gv).yucky_direction(2)),		\
+           idx0 = (is - (gv).little_corner()).yucky_val(0) / 2 * loop_s1 \
+                + (is - (gv).little_corner()).yucky_val(1) / 2 * loop_s2 \
+                + (is - (gv).little_corner()).yucky_val(2) / 2 * loop_s3,\
+           loop_i1 = 0; loop_i1 < loop_n1; loop_i1++) \
+    for (int loop_i2 = 0; loop_i2 < loop_n2; loop_i2++) \
+      for (int idx = idx0 + loop_i1*loop_s1 + loop_i2*loop_s2, \
+           loop_row = 1; loop_row; loop_row = 0)
+
+/* like LOOP_OVER_IVECS, but only over the points p0 <= loop_p < p1,
+   where loop_p counts the points in the order of LOOP_OVER_IVECS
+   (e.g. to split the loop among threads); loop_i1/2/3 and loop_n1/2/3
+   are those of the whole loop, so IVEC_LOOP_WEIGHT etc. still work */
+#define LOOP_OVER_IVECS_PART(gv, is, ie, idx, p0, p1) \
+  for (int loop_is1 = (is).yucky_val(0), \
+           loop_is2 = (is).yucky_val(1), \
+           loop_is3 = (is).yucky_val(2), \
+           loop_n1 = ((ie).yucky_val(0) - loop_is1) / 2 + 1, \
+           loop_n2 = ((ie).yucky_val(1) - loop_is2) / 2 + 1, \
+           loop_n3 = ((ie).yucky_val(2) - loop_is3) / 2 + 1, \
+           loop_d1 = (gv).yucky_direction(0), \
+           loop_d2 = (gv).yucky_direction(1), \
+           loop_d3 = (gv).yucky_direction(2), \
+	   loop_s1 = (gv).stride((meep::direction) loop_d1),		\
+	   loop_s2 = (gv).stride((meep::direction) loop_d2),		\
+	   loop_s3 = (gv).stride((meep::direction) loop_d3),		\
+           idx0 = (is - (gv).little_corner()).yucky_val(0) / 2 * loop_s1 \
+                + (is - (gv).little_corner()).yucky_val(1) / 2 * loop_s2 \
+                + (is - (gv).little_corner()).yucky_val(2) / 2 * loop_s3,\
+           loop_p = (p0), \
+           loop_i1 = loop_p / (loop_n2 * loop_n3), \
+           loop_i2 = loop_p / loop_n3 % loop_n2, \
+           loop_i3 = loop_p % loop_n3, \
+           idx = idx0 + loop_i1*loop_s1 + loop_i2*loop_s2 + loop_i3*loop_s3; \
+       loop_p < (p1); \
+       loop_p++, \
+       (++loop_i3 < loop_n3 ? 0 : \
+        (loop_i3 = 0, ++loop_i2 < loop_n2 ? 0 : (loop_i2 = 0, ++loop_i1))), \
+       idx = idx0 + loop_i1*loop_s1 + loop_i2*loop_s2 + loop_i3*loop_s3)
+
 #define LOOP_OVER_VOL(gv, c, idx) \
   LOOP_OVER_IVECS(gv, (gv).little_corner() + (gv).iyee_shift(c), (gv).big_corner() + (gv).iyee_shift(c), idx)
 
@@ -191,6 +243,9 @@ component first_field_component(field_type ft);
       for (int idx = idx0 + loop_i1*loop_s1 + loop_i2*loop_s2, \
            loop_i3 = 0; loop_i3 < loop_n3; loop_i3++, idx++)
 
+#define S1LOOP_OVER_IVEC_ROWS(gv, is, ie, idx) \
+  LOOP_OVER_IVEC_ROWS(gv, is, ie, idx)
+
 #define S1LOOP_OVER_VOL(gv, c, idx) \
   S1LOOP_OVER_IVECS(gv, (gv).little_corner() + (gv).iyee_shift(c), (gv).big_corner() + (gv).iyee_shift(c), idx)
 
@@ -814,8 +869,9 @@ class grid_volume {
   friend grid_volume vol3d(double xsize, double ysize, double zsize, double a);
 
   grid_volume split(int num, int which) const;
-  grid_volume split_by_effort(int num, int which, int Ngv = 0, const grid_volume *v = NULL, double *effort = NULL) const;
+  grid_volume split_by_effort(int num, int which, int Ngv = 0, const grid_volume *v = NULL, double *effort = NULL, double boundary_effort = 0) const;
   grid_volume split_at_fraction(bool want_high, int numer) const;
+  grid_volume split_at_fraction(bool want_high, int numer, direction d) const;
   grid_volume halve(direction d) const;
   void pad_self(direction d);
   grid_volume pad(direction d) const;
@@ -102,7 +102,11 @@ symmetry r_to_minus_r_symmetry(int m);
 
 // functions in step_generic.cpp:
 
-void step_curl(realnum *f, component c, const realnum *g1, const realnum *g2,
+// max. number of polarizations subtracted from D/B by step_update_EDHB
+#define MAX_FUSED_P 4
+
+void step_curl(realnum *f, const ivec &is, const ivec &ie,
+	       const realnum *g1, const realnum *g2,
 	       int s1, int s2, // strides for g1/g2 shift
 	       const grid_volume &gv, double dtdx,
 	       direction dsig, const double *sig, const double *kap, const double *siginv,
@@ -110,9 +114,12 @@ void step_curl(realnum *f, component c, const realnum *g1, const realnum *g2,
 	       double dt, const realnum *cnd, const realnum *cndinv,
 	       realnum *fcnd);
 
-void step_update_EDHB(realnum *f, component fc, const grid_volume &gv,
+void step_update_EDHB(realnum *f, const ivec &is, const ivec &ie,
+		      const grid_volume &gv,
 		      const realnum *g, const realnum *g1, const realnum *g2,
+		      const realnum *const *gP, int ngP,
 		      const realnum *u, const realnum *u1, const realnum *u2,
+		      const unsigned char *uidx8, const unsigned short *uidx16,
 		      int s, int s1, int s2,
 		      const realnum *chi2, const realnum *chi3,
 		      realnum *fw, direction dsigw, const double *sigw, const double *kapw);
@@ -125,7 +132,8 @@ void step_beta(realnum *f, component c, const realnum *g,
 
 // functions in step_generic_stride1.cpp, generated from step_generic.cpp:
 
-void step_curl_stride1(realnum *f, component c, const realnum *g1, const realnum *g2,
+void step_curl_stride1(realnum *f, const ivec &is, const ivec &ie,
+	       const realnum *g1, const realnum *g2,
 	       int s1, int s2, // strides for g1/g2 shift
 	       const grid_volume &gv, double dtdx,
 	       direction dsig, const double *sig, const double *kap, const double *siginv,
@@ -133,9 +141,12 @@ void step_curl_stride1(realnum *f, component c, const realnum *g1, const realnum
 	       double dt, const realnum *cnd, const realnum *cndinv,
                realnum *fcnd);
 
-void step_update_EDHB_stride1(realnum *f, component fc, const grid_volume &gv,
+void step_update_EDHB_stride1(realnum *f, const ivec &is, const ivec &ie,
+		      const grid_volume &gv,
 		      const realnum *g, const realnum *g1, const realnum *g2,
+		      const realnum *const *gP, int ngP,
 		      const realnum *u, const realnum *u1, const realnum *u2,
+		      const unsigned char *uidx8, const unsigned short *uidx16,
 		      int s, int s1, int s2,
 		      const realnum *chi2, const realnum *chi3,
 		      realnum *fw, direction dsigw, const double *sigw, const double *kapw);
@@ -146,23 +157,44 @@ void step_beta_stride1(realnum *f, component c, const realnum *g,
 		       realnum *fu, direction dsigu, const double *siginvu,
 		       const realnum *cndinv, realnum *fcnd);
 
+// functions in step_simd.cpp: vectorized rows of n stride-1 points
+
+// f -= dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2]), g2 may be NULL
+void simd_curl_row(realnum *f, const realnum *g1, const realnum *g2,
+		   int s1, int s2, double dtdx, int n);
+// f = g * u
+void simd_mult_row(realnum *f, const realnum *g, const realnum *u, int n);
+// the same without vectors, giving identical results (for testing)
+void scalar_curl_row(realnum *f, const realnum *g1, const realnum *g2,
+		     int s1, int s2, double dtdx, int n);
+void scalar_mult_row(realnum *f, const realnum *g, const realnum *u, int n);
+
+// functions in step_wavefront.cpp:
+
+// restrict the loop range is..ie of a component to the box lo..hi
+bool clip_to_box(const grid_volume &gv, ivec &is, ivec &ie,
+		 const ivec &lo, const ivec &hi);
+// the loop ranges bs..be covering the points of is..ie outside lo..hi
+int subtract_box(const grid_volume &gv, ivec is, ivec ie,
+		 const ivec &lo, const ivec &hi, ivec bs[10], ivec be[10]);
+
 /* macro wrappers around time-stepping functions: for performance reasons,
    if the inner loop is stride-1 then we use the stride-1 versions,
    which allow gcc (and possibly other compilers) to do additional
    optimizations, especially loop vectorization */
 
-#define STEP_CURL(f, c, g1, g2, s1, s2, gv, dtdx, dsig, sig, kap, siginv, fu, dsigu, sigu, kapu, siginvu, dt, cnd, cndinv, fcnd) do { \
+#define STEP_CURL(f, is, ie, g1, g2, s1, s2, gv, dtdx, dsig, sig, kap, siginv, fu, dsigu, sigu, kapu, siginvu, dt, cnd, cndinv, fcnd) do { \
   if (LOOPS_ARE_STRIDE1(gv))						\
-    step_curl_stride1(f, c, g1, g2, s1, s2, gv, dtdx, dsig, sig, kap, siginv, fu, dsigu, sigu, kapu, siginvu, dt, cnd, cndinv, fcnd); \
+    step_curl_stride1(f, is, ie, g1, g2, s1, s2, gv, dtdx, dsig, sig, kap, siginv, fu, dsigu, sigu, kapu, siginvu, dt, cnd, cndinv, fcnd); \
   else									\
-    step_curl(f, c, g1, g2, s1, s2, gv, dtdx, dsig, sig, kap, siginv, fu, dsigu, sigu, kapu, siginvu, dt, cnd, cndinv, fcnd); \
+    step_curl(f, is, ie, g1, g2, s1, s2, gv, dtdx, dsig, sig, kap, siginv, fu, dsigu, sigu, kapu, siginvu, dt, cnd, cndinv, fcnd); \
 } while (0)
 
-#define STEP_UPDATE_EDHB(f, fc, gv, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, dsigw, sigw, kapw) do { \
+#define STEP_UPDATE_EDHB(f, is, ie, gv, g, g1, g2, gP, ngP, u, u1, u2, uidx8, uidx16, s, s1, s2, chi2, chi3, fw, dsigw, sigw, kapw) do { \
   if (LOOPS_ARE_STRIDE1(gv))						\
-    step_update_EDHB_stride1(f, fc, gv, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, dsigw, sigw, kapw); \
+    step_update_EDHB_stride1(f, is, ie, gv, g, g1, g2, gP, ngP, u, u1, u2, uidx8, uidx16, s, s1, s2, chi2, chi3, fw, dsigw, sigw, kapw); \
   else									\
-    step_update_EDHB(f, fc, gv, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, dsigw, sigw, kapw); \
+    step_update_EDHB(f, is, ie, gv, g, g1, g2, gP, ngP, u, u1, u2, uidx8, uidx16, s, s1, s2, chi2, chi3, fw, dsigw, sigw, kapw); \
 } while (0)
 
 #define STEP_BETA(f, c, g, gv, betadt, dsig, siginv, fu, dsigu, siginvu, cndinv, fcnd) do {	\
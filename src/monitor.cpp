@@ -211,7 +211,7 @@ double fields::get_chi1inv(component c, direction d,
 double fields_chunk::get_chi1inv(component c, direction d,
 			     const ivec &iloc) const {
   double res = 0.0;
-  if (is_mine()) res = s->chi1inv[c][d] ? s->chi1inv[c][d][gv.index(c, iloc)]
+  if (is_mine()) res = s->chi1inv[c][d] ? s->chi1inv_at(c, d, gv.index(c, iloc))
 		   : (d == component_direction(c) ? 1.0 : 0);
   return broadcast(n_proc(), res);
 }
@@ -271,7 +271,7 @@ double structure::get_chi1inv(component c, direction d,
 double structure_chunk::get_chi1inv(component c, direction d,
 				    const ivec &iloc) const {
   double res = 0.0;
-  if (is_mine()) res = chi1inv[c][d] ? chi1inv[c][d][gv.index(c, iloc)] 
+  if (is_mine()) res = chi1inv[c][d] ? chi1inv_at(c, d, gv.index(c, iloc))
 		   : (d == component_direction(c) ? 1.0 : 0);
   return broadcast(n_proc(), res);
 }
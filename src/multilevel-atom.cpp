@@ -34,6 +34,7 @@ multilevel_susceptibility::multilevel_susceptibility(int theL, int theT,
 			    const realnum *theomega,
 			    const realnum *thegamma,
 			    const realnum *thesigmat) {
+  batched = true;
   L = theL;
   T = theT;
   Gamma = new realnum[L*L];
@@ -52,6 +53,7 @@ multilevel_susceptibility::multilevel_susceptibility(int theL, int theT,
 
 multilevel_susceptibility::multilevel_susceptibility(const multilevel_susceptibility &from) :
   susceptibility(from) {
+  batched = from.batched;
   L = from.L; T = from.T;
   Gamma = new realnum[L*L];
   memcpy(Gamma, from.Gamma, sizeof(realnum) * L*L);
@@ -121,7 +123,7 @@ typedef struct {
   realnum *GammaInv; // inv(1 + Gamma * dt / 2)
   realnumP *P[NUM_FIELD_COMPONENTS][2]; // P[c][cmp][transition][i]
   realnumP *P_prev[NUM_FIELD_COMPONENTS][2];
-  realnum *N; // ntot x L array of centered grid populations N[i*L + level]
+  realnum *N; // L x ntot array of centered grid populations N[level*ntot + i]
   realnum *Ntmp; // temporary length L array of levels, used in updating
   realnum data[1];
 } multilevel_data;
@@ -178,9 +180,9 @@ void multilevel_susceptibility::init_internal_data(
   d->N = P + L; // the last L*ntot block of the data
 
   // initial populations
-  for (int i = 0; i < ntot; ++i)
-    for (int l = 0; l < L; ++l)
-      d->N[i*L + l] = N0[l];
+  for (int l = 0; l < L; ++l)
+    for (int i = 0; i < ntot; ++i)
+      d->N[l*ntot + i] = N0[l];
 }
 
 void multilevel_susceptibility::delete_internal_data(void *data) const {
@@ -218,6 +220,10 @@ void *multilevel_susceptibility::copy_internal_data(void *data) const {
   return (void*) dnew;
 }
 
+size_t multilevel_susceptibility::size_internal_data(void *data) const {
+  return data ? ((multilevel_data *) data)->sz_data : 0;
+}
+
 int multilevel_susceptibility::num_cinternal_notowned_needed(component c,
 				   void *P_internal_data) const {
   multilevel_data *d = (multilevel_data *) P_internal_data;
@@ -229,39 +235,31 @@ realnum *multilevel_susceptibility::cinternal_notowned_ptr(
 					int n, 
 					void *P_internal_data) const {
   multilevel_data *d = (multilevel_data *) P_internal_data;
-  if (!d->P[c][cmp] || inotowned < 0 || inotowned >= T) // never true
-    return NULL;
+  if (!d || !d->P[c][cmp] || inotowned < 0 || inotowned >= T)
+    return NULL; // no data if the chunk is on another process
   return d->P[c][cmp][inotowned] + n;
 }
 
-void multilevel_susceptibility::update_P
-       (realnum *W[NUM_FIELD_COMPONENTS][2],
-	realnum *W_prev[NUM_FIELD_COMPONENTS][2], 
-	double dt, const grid_volume &gv, void *P_internal_data) const {
-  multilevel_data *d = (multilevel_data *) P_internal_data;
-  double dt2 = 0.5 * dt;
-
-  // field directions and offsets for E * dP dot product.
-  component cdot[3] = {Dielectric,Dielectric,Dielectric};
-  int o1[3], o2[3];
-  int idot = 0;
-  FOR_COMPONENTS(c) if (d->P[c][0]) {
-    if (idot == 3) abort("bug in meep: too many polarization components");
-    gv.yee2cent_offsets(c, o1[idot], o2[idot]);
-    cdot[idot++] = c;
-  }
-
-  // update N from W and P
+/* Population update one voxel at a time, for any number of levels L. */
+static void update_N_generic(const multilevel_data *d, int L, int T,
+			     const realnum *Gamma, const realnum *alpha,
+			     double dt2, const component *cdot,
+			     const int *o1, const int *o2,
+			     realnum *W[NUM_FIELD_COMPONENTS][2],
+			     realnum *W_prev[NUM_FIELD_COMPONENTS][2],
+			     const grid_volume &gv) {
+  const int ntot = d->ntot;
+  int idot;
   realnum *GammaInv = d->GammaInv;
   realnum *Ntmp = d->Ntmp;
   LOOP_OVER_VOL_OWNED(gv, Centered, i) {
-    realnum *N = d->N + i*L; // N at current point, to update
+    realnum *N = d->N + i; // N at current point (stride ntot), to update
     
     // Ntmp = (I - Gamma * dt/2) * N
     for (int l1 = 0; l1 < L; ++l1) {
-      Ntmp[l1] = (1.0 - Gamma[l1*L + l1]*dt2) * N[l1]; // diagonal term
-      for (int l2 = 0; l2 < l1; ++l2) Ntmp[l1] -= Gamma[l1*L+l2]*dt2 * N[l2];
-      for (int l2 = l1+1; l2 < L; ++l2) Ntmp[l1] -= Gamma[l1*L+l2]*dt2 * N[l2];
+      Ntmp[l1] = (1.0 - Gamma[l1*L + l1]*dt2) * N[l1*ntot]; // diagonal term
+      for (int l2 = 0; l2 < l1; ++l2) Ntmp[l1] -= Gamma[l1*L+l2]*dt2 * N[l2*ntot];
+      for (int l2 = l1+1; l2 < L; ++l2) Ntmp[l1] -= Gamma[l1*L+l2]*dt2 * N[l2*ntot];
     }
 
     // compute E*8 at point i
@@ -301,10 +299,153 @@ void multilevel_susceptibility::update_P
 
     // N = GammaInv * Ntmp
     for (int l1 = 0; l1 < L; ++l1) {
-      N[l1] = 0;
-      for (int l2 = 0; l2 < L; ++l2) N[l1] += GammaInv[l1*L+l2] * Ntmp[l2];
+      N[l1*ntot] = 0;
+      for (int l2 = 0; l2 < L; ++l2) N[l1*ntot] += GammaInv[l1*L+l2] * Ntmp[l2];
     }
   }
+}
+
+/* Population update for one row of voxels, NBATCH voxels at a time,
+   for a compile-time number of levels L.  Each step below is a loop
+   over the voxels of the batch with the level loops unrolled, so that
+   the compiler can vectorize across voxels (the populations are stored
+   level-major for this reason).  The sums are in the order and the
+   precision (realnum) of update_N_generic, so that both give the same
+   results.  S1 is whether the row has stride 1. */
+#define NBATCH 64
+
+template <int L, bool S1>
+static void update_N_row(const multilevel_data *d, int T, const double *A,
+			 const realnum *alpha, int ndot, const component *cdot,
+			 const int *o1, const int *o2,
+			 realnum *W[NUM_FIELD_COMPONENTS][2],
+			 realnum *W_prev[NUM_FIELD_COMPONENTS][2],
+			 int i0, int n3, int s3) {
+  const int ntot = d->ntot;
+  const int s = S1 ? 1 : s3;
+  const realnum *GammaInv = d->GammaInv;
+  realnum *N = d->N;
+  realnum Ntmp[L][NBATCH];
+  double E8[3][2][NBATCH], EdP32[NBATCH];
+
+  for (int jb = 0; jb < n3; jb += NBATCH) {
+    const int nb = n3 - jb < NBATCH ? n3 - jb : NBATCH;
+    const int ib = i0 + jb * s;
+
+    // Ntmp = (I - Gamma * dt/2) * N, diagonal term first
+    for (int l1 = 0; l1 < L; ++l1)
+      for (int k = 0; k < nb; ++k) {
+	const int i = ib + k * s;
+	realnum sum = A[l1*L + l1] * N[l1*ntot + i];
+	for (int l2 = 0; l2 < L; ++l2)
+	  if (l2 != l1) sum += A[l1*L + l2] * N[l2*ntot + i];
+	Ntmp[l1][k] = sum;
+      }
+
+    // compute E*8 at the points
+    for (int idot = 0; idot < ndot; ++idot) DOCMP2 {
+      const realnum *w = W[cdot[idot]][cmp], *wp = W_prev[cdot[idot]][cmp];
+      const int a = o1[idot], b = o2[idot];
+      if (w)
+	for (int k = 0; k < nb; ++k) {
+	  const int i = ib + k * s;
+	  E8[idot][cmp][k] = w[i]+w[i+a]+w[i+b]+w[i+a+b]
+	    + wp[i]+wp[i+a]+wp[i+b]+wp[i+a+b];
+	}
+      else
+	for (int k = 0; k < nb; ++k) E8[idot][cmp][k] = 0;
+    }
+
+    // Ntmp = Ntmp + alpha * E * dP
+    for (int t = 0; t < T; ++t) {
+      for (int k = 0; k < nb; ++k) EdP32[k] = 0;
+      for (int idot = 0; idot < ndot; ++idot) DOCMP2
+	if (d->P[cdot[idot]][cmp]) {
+	  const realnum *p = d->P[cdot[idot]][cmp][t];
+	  const realnum *pp = d->P_prev[cdot[idot]][cmp][t];
+	  const int a = o1[idot], b = o2[idot];
+	  const realnum sgn = cmp ? 1 : -1; // same as the generic loop
+	  for (int k = 0; k < nb; ++k) {
+	    const int i = ib + k * s;
+	    realnum dP = p[i]+p[i+a]+p[i+b]+p[i+a+b]
+	      + sgn * (pp[i]+pp[i+a]+pp[i+b]+pp[i+a+b]);
+	    EdP32[k] += dP * E8[idot][cmp][k];
+	  }
+	}
+      for (int l = 0; l < L; ++l) {
+	const double al = alpha[l*T + t];
+	if (al != 0)
+	  for (int k = 0; k < nb; ++k)
+	    Ntmp[l][k] += al * (EdP32[k] * 0.03125); /* divide by 32 */
+      }
+    }
+
+    // N = GammaInv * Ntmp
+    for (int l1 = 0; l1 < L; ++l1)
+      for (int k = 0; k < nb; ++k) {
+	realnum sum = 0;
+	for (int l2 = 0; l2 < L; ++l2) sum += GammaInv[l1*L+l2] * Ntmp[l2][k];
+	N[l1*ntot + ib + k * s] = sum;
+      }
+  }
+}
+
+template <int L>
+static void update_N_batched(const multilevel_data *d, int T,
+			     const realnum *Gamma, double dt2,
+			     const realnum *alpha, int ndot,
+			     const component *cdot,
+			     const int *o1, const int *o2,
+			     realnum *W[NUM_FIELD_COMPONENTS][2],
+			     realnum *W_prev[NUM_FIELD_COMPONENTS][2],
+			     const grid_volume &gv) {
+  double A[L*L]; // I - Gamma * dt/2
+  for (int l1 = 0; l1 < L; ++l1)
+    for (int l2 = 0; l2 < L; ++l2)
+      A[l1*L + l2] = (l1 == l2) - Gamma[l1*L + l2] * dt2;
+
+  LOOP_OVER_IVEC_ROWS(gv, gv.little_owned_corner(Centered), gv.big_corner(),
+		      i0) {
+    if (loop_s3 == 1)
+      update_N_row<L,true>(d, T, A, alpha, ndot, cdot, o1, o2, W, W_prev,
+			   i0, loop_n3, loop_s3);
+    else
+      update_N_row<L,false>(d, T, A, alpha, ndot, cdot, o1, o2, W, W_prev,
+			    i0, loop_n3, loop_s3);
+  }
+}
+
+void multilevel_susceptibility::update_P
+       (realnum *W[NUM_FIELD_COMPONENTS][2],
+	realnum *W_prev[NUM_FIELD_COMPONENTS][2], 
+	double dt, const grid_volume &gv, void *P_internal_data) const {
+  multilevel_data *d = (multilevel_data *) P_internal_data;
+  double dt2 = 0.5 * dt;
+  const int ntot = d->ntot;
+
+  // field directions and offsets for E * dP dot product.
+  component cdot[3] = {Dielectric,Dielectric,Dielectric};
+  int o1[3], o2[3];
+  int idot = 0;
+  FOR_COMPONENTS(c) if (d->P[c][0]) {
+    if (idot == 3) abort("bug in meep: too many polarization components");
+    gv.yee2cent_offsets(c, o1[idot], o2[idot]);
+    cdot[idot++] = c;
+  }
+  const int ndot = idot;
+
+  // update N from W and P
+  if (batched && L == 2)
+    update_N_batched<2>(d, T, Gamma, dt2, alpha, ndot, cdot, o1, o2,
+			W, W_prev, gv);
+  else if (batched && L == 3)
+    update_N_batched<3>(d, T, Gamma, dt2, alpha, ndot, cdot, o1, o2,
+			W, W_prev, gv);
+  else if (batched && L == 4)
+    update_N_batched<4>(d, T, Gamma, dt2, alpha, ndot, cdot, o1, o2,
+			W, W_prev, gv);
+  else
+    update_N_generic(d, L, T, Gamma, alpha, dt2, cdot, o1, o2, W, W_prev, gv);
 
   // each P is updated as a damped harmonic oscillator
   for (int t = 0; t < T; ++t) {
@@ -328,8 +469,7 @@ void multilevel_susceptibility::update_P
 
 	int o1, o2;
 	gv.cent2yee_offsets(c, o1, o2);
-	o1 *= L; o2 *= L;
-	const realnum *N = d->N;
+	const realnum *Np = d->N + lp*ntot, *Nm = d->N + lm*ntot;
 	
 	// directions/strides for offdiagonal terms, similar to update_eh
 	const direction d = component_direction(c);
@@ -348,10 +488,9 @@ void multilevel_susceptibility::update_P
 	else { // isotropic
 	  LOOP_OVER_VOL_OWNED(gv, c, i) {
 	    realnum pcur = p[i];
-	    const realnum *Ni = N + i*L;
 	    // dNi is population inversion for this transition
-	    double dNi = -0.25 * (Ni[lp]+Ni[lp+o1]+Ni[lp+o2]+Ni[lp+o1+o2]
-				  -Ni[lm]-Ni[lm+o1]-Ni[lm+o2]-Ni[lm+o1+o2]);
+	    double dNi = -0.25 * (Np[i]+Np[i+o1]+Np[i+o2]+Np[i+o1+o2]
+				  -Nm[i]-Nm[i+o1]-Nm[i+o2]-Nm[i+o1+o2]);
 	    p[i] = gamma1inv * (pcur * (2 - omega0dtsqr) 
 				- gamma1 * pp[i] 
 				+ omega0dtsqr * (st * s[i] * w[i])) * dNi;
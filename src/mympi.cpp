@@ -32,6 +32,10 @@
 #  include <mpi.h>
 #endif
 
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
 #ifdef IGNORE_SIGFPE
 #  include <signal.h>
 #endif
@@ -79,7 +83,13 @@ bool quiet = false; // defined in meep.h
 
 initialize::initialize(int &argc, char** &argv) {
 #ifdef HAVE_MPI
+#  ifdef _OPENMP
+  /* only the master thread communicates; the threads just step chunks */
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#  else
   MPI_Init(&argc, &argv);
+#  endif
   int major, minor;
   MPI_Get_version(&major, &minor);
   if (!quiet) master_printf("Using MPI version %d.%d, %d processes\n", 
@@ -93,6 +103,10 @@ initialize::initialize(int &argc, char** &argv) {
 #endif
 #ifdef IGNORE_SIGFPE
   signal(SIGFPE, SIG_IGN);
+#endif
+#ifdef _OPENMP
+  if (!quiet && count_threads() > 1)
+    master_printf("Using %d OpenMP threads per process\n", count_threads());
 #endif
   t_start = wall_time();
 }
@@ -146,7 +160,71 @@ void send(int from, int to, double *data, int size) {
 #endif
 }
 
+void send(int from, int to, int *data, int size) {
+#ifdef HAVE_MPI
+  if (from == to) return;
+  if (size == 0) return;
+  const int me = my_rank();
+  if (from == me) MPI_Send(data, size, MPI_INT, to, 1, mycomm);
+  MPI_Status stat;
+  if (to == me) MPI_Recv(data, size, MPI_INT, from, 1, mycomm, &stat);
+#else
+  UNUSED(from);
+  UNUSED(to);
+  UNUSED(data);
+  UNUSED(size);
+#endif
+}
+
+void send(int from, int to, char *data, int size) {
+#ifdef HAVE_MPI
+  if (from == to) return;
+  if (size == 0) return;
+  const int me = my_rank();
+  if (from == me) MPI_Send(data, size, MPI_CHAR, to, 1, mycomm);
+  MPI_Status stat;
+  if (to == me) MPI_Recv(data, size, MPI_CHAR, from, 1, mycomm, &stat);
+#else
+  UNUSED(from);
+  UNUSED(to);
+  UNUSED(data);
+  UNUSED(size);
+#endif
+}
+
+/* every process sends data to the next process (rank + 1, cyclically)
+   and replaces it with the data of the previous one */
+void send_to_next(double *data, int size) {
+#ifdef HAVE_MPI
+  const int np = count_processors();
+  if (np == 1 || size == 0) return;
+  const int me = my_rank();
+  MPI_Status stat;
+  MPI_Sendrecv_replace(data, size, MPI_DOUBLE, (me + 1) % np, 1,
+                       (me + np - 1) % np, 1, mycomm, &stat);
+#else
+  UNUSED(data);
+  UNUSED(size);
+#endif
+}
+
 #if MEEP_SINGLE
+void send(int from, int to, realnum *data, int size) {
+#ifdef HAVE_MPI
+  if (from == to) return;
+  if (size == 0) return;
+  const int me = my_rank();
+  if (from == me) MPI_Send(data, size, MPI_FLOAT, to, 1, mycomm);
+  MPI_Status stat;
+  if (to == me) MPI_Recv(data, size, MPI_FLOAT, from, 1, mycomm, &stat);
+#else
+  UNUSED(from);
+  UNUSED(to);
+  UNUSED(data);
+  UNUSED(size);
+#endif
+}
+
 void broadcast(int from, realnum *data, int size) {
 #ifdef HAVE_MPI
   if (size == 0) return;
@@ -301,6 +379,14 @@ void sum_to_master(const double *in, double *out, int size) {
 #endif
 }
 
+void sum_to_master(const float *in, float *out, int size) {
+#ifdef HAVE_MPI
+  MPI_Reduce((void*) in, out, size, MPI_FLOAT,MPI_SUM,0,mycomm);
+#else
+  memcpy(out, in, sizeof(float) * size);
+#endif
+}
+
 void sum_to_all(const float *in, double *out, int size) {
   double *in2 = new double[size];
   for (int i = 0; i < size; ++i) in2[i] = in[i];
@@ -431,52 +517,117 @@ int count_processors() {
 #endif
 }
 
-void fields::boundary_communications(field_type ft) {
-  // Communicate the data around!
-#if 0 // This is the blocking version, which should always be safe!
-  for (int noti=0;noti<num_chunks;noti++)
-    for (int j=0;j<num_chunks;j++) {
-      const int i = (noti+j)%num_chunks;
-      const int pair = j+i*num_chunks;
-      DOCMP {
-        send(chunks[j]->n_proc(), chunks[i]->n_proc(),
-             comm_blocks[ft][pair], comm_size_tot(ft,pair));
-      }
-    }
-#endif
-#ifdef HAVE_MPI
-  const int maxreq = num_chunks*num_chunks;
-  MPI_Request *reqs = new MPI_Request[maxreq];
-  MPI_Status *stats = new MPI_Status[maxreq];
-  int reqnum = 0;
-  int *tagto = new int[count_processors()];
-  for (int i=0;i<count_processors();i++) tagto[i] = 0;
-  for (int noti=0;noti<num_chunks;noti++)
-    for (int j=0;j<num_chunks;j++) {
-      const int i = (noti+j)%num_chunks;
-      const int pair = j+i*num_chunks;
-      const int comm_size = comm_size_tot(ft,pair);
-      if (comm_size > 0) {
-	if (chunks[j]->is_mine() && !chunks[i]->is_mine())
-	  MPI_Isend(comm_blocks[ft][pair], comm_size,
-		    MPI_REALNUM, chunks[i]->n_proc(),
-		    tagto[chunks[i]->n_proc()]++,
-		    mycomm, &reqs[reqnum++]);
-	if (chunks[i]->is_mine() && !chunks[j]->is_mine())
-	  MPI_Irecv(comm_blocks[ft][pair], comm_size,
-		    MPI_REALNUM, chunks[j]->n_proc(),
-		    tagto[chunks[j]->n_proc()]++,
-		    mycomm, &reqs[reqnum++]);
+int count_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+void set_num_threads(int n) {
+#ifdef _OPENMP
+  if (n > 0) omp_set_num_threads(n);
+#else
+  UNUSED(n);
+#endif
+}
+
+#ifdef HAVE_MPI
+struct comm_requests {
+  MPI_Request *reqs;
+  int n;
+};
+#else
+struct comm_requests { };
+#endif
+
+/* Set up persistent requests for the sends and receives of the
+   comm_blocks of each field type, so that each step_boundaries only
+   needs to start and complete them.  They must be recreated whenever
+   the comm_blocks are reallocated, i.e. by connect_chunks. */
+void fields::plan_boundary_communications() {
+  free_boundary_communications();
+  FOR_FIELD_TYPES(ft) {
+    comm_plan[ft] = new comm_requests;
+#ifdef HAVE_MPI
+    int reqnum = 0;
+    for (int pair=0;pair<num_chunks*num_chunks;pair++)
+      if (comm_size_tot(ft,pair) > 0
+	  && chunks[pair % num_chunks]->is_mine()
+	  != chunks[pair / num_chunks]->is_mine())
+	++reqnum;
+    MPI_Request *reqs = new MPI_Request[reqnum];
+    reqnum = 0;
+    /* The tags count the messages between each pair of processes, in an
+       order that both of them agree on. */
+    int *tagto = new int[count_processors()];
+    for (int i=0;i<count_processors();i++) tagto[i] = 0;
+    for (int noti=0;noti<num_chunks;noti++)
+      for (int j=0;j<num_chunks;j++) {
+	const int i = (noti+j)%num_chunks;
+	const int pair = j+i*num_chunks;
+	const int comm_size = comm_size_tot(ft,pair);
+	if (comm_size > 0) {
+	  if (chunks[j]->is_mine() && !chunks[i]->is_mine())
+	    MPI_Send_init(comm_blocks[ft][pair], comm_size,
+			  MPI_REALNUM, chunks[i]->n_proc(),
+			  tagto[chunks[i]->n_proc()]++,
+			  mycomm, &reqs[reqnum++]);
+	  if (chunks[i]->is_mine() && !chunks[j]->is_mine())
+	    MPI_Recv_init(comm_blocks[ft][pair], comm_size,
+			  MPI_REALNUM, chunks[j]->n_proc(),
+			  tagto[chunks[j]->n_proc()]++,
+			  mycomm, &reqs[reqnum++]);
+	}
       }
-    }
-  delete[] tagto;
-  if (reqnum > maxreq) abort("Too many requests!!!\n");
-  if (reqnum > 0) MPI_Waitall(reqnum, reqs, stats);
-  delete[] reqs;
-  delete[] stats;
+    delete[] tagto;
+    comm_plan[ft]->reqs = reqs;
+    comm_plan[ft]->n = reqnum;
+#endif
+  }
+}
+
+void fields::free_boundary_communications() {
+  if (pending_comms) abort("bug - freeing pending boundary communications");
+  FOR_FIELD_TYPES(ft) if (comm_plan[ft]) {
+#ifdef HAVE_MPI
+    for (int i=0;i<comm_plan[ft]->n;i++)
+      MPI_Request_free(&comm_plan[ft]->reqs[i]);
+    delete[] comm_plan[ft]->reqs;
+#endif
+    delete comm_plan[ft];
+    comm_plan[ft] = NULL;
+  }
+}
+
+void fields::boundary_communications(field_type ft) {
+  start_boundary_communications(ft);
+  finish_boundary_communications(ft);
+}
+
+/* Start the sends and receives of the comm_blocks for ft, which are
+   completed by finish_boundary_communications.  In between, the
+   caller can do any work that doesn't touch the comm_blocks. */
+void fields::start_boundary_communications(field_type ft) {
+  if (pending_comms) abort("bug - boundary communications already pending");
+  if (!comm_plan[ft]) abort("bug - boundary communications not planned");
+  pending_comms = comm_plan[ft];
+#ifdef HAVE_MPI
+  if (pending_comms->n > 0) MPI_Startall(pending_comms->n, pending_comms->reqs);
+#endif
+}
+
+void fields::finish_boundary_communications(field_type ft) {
+  if (pending_comms != comm_plan[ft])
+    abort("bug - no boundary communications pending");
+#ifdef HAVE_MPI
+  if (pending_comms->n > 0)
+    MPI_Waitall(pending_comms->n, pending_comms->reqs, MPI_STATUSES_IGNORE);
 #else
   (void) ft; // unused
 #endif
+  pending_comms = NULL;
 }
 
 // IO Routines...
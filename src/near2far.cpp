@@ -22,6 +22,9 @@
 
 #include <meep.hpp>
 #include <assert.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
 #include "config.h"
 
 using namespace std;
@@ -85,10 +88,6 @@ void dft_near2far::scale_dfts(complex<double> scale) {
   if (F) F->scale_dft(scale);
 }
 
-typedef void (*greenfunc)(std::complex<double> *EH, const vec &x,
-                          double freq, double eps, double mu,
-                          const vec &x0, component c0, std::complex<double>);
-
 /* Given the field f0 correponding to current-source component c0 at
    x0, compute the E/H fields EH[6] (6 components) at x for a frequency
    freq in the homogeneous 3d medium eps and mu. 
@@ -157,19 +156,87 @@ void green3d(std::complex<double> *EH, const vec &x,
         abort("unrecognized source type");
 }
 
-#ifdef HAVE_LIBGSL
-#  include <gsl/gsl_sf_bessel.h>
-// hankel function J + iY
-static std::complex<double> hankel(int n, double x) {
-    return std::complex<double>(gsl_sf_bessel_Jn(n, x),
-                                gsl_sf_bessel_Yn(n, x));
+/* Hankel functions H0 = J0 + iY0 and H1 = J1 + iY1, to nearly machine
+   precision: by power series for x < HANKEL_XSERIES, from the J_n
+   computed by Miller's backward recurrence (normalized by J0 + 2 sum
+   J_2k = 1) and Neumann series for Y0 and Y1 for x < HANKEL_XASYM, and
+   by the asymptotic expansion (with HANKEL_NASYM terms each in P and Q)
+   beyond that.  Then H2 = 2 H1 / x - H0. */
+#define HANKEL_XSERIES 2.0
+#define HANKEL_XASYM 25.0
+#define HANKEL_NASYM 8
+static const double euler_gamma = 0.57721566490153286061;
+
+/* the coefficients of the asymptotic expansion of Hnu(x) =
+   sqrt(2/(pi x)) exp(i(x - nu pi/2 - pi/4)) (P + iQ), where P = sum of
+   p[m]/x^2m and Q = sum of q[m]/x^(2m+1) */
+static void hankel_asym_coefs(int nu, double *p, double *q) {
+    const double mu = 4.0 * nu * nu;
+    double a = 1; // ((mu - 1)(mu - 9)...(mu - (2k-1)^2)) / (k! 8^k)
+    for (int k = 0; k < 2 * HANKEL_NASYM; ++k) {
+        const double s = (k / 2) % 2 ? -1 : 1;
+        if (k % 2) q[k / 2] = s * a;
+        else p[k / 2] = s * a;
+        a *= (mu - (2*k + 1) * (2*k + 1)) / ((k + 1) * 8.0);
+    }
 }
-#else /* !HAVE_LIBGSL */
-static std::complex<double> hankel(int n, double x) {
-    (void) n; (void) x; // unused
-    abort("GNU GSL library is required for Hankel functions");
+
+// H[0] = H0(x), H[1] = H1(x)
+static void hankel01(double x, std::complex<double> *H) {
+    if (x < HANKEL_XSERIES) {
+        const double t = -0.25 * x*x, L = log(0.5 * x) + euler_gamma;
+        double J0 = 0, J1 = 0, S0 = 0, S1 = 0, a = 1, Hk = 0;
+        for (int k = 0; k < 14; ++k) { // a = t^k / k!^2, Hk = 1 + ... + 1/k
+            const double b = a / (k + 1);
+            J0 += a;
+            J1 += b;
+            S0 += Hk * a;
+            S1 += (2*Hk + 1.0 / (k + 1)) * b;
+            Hk += 1.0 / (k + 1);
+            a *= t / ((k + 1) * (k + 1));
+        }
+        J1 *= 0.5 * x;
+        H[0] = std::complex<double>(J0, (2/pi) * (L * J0 - S0));
+        H[1] = std::complex<double>(J1, -2 / (pi * x) + (2/pi) * L * J1
+                                    - (0.5 / pi) * x * S1);
+    }
+    else if (x < HANKEL_XASYM) {
+        // j_n proportional to J_n, from j_N = tiny and j_(N+1) = 0
+        double j = 1e-30, jp = 0, sum = 0, S0 = 0, S1 = 0;
+        for (int n = 2 * (int(x) / 2) + 44; n > 0; --n) {
+            const double jm = (2 * n / x) * j - jp;
+            if (n % 2 == 0) { // n = 2k
+                const double s = (n / 2) % 2 ? -2.0 / n : 2.0 / n;
+                sum += 2 * j;
+                S0 += s * j;          // sum (-1)^k J_2k / k
+                S1 += s * (jm - jp);  // sum (-1)^k (J_2k-1 - J_2k+1) / k
+            }
+            jp = j;
+            j = jm;
+        }
+        const double nrm = 1 / (sum + j), J0 = j * nrm, J1 = jp * nrm;
+        const double L = log(0.5 * x) + euler_gamma;
+        H[0] = std::complex<double>(J0, (2/pi) * (L * J0 - 2 * S0 * nrm));
+        H[1] = std::complex<double>(J1, (2/pi) * (L * J1 - J0 / x
+                                                  + S1 * nrm));
+    }
+    else {
+        double p0[HANKEL_NASYM], q0[HANKEL_NASYM];
+        double p1[HANKEL_NASYM], q1[HANKEL_NASYM];
+        hankel_asym_coefs(0, p0, q0);
+        hankel_asym_coefs(1, p1, q1);
+        const double u = 1 / (x*x);
+        double P0 = 0, Q0 = 0, P1 = 0, Q1 = 0;
+        for (int m = HANKEL_NASYM - 1; m >= 0; --m) {
+            P0 = P0 * u + p0[m]; Q0 = Q0 * u + q0[m];
+            P1 = P1 * u + p1[m]; Q1 = Q1 * u + q1[m];
+        }
+        const std::complex<double> E = sqrt(2 / (pi * x))
+            * polar(1.0, x - 0.25*pi);
+        H[0] = E * std::complex<double>(P0, Q0 / x);
+        H[1] = E * std::complex<double>(Q1 / x, -P1); // exp(-i pi/2) (P+iQ)
+    }
 }
-#endif /* !HAVE_LIBGSL */
 
 /* like green3d, but 2d Green's functions */
 void green2d(std::complex<double> *EH, const vec &x,
@@ -187,8 +254,10 @@ void green2d(std::complex<double> *EH, const vec &x,
     std::complex<double> ik = std::complex<double>(0.0, k);
     double kr = k*r;
     double Z = sqrt(mu/eps);
-    std::complex<double> H0 = hankel(0, kr) * f0;
-    std::complex<double> H1 = hankel(1, kr) * f0;
+    std::complex<double> H[2];
+    hankel01(kr, H);
+    std::complex<double> H0 = H[0] * f0;
+    std::complex<double> H1 = H[1] * f0;
     std::complex<double> ikH1 = 0.25 * ik * H1;
 
     if (component_direction(c0) == meep::Z) {
@@ -210,7 +279,7 @@ void green2d(std::complex<double> *EH, const vec &x,
         }
     }
     else { /* in-plane source */
-        std::complex<double> H2 = hankel(2, kr) * f0;
+        std::complex<double> H2 = (2 / kr) * H1 - H0;
 
         vec p = zero_vec(rhat.dim);
         p.set_direction(component_direction(c0), 1);
@@ -241,34 +310,559 @@ void green2d(std::complex<double> *EH, const vec &x,
     }
 }
 
-void dft_near2far::farfield_lowlevel(std::complex<double> *EH, const vec &x)
-{
-    if (x.dim != D3 && x.dim != D2)
-        abort("only 2d or 3d far-field computation is supported");
-    greenfunc green = x.dim == D2 ? green2d : green3d;
+/* The far-field engine used by farfield_lowlevel and save_farfields.
+   The equivalent currents are described by near2far_sources: the
+   positions of the surface points of each dft_chunk, with its dft array
+   used in place (or, for the radiation patterns, merged copies of the
+   currents of each component, or a block of currents from another
+   process in save_farfields).  For each (far point, surface
+   point) pair, the geometry is then computed only once, and the fields
+   at all frequencies are a few "basis" spectra (as in green3d/green2d)
+   times real coefficients for each of the 6 field components, all
+   computed by loops over frequency on split re/im arrays that vectorize.
+   The far points are processed in blocks, so that the currents of a
+   surface point are reused from cache for all the points of a block. */
 
-    std::complex<double> EH6[6];
-    for (int i = 0; i < 6 * Nfreq; ++i)
-        EH[i] = 0.0;
-    
-    for (dft_chunk *f = F; f; f = f->next_in_dft) {
-        assert(Nfreq == f->Nomega);
+struct near2far_sources { // currents of one source component c0
+  component c0;
+  int n;      // number of surface points
+  double *x0; // n x 3 positions
+  double *f;  // n x 2 x Nfreq currents (re/im split, as in dft_chunk::dft)
+};
 
-        component c0 = component(f->vc); /* equivalent source component */
+struct farfield_data { // constants shared by all the far points
+  ndim dim;
+  int Nfreq;
+  double eps, mu, n, Z;
+  double k0, dk; // wavevectors k0 + i*dk in the medium
+  double *k, *invk, *omega; // Nfreq arrays of k, 1/k, and omega
+  int nsrc;
+  near2far_sources *src;
+  bool own_f; // whether the src[].f are copies, to be deleted
+
+  // 2d only: the asymptotic expansions of H0 and H1 (hankel_asym_coefs),
+  double hp0[HANKEL_NASYM], hq0[HANKEL_NASYM];
+  double hp1[HANKEL_NASYM], hq1[HANKEL_NASYM];
+  double *isk; // 1/sqrt(k),
+  /* and the table of H0, H1 and H1' (J0,Y0,J1,Y1,J1',Y1') at the hn
+     points hx0 + j/hinvh, or none (hn = 0) */
+  int hn;
+  double hx0, hinvh, *htab;
+};
+
+/* the currents of n2f on this process, in d->src: one near2far_sources
+   per dft_chunk, using its dft array in place, or if merge one per
+   component, with copies of the currents (so that the points of all
+   the chunks are grouped into columns by add_radiation_vectors) */
+static void get_farfield_data(const dft_near2far &n2f, farfield_data *d,
+                              ndim dim, bool merge) {
+    const int N = n2f.Nfreq;
+    d->dim = dim;
+    d->Nfreq = N;
+    d->eps = n2f.eps; d->mu = n2f.mu;
+    d->n = sqrt(n2f.eps * n2f.mu);
+    d->Z = sqrt(n2f.mu / n2f.eps);
+    d->k0 = 2*pi * n2f.freq_min * d->n;
+    d->dk = 2*pi * n2f.dfreq * d->n;
+    d->k = new double[N];
+    d->invk = new double[N];
+    d->omega = new double[N];
+    d->isk = new double[N];
+    for (int i = 0; i < N; ++i) {
+        d->omega[i] = 2*pi * (n2f.freq_min + i*n2f.dfreq);
+        d->k[i] = d->omega[i] * d->n;
+        d->invk[i] = 1 / d->k[i];
+        d->isk[i] = 1 / sqrt(d->k[i]);
+    }
+    hankel_asym_coefs(0, d->hp0, d->hq0);
+    hankel_asym_coefs(1, d->hp1, d->hq1);
+    d->hn = 0;
+    d->hx0 = d->hinvh = 0;
+    d->htab = NULL;
+
+    /* the number of points of each component, and of dft_chunks */
+    int n[NUM_FIELD_COMPONENTS], isrc[NUM_FIELD_COMPONENTS], nchunks = 0;
+    for (int c = 0; c < NUM_FIELD_COMPONENTS; ++c) n[c] = 0;
+    for (dft_chunk *f = n2f.F; f; f = f->next_in_dft) {
+        assert(N == f->Nomega);
+        if (f->dft) { n[f->vc] += f->N; ++nchunks; } // else a placeholder
+    }
+    d->nsrc = 0;
+    d->src = new near2far_sources[merge ? NUM_FIELD_COMPONENTS : nchunks];
+    d->own_f = merge;
+    if (merge)
+        for (int c = 0; c < NUM_FIELD_COMPONENTS; ++c) {
+            if (!n[c]) continue;
+            near2far_sources &s = d->src[isrc[c] = d->nsrc++];
+            s.c0 = component(c);
+            s.n = 0;
+            s.x0 = new double[size_t(n[c]) * 3];
+            s.f = new double[size_t(n[c]) * 2*N];
+        }
 
+    for (dft_chunk *f = n2f.F; f; f = f->next_in_dft) {
+        if (!f->dft) continue;
+        f->flush_dft();
+        near2far_sources *s;
+        if (merge) {
+            s = d->src + isrc[f->vc];
+            memcpy(s->f + size_t(s->n) * 2*N, f->dft,
+                   size_t(f->N) * 2*N * sizeof(double));
+        }
+        else {
+            s = d->src + d->nsrc++;
+            s->c0 = component(f->vc);
+            s->n = 0;
+            s->x0 = new double[size_t(f->N) * 3];
+            s->f = f->dft;
+        }
         vec rshift(f->shift * (0.5*f->fc->gv.inva));
-        int idx_dft = 0;
         LOOP_OVER_IVECS(f->fc->gv, f->is, f->ie, idx) {
             IVEC_LOOP_LOC(f->fc->gv, x0);
             x0 = f->S.transform(x0, f->sn) + rshift;
-            for (int i = 0; i < Nfreq; ++i) {
-                double freq = freq_min + i*dfreq;
-                green(EH6, x, freq, eps, mu, x0, c0, f->dft[Nfreq*idx_dft+i]);
-                for (int j = 0; j < 6; ++j) EH[i*6 + j] += EH6[j];
+            double *xj = s->x0 + size_t(s->n++) * 3;
+            xj[0] = xj[1] = xj[2] = 0;
+            LOOP_OVER_DIRECTIONS(x0.dim, dd) xj[dd] = x0.in_direction(dd);
+        }
+    }
+}
+
+static void free_farfield_data(farfield_data *d) {
+    delete[] d->k;
+    delete[] d->invk;
+    delete[] d->omega;
+    delete[] d->isk;
+    delete[] d->htab;
+    for (int j = 0; j < d->nsrc; ++j) {
+        delete[] d->src[j].x0;
+        if (d->own_f) delete[] d->src[j].f;
+    }
+    delete[] d->src;
+}
+
+/* the loop over frequency of green3d_basis, with separate restrict
+   arguments so that the compiler can vectorize it */
+static void green3d_kernel(int N, double s0, double invr,
+                           const double * restrict k,
+                           const double * restrict invk,
+                           const double * restrict f0r,
+                           const double * restrict f0i,
+                           const double * restrict pr,
+                           const double * restrict pi_,
+                           double * restrict Ur, double * restrict Ui,
+                           double * restrict Vr, double * restrict Vi,
+                           double * restrict Wr, double * restrict Wi) {
+    for (int i = 0; i < N; ++i) {
+        const double s = s0 * k[i], inv = invk[i] * invr; // 1/kr
+        const double inv2 = inv * inv;
+        const double ar = -s * (f0r[i] * pi_[i] + f0i[i] * pr[i]);
+        const double ai = s * (f0r[i] * pr[i] - f0i[i] * pi_[i]);
+        // term1 = 1 - 1/(kr)^2 + i/(kr)
+        Ur[i] = ar * (1 - inv2) - ai * inv;
+        Ui[i] = ai * (1 - inv2) + ar * inv;
+        // term2 / pdotrhat = 3/(kr)^2 - 1 - 3i/(kr)
+        Vr[i] = ar * (3*inv2 - 1) + 3 * ai * inv;
+        Vi[i] = ai * (3*inv2 - 1) - 3 * ar * inv;
+        // term3 = 1 + i/(kr)
+        Wr[i] = ar - ai * inv;
+        Wi[i] = ai + ar * inv;
+    }
+}
+
+/* the basis spectra b (U, V, W, each N complex, re/im split) of green3d
+   for current f0 at distance r: with amp = f0 k n/(4 pi r) i exp(ikr),
+   divided by eps (electric) or mu (magnetic) source, U = amp*term1,
+   V = amp*term2/pdotrhat, W = amp*term3; ph is N x 2 workspace */
+static void green3d_basis(const farfield_data &d, double r, bool electric,
+                          const double *f0, double *ph, double *b) {
+    const int N = d.Nfreq;
+    // exp(ikr), by recurrence in the equally spaced k
+    std::complex<double> e = polar(1.0, d.k0 * r);
+    const std::complex<double> de = polar(1.0, d.dk * r);
+    for (int i = 0; i < N; ++i) {
+        ph[i] = real(e);
+        ph[N + i] = imag(e);
+        e *= de;
+    }
+    const double s0 = d.n / (4*pi*r) / (electric ? d.eps : d.mu);
+    green3d_kernel(N, s0, 1/r, d.k, d.invk, f0, f0 + N, ph, ph + N,
+                   b, b + N, b + 2*N, b + 3*N, b + 4*N, b + 5*N);
+}
+
+/* the bounding box smin..smax of the surface points in d, returning
+   their number */
+static double source_bounds(const farfield_data &d, double *smin,
+                            double *smax) {
+    double nsrc = 0;
+    for (int dd = 0; dd < 3; ++dd) {
+        smin[dd] = HUGE_VAL;
+        smax[dd] = -HUGE_VAL;
+    }
+    for (int p = 0; p < d.nsrc; ++p) {
+        const near2far_sources &s = d.src[p];
+        for (int j = 0; j < s.n; ++j)
+            for (int dd = 0; dd < 3; ++dd) {
+                smin[dd] = std::min(smin[dd], s.x0[j*3 + dd]);
+                smax[dd] = std::max(smax[dd], s.x0[j*3 + dd]);
             }
-            idx_dft++;
+        nsrc += s.n;
+    }
+    return nsrc;
+}
+
+/* tabulate H0, H1 and H1' in d at the spacing 1/HANKEL_INVH, for the
+   HANKEL_XSERIES <= kr < HANKEL_XASYM that occur between nsrc currents
+   in the box smin..smax and npts far points in the box lo..hi, if there
+   are enough of them for the table to be cheaper than computing each
+   value */
+#define HANKEL_INVH 128.0
+static void make_hankel_table(farfield_data *d, const double *lo,
+                              const double *hi, int npts,
+                              const double *smin, const double *smax,
+                              double nsrc) {
+    if (!nsrc) return;
+    double rmin = 0, rmax = 0; // bounds on the distances
+    for (int dd = 0; dd < 3; ++dd) {
+        const double gap = std::max(0.0, std::max(smin[dd] - hi[dd],
+                                                  lo[dd] - smax[dd]));
+        const double far = std::max(fabs(hi[dd] - smin[dd]),
+                                    fabs(smax[dd] - lo[dd]));
+        rmin += gap * gap;
+        rmax += far * far;
+    }
+    const int N = d->Nfreq;
+    const double kmin = std::min(d->k[0], d->k[N-1]);
+    const double kmax = std::max(d->k[0], d->k[N-1]);
+    const double xlo = std::max(HANKEL_XSERIES, kmin * sqrt(rmin));
+    const double xhi = std::min(HANKEL_XASYM, kmax * sqrt(rmax));
+    if (xlo >= xhi) return;
+    const int n = int((xhi - xlo) * HANKEL_INVH) + 2;
+    if (nsrc * npts * N < 8.0 * n) return; // not worth it
+
+    d->hn = n;
+    d->hx0 = xlo;
+    d->hinvh = HANKEL_INVH;
+    d->htab = new double[n * 6];
+    for (int j = 0; j < n; ++j) {
+        const double x = xlo + j / HANKEL_INVH;
+        std::complex<double> H[2];
+        hankel01(x, H);
+        const std::complex<double> dH1 = H[0] - H[1] / x;
+        double *t = d->htab + j*6;
+        t[0] = real(H[0]); t[1] = imag(H[0]);
+        t[2] = real(H[1]); t[3] = imag(H[1]);
+        t[4] = real(dH1); t[5] = imag(dH1);
+    }
+}
+
+/* H0 and H1 at x, by cubic Hermite interpolation in the table of d
+   (with H0' = -H1), or computed if x is not in the table */
+static void hankel01_lookup(const farfield_data &d, double x,
+                            std::complex<double> *H) {
+    const double s = (x - d.hx0) * d.hinvh;
+    if (!(s >= 0 && s < d.hn - 1)) {
+        hankel01(x, H);
+        return;
+    }
+    const int j = int(s);
+    const double t = s - j, h = 1 / d.hinvh;
+    const double c0 = (1 + 2*t) * (1 - t) * (1 - t), c1 = t * t * (3 - 2*t);
+    const double d0 = h * t * (1 - t) * (1 - t), d1 = h * t * t * (t - 1);
+    const double *a = d.htab + j*6, *b = a + 6;
+    H[0] = std::complex<double>(c0 * a[0] + c1 * b[0] - d0 * a[2] - d1 * b[2],
+                                c0 * a[1] + c1 * b[1] - d0 * a[3] - d1 * b[3]);
+    H[1] = std::complex<double>(c0 * a[2] + c1 * b[2] + d0 * a[4] + d1 * b[4],
+                                c0 * a[3] + c1 * b[3] + d0 * a[5] + d1 * b[5]);
+}
+
+/* the loop over frequency of green2d_basis for kr >= HANKEL_XASYM, using
+   the asymptotic expansions of H0 and H1 with the coefficients of d,
+   where s0 = sqrt(2/(pi r)) and e = exp(i(kr - pi/4)); separate restrict
+   arguments so that the compiler can vectorize it */
+static void green2d_kernel(int n, double s0, double invr,
+                           const double * restrict p0,
+                           const double * restrict q0,
+                           const double * restrict p1,
+                           const double * restrict q1,
+                           const double * restrict invk,
+                           const double * restrict isk,
+                           const double * restrict w,
+                           const double * restrict f0r,
+                           const double * restrict f0i,
+                           const double * restrict er,
+                           const double * restrict ei,
+                           double * restrict Ur, double * restrict Ui,
+                           double * restrict Vr, double * restrict Vi,
+                           double * restrict Wr, double * restrict Wi,
+                           double * restrict Xr, double * restrict Xi) {
+    for (int i = 0; i < n; ++i) {
+        const double inv = invk[i] * invr, u = inv * inv; // 1/kr, 1/(kr)^2
+        double P0 = 0, Q0 = 0, P1 = 0, Q1 = 0;
+        for (int m = HANKEL_NASYM - 1; m >= 0; --m) {
+            P0 = P0 * u + p0[m]; Q0 = Q0 * u + q0[m];
+            P1 = P1 * u + p1[m]; Q1 = Q1 * u + q1[m];
+        }
+        Q0 *= inv; Q1 *= inv;
+        // E = sqrt(2/(pi kr)) exp(i(kr - pi/4)) f0; H0 = E (P0 + iQ0)
+        // and H1 = -i E (P1 + iQ1) (times f0)
+        const double A = s0 * isk[i];
+        const double Er = A * (er[i] * f0r[i] - ei[i] * f0i[i]);
+        const double Ei = A * (er[i] * f0i[i] + ei[i] * f0r[i]);
+        const double H0r = Er * P0 - Ei * Q0, H0i = Er * Q0 + Ei * P0;
+        const double H1r = Er * Q1 + Ei * P1, H1i = Ei * Q1 - Er * P1;
+        Ur[i] = H1r; Ui[i] = H1i;
+        // H0 - H2 = 2 H0 - 2 H1 / kr
+        Vr[i] = 2 * w[i] * (H0r - H1r * inv);
+        Vi[i] = 2 * w[i] * (H0i - H1i * inv);
+        Wr[i] = -w[i] * H1i; Wi[i] = w[i] * H1r;
+        Xr[i] = w[i] * H0r; Xi[i] = w[i] * H0i;
+    }
+}
+
+/* the basis spectra b (U, V, W, X, each N complex, re/im split) of
+   green2d for current f0 at distance r: U = H1 f0, V = omega (H0-H2) f0,
+   W = i omega H1 f0 and X = omega H0 f0, where Hn = Hn(kr); ph is N x 2
+   workspace */
+static void green2d_basis(const farfield_data &d, double r,
+                          const double *f0, double *ph, double *b) {
+    const int N = d.Nfreq;
+    // the frequencies i >= i0 have kr >= HANKEL_XASYM (if k increases)
+    int i0 = 0;
+    if (d.dk >= 0)
+        while (i0 < N && d.k[i0] * r < HANKEL_XASYM) ++i0;
+    else
+        i0 = N;
+
+    const double *f0r = f0, *f0i = f0 + N;
+    for (int i = 0; i < i0; ++i) {
+        const double kr = d.k[i] * r, w = d.omega[i];
+        const std::complex<double> f(f0r[i], f0i[i]);
+        std::complex<double> H[2];
+        hankel01_lookup(d, kr, H);
+        const std::complex<double> H0 = H[0] * f, H1 = H[1] * f;
+        const std::complex<double> H02 = (2 * w) * (H0 - H1 / kr);
+        b[i] = real(H1); b[N + i] = imag(H1);
+        b[2*N + i] = real(H02); b[3*N + i] = imag(H02);
+        b[4*N + i] = -w * imag(H1); b[5*N + i] = w * real(H1);
+        b[6*N + i] = w * real(H0); b[7*N + i] = w * imag(H0);
+    }
+    if (i0 == N) return;
+
+    // exp(i(kr - pi/4)), by recurrence in the equally spaced k
+    std::complex<double> e = polar(1.0, d.k[i0] * r - 0.25*pi);
+    const std::complex<double> de = polar(1.0, d.dk * r);
+    for (int i = i0; i < N; ++i) {
+        ph[i] = real(e);
+        ph[N + i] = imag(e);
+        e *= de;
+    }
+    green2d_kernel(N - i0, sqrt(2 / (pi * r)), 1 / r,
+                   d.hp0, d.hq0, d.hp1, d.hq1,
+                   d.invk + i0, d.isk + i0, d.omega + i0,
+                   f0r + i0, f0i + i0, ph + i0, ph + N + i0,
+                   b + i0, b + N + i0, b + 2*N + i0, b + 3*N + i0,
+                   b + 4*N + i0, b + 5*N + i0, b + 6*N + i0, b + 7*N + i0);
+}
+
+/* coef[m][j] (m = Ex,Ey,Ez,Hx,Hy,Hz) of the basis spectra (U,V,W) of
+   green3d for a source c0 (unit vector p) in direction rhat */
+static void green3d_coefs(const farfield_data &d, component c0,
+                          const double *rhat, double coef[6][4]) {
+    double p[3] = {0,0,0};
+    p[component_direction(c0)] = 1;
+    const double pdotrhat = rhat[0]*p[0] + rhat[1]*p[1] + rhat[2]*p[2];
+    const double rhatcrossp[3] = { rhat[1] * p[2] - rhat[2] * p[1],
+                                   rhat[2] * p[0] - rhat[0] * p[2],
+                                   rhat[0] * p[1] - rhat[1] * p[0] };
+    // the "direct" field (E for an E source) and the "cross" field
+    const int m0 = is_electric(c0) ? 0 : 3, m1 = 3 - m0;
+    const double cross = is_electric(c0) ? 1 / d.Z : -d.Z;
+    for (int j = 0; j < 3; ++j) {
+        coef[m0 + j][0] = p[j];
+        coef[m0 + j][1] = pdotrhat * rhat[j];
+        coef[m0 + j][2] = 0;
+        coef[m1 + j][0] = coef[m1 + j][1] = 0;
+        coef[m1 + j][2] = cross * rhatcrossp[j];
+    }
+}
+
+/* coef[m][j] of the basis spectra (U,V,W,X) of green2d for a source c0
+   in direction rhat at distance r */
+static void green2d_coefs(const farfield_data &d, component c0,
+                          const double *rhat, double r, double coef[6][4]) {
+    for (int m = 0; m < 6; ++m)
+        for (int j = 0; j < 4; ++j)
+            coef[m][j] = 0;
+    const double ik = 0.25 * d.n; // ik H1 / 4 = ik * W
+    if (component_direction(c0) == meep::Z) {
+        if (is_electric(c0)) { // Ez source
+            coef[2][3] = -0.25 * d.mu;
+            coef[3][2] = -rhat[1] * ik;
+            coef[4][2] = rhat[0] * ik;
+        }
+        else { // Hz source
+            coef[0][2] = rhat[1] * ik;
+            coef[1][2] = -rhat[0] * ik;
+            coef[5][3] = -0.25 * d.eps;
+        }
+    }
+    else { /* in-plane source */
+        double p[2] = {0,0};
+        p[component_direction(c0)] = 1;
+        const double pdotrhat = rhat[0] * p[0] + rhat[1] * p[1];
+        const double rhatcrossp = rhat[0] * p[1] - rhat[1] * p[0];
+        const bool electric = is_electric(c0);
+        const int m = electric ? 0 : 3; // the in-plane field components
+        const double z = electric ? d.Z : 1 / d.Z;
+        const double em = electric ? d.mu : d.eps;
+        coef[m][0] = -rhat[0] * (pdotrhat/r * 0.25*z);
+        coef[m][1] = rhat[1] * (rhatcrossp * em * 0.125);
+        coef[m + 1][0] = -rhat[1] * (pdotrhat/r * 0.25*z);
+        coef[m + 1][1] = -rhat[0] * (rhatcrossp * em * 0.125);
+        coef[electric ? 5 : 2][2] = (electric ? -rhatcrossp : rhatcrossp) * ik;
+    }
+}
+
+/* add the far fields of all the currents in d at the nx points x (an
+   nx x 3 array of coordinates) to EH, an nx x 6 x 2 x Nfreq array of
+   the (Ex,Ey,Ez,Hx,Hy,Hz) spectra, re/im split */
+static void add_farfields(const farfield_data &d, const double *x, int nx,
+                          double *EH) {
+    const int N = d.Nfreq, nb = d.dim == D3 ? 3 : 4;
+    double *b = new double[4 * 2*N]; // basis spectra
+    double *work = new double[2*N];
+    double coef[6][4];
+    for (int p = 0; p < d.nsrc; ++p) {
+        const near2far_sources &s = d.src[p];
+        const component c0 = s.c0;
+        for (int j = 0; j < s.n; ++j) {
+            const double *x0 = s.x0 + j*3, *f0 = s.f + size_t(j)*2*N;
+            for (int q = 0; q < nx; ++q) {
+                double rhat[3] = { x[q*3] - x0[0], x[q*3+1] - x0[1],
+                                   x[q*3+2] - x0[2] };
+                const double r = sqrt(rhat[0]*rhat[0] + rhat[1]*rhat[1]
+                                      + rhat[2]*rhat[2]);
+                for (int k = 0; k < 3; ++k) rhat[k] /= r;
+                if (d.dim == D3) {
+                    green3d_basis(d, r, is_electric(c0), f0, work, b);
+                    green3d_coefs(d, c0, rhat, coef);
+                }
+                else {
+                    green2d_basis(d, r, f0, work, b);
+                    green2d_coefs(d, c0, rhat, r, coef);
+                }
+                double *out = EH + q * 6*2*N;
+                for (int m = 0; m < 6; ++m, out += 2*N)
+                    for (int jb = 0; jb < nb; ++jb)
+                        if (coef[m][jb] != 0) {
+                            const double c = coef[m][jb];
+                            const double *bj = b + jb*2*N;
+                            for (int i = 0; i < 2*N; ++i) out[i] += c * bj[i];
+                        }
+            }
+        }
+    }
+    delete[] work;
+    delete[] b;
+}
+
+/* sum_to_master for arrays whose size may not fit in an int */
+template<class T> static void sum_to_master_blocks(const T *in, T *out,
+                                                   size_t size) {
+    const size_t block = size_t(1) << 30;
+    for (size_t k = 0; k < size; k += block)
+        sum_to_master(in + k, out ? out + k : NULL,
+                      int(size - k < block ? size - k : block));
+}
+
+/* add_farfields for the nx points x, in blocks of points divided among
+   the threads */
+static void add_farfields_blocked(const farfield_data &d, const double *x,
+                                  int nx, double *EH) {
+    const int block = 16;
+    const int nblocks = (nx + block - 1) / block;
+    const size_t nEH = size_t(6*2) * d.Nfreq;
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1)
+#endif
+    for (int ib = 0; ib < nblocks; ++ib) {
+        const int q0 = ib * block;
+        add_farfields(d, x + q0*3, std::min(block, nx - q0), EH + q0 * nEH);
+    }
+}
+
+/* In save_farfields, the currents are passed between the processes in
+   blocks of at most NEAR2FAR_BLOCK doubles (or one surface point): the
+   number of pieces, then for each piece its component c0, its number of
+   points n, and its n x 3 positions and n x 2 x Nfreq currents. */
+#define NEAR2FAR_BLOCK (size_t(1) << 20)
+
+/* pack the next (at most B) surface points of d, from point j of
+   d.src[p] on, into buf, advancing p and j past them */
+static void pack_sources(const farfield_data &d, int B, int &p, int &j,
+                         double *buf) {
+    const int N = d.Nfreq;
+    size_t k = 1;
+    int nseg = 0, npts = 0;
+    while (p < d.nsrc && npts < B) {
+        const near2far_sources &s = d.src[p];
+        const int n = std::min(s.n - j, B - npts);
+        if (n > 0) {
+            buf[k++] = s.c0;
+            buf[k++] = n;
+            memcpy(buf + k, s.x0 + size_t(j) * 3, size_t(n) * 3 * sizeof(double));
+            k += size_t(n) * 3;
+            memcpy(buf + k, s.f + size_t(j) * 2*N,
+                   size_t(n) * 2*N * sizeof(double));
+            k += size_t(n) * 2*N;
+            ++nseg;
+            npts += n;
+            j += n;
         }
+        if (j == s.n) { ++p; j = 0; }
+    }
+    buf[0] = nseg;
+}
+
+/* the pieces of a block buf from pack_sources, pointing into buf, in
+   src, returning their number */
+static int unpack_sources(double *buf, int N, near2far_sources *src) {
+    const int nseg = int(buf[0]);
+    size_t k = 1;
+    for (int i = 0; i < nseg; ++i) {
+        src[i].c0 = component(int(buf[k]));
+        src[i].n = int(buf[k + 1]);
+        k += 2;
+        src[i].x0 = buf + k;
+        k += size_t(src[i].n) * 3;
+        src[i].f = buf + k;
+        k += size_t(src[i].n) * 2*N;
+    }
+    return nseg;
+}
+
+void dft_near2far::farfield_lowlevel(std::complex<double> *EH, const vec &x)
+{
+    if (x.dim != D3 && x.dim != D2)
+        abort("only 2d or 3d far-field computation is supported");
+
+    farfield_data d;
+    get_farfield_data(*this, &d, x.dim, false);
+    double x3[3] = {0,0,0}, *EH1 = new double[6*2*Nfreq];
+    LOOP_OVER_DIRECTIONS(x.dim, dd) x3[dd] = x.in_direction(dd);
+    if (x.dim == D2) {
+        double smin[3], smax[3];
+        const double nsrc = source_bounds(d, smin, smax);
+        make_hankel_table(&d, x3, x3, 1, smin, smax, nsrc);
     }
+    for (int i = 0; i < 6*2*Nfreq; ++i) EH1[i] = 0;
+    add_farfields(d, x3, 1, EH1);
+    for (int i = 0; i < Nfreq; ++i)
+        for (int k = 0; k < 6; ++k)
+            EH[i*6 + k] = std::complex<double>(EH1[(k*2 + 0)*Nfreq + i],
+                                               EH1[(k*2 + 1)*Nfreq + i]);
+    delete[] EH1;
+    free_farfield_data(&d);
 }
 
 std::complex<double> *dft_near2far::farfield(const vec &x) {
@@ -300,39 +894,92 @@ void dft_near2far::save_farfields(const char *fname, const char *prefix,
         dirs[rank++] = d;
     }
 
-    if (N * Nfreq < 1) return; /* nothing to output */
+    if (N < 1 || Nfreq < 1) return; /* nothing to output */
+
+    if (where.dim != D3 && where.dim != D2)
+        abort("only 2d or 3d far-field computation is supported");
 
     /* 6 x 2 x N x Nfreq array of fields in row-major order */
-    realnum *EH = new realnum[6*2*N*Nfreq];
-    realnum *EH_ = new realnum[6*2*N*Nfreq]; // temp array for sum_to_master
-
-    /* fields for farfield_lowlevel for a single output point x */
-    std::complex<double> *EH1 = new std::complex<double>[6*Nfreq];
-
-    vec x(where.dim);
-    for (int i0 = 0; i0 < dims[0]; ++i0) {
-        x.set_direction(dirs[0], where.in_direction_min(dirs[0]) + i0*dx[0]);
-        for (int i1 = 0; i1 < dims[1]; ++i1) {
-            x.set_direction(dirs[1], 
-                            where.in_direction_min(dirs[1]) + i1*dx[1]);
-            for (int i2 = 0; i2 < dims[2]; ++i2) {
-                x.set_direction(dirs[2], 
-                                where.in_direction_min(dirs[2]) + i2*dx[2]);
-                farfield_lowlevel(EH1, x);
-                int idx = (i0 * dims[1] + i1) * dims[2] + i2;
-                for (int i = 0; i < Nfreq; ++i)
-                    for (int k = 0; k < 6; ++k) {
-                        EH_[((k * 2 + 0) * N + idx) * Nfreq + i] =
-                            real(EH1[i * 6 + k]);
-                        EH_[((k * 2 + 1) * N + idx) * Nfreq + i] =
-                            imag(EH1[i * 6 + k]);
-                    }
+    const size_t nEH = size_t(6*2) * N * Nfreq;
+    realnum *EH = am_master() ? new realnum[nEH] : NULL;
+    realnum *EH_ = new realnum[nEH]; // temp array for sum_to_master
+    for (size_t i = 0; i < nEH; ++i) EH_[i] = 0;
+
+    /* each process computes the fields at its share of the N points.
+       Its currents are passed around the processes in a ring, a block
+       at a time, and each process adds the far fields of every block
+       to its points, in blocks of points divided among the threads */
+    farfield_data d;
+    get_farfield_data(*this, &d, where.dim, false);
+    if (where.dim == D2) {
+        double lo[3] = {0,0,0}, hi[3] = {0,0,0};
+        LOOP_OVER_DIRECTIONS(where.dim, dd) {
+            lo[dd] = where.in_direction_min(dd);
+            hi[dd] = where.in_direction_max(dd);
+        }
+        double smin[3], smax[3];
+        const double nsrc = sum_to_all(source_bounds(d, smin, smax));
+        for (int dd = 0; dd < 3; ++dd) {
+            smin[dd] = -max_to_all(-smin[dd]);
+            smax[dd] = max_to_all(smax[dd]);
+        }
+        make_hankel_table(&d, lo, hi, N, smin, smax, nsrc);
+    }
+    const int np = count_processors(), me = my_rank();
+    const int idx_start = int((long long) N * me / np);
+    const int idx_end = int((long long) N * (me + 1) / np);
+    const int nmine = idx_end - idx_start;
+    double *x = new double[size_t(nmine) * 3];
+    for (int q = 0; q < nmine; ++q) {
+        const int idx = idx_start + q;
+        const int i[3] = { idx / (dims[1] * dims[2]),
+                           (idx / dims[2]) % dims[1], idx % dims[2] };
+        x[q*3] = x[q*3 + 1] = x[q*3 + 2] = 0;
+        for (int k = 0; k < rank; ++k)
+            x[q*3 + dirs[k]] = where.in_direction_min(dirs[k]) + i[k]*dx[k];
+    }
+    const size_t nEH1 = size_t(nmine) * 6*2*Nfreq;
+    double *EH1 = new double[nEH1];
+    for (size_t k = 0; k < nEH1; ++k) EH1[k] = 0;
+
+    if (np == 1)
+        add_farfields_blocked(d, x, nmine, EH1);
+    else {
+        const size_t pt = 3 + size_t(2) * Nfreq; // doubles per point
+        const int B = int(std::max(size_t(1), NEAR2FAR_BLOCK / pt));
+        double npts = 0;
+        for (int p = 0; p < d.nsrc; ++p) npts += d.src[p].n;
+        const int nrounds = max_to_all(int(ceil(npts / B)));
+        const int maxseg = std::min(B, max_to_all(d.nsrc));
+        const size_t bufsize = 1 + size_t(B) * (2 + pt);
+        if (bufsize > size_t(INT_MAX))
+            abort("too many frequencies for save_farfields");
+        double *buf = new double[bufsize];
+        farfield_data db = d; // the same constants, with the block currents
+        db.src = new near2far_sources[maxseg];
+        int p = 0, j = 0;
+        for (int round = 0; round < nrounds; ++round) {
+            pack_sources(d, B, p, j, buf);
+            for (int step = 0; step < np; ++step) {
+                if (step > 0) send_to_next(buf, int(bufsize));
+                db.nsrc = unpack_sources(buf, Nfreq, db.src);
+                add_farfields_blocked(db, x, nmine, EH1);
             }
         }
+        delete[] db.src;
+        delete[] buf;
     }
+    free_farfield_data(&d);
 
+    for (int q = 0; q < nmine; ++q)
+        for (int k = 0; k < 6*2; ++k)
+            for (int i = 0; i < Nfreq; ++i)
+                EH_[(size_t(k) * N + idx_start + q) * Nfreq + i] =
+                    EH1[(size_t(q) * 6*2 + k) * Nfreq + i];
     delete[] EH1;
-    sum_to_master(EH_, EH, 6*2*N*Nfreq);
+    delete[] x;
+
+    sum_to_master_blocks(EH_, EH, nEH);
     delete[] EH_;
 
     /* collapse trailing singleton dimensions */
@@ -356,13 +1003,259 @@ void dft_near2far::save_farfields(const char *fname, const char *prefix,
             for (int reim = 0; reim < 2; ++reim) {
                 snprintf(dataname, 128, "%s.%c", 
                          component_name(c[k]), "ri"[reim]);
-                ff.write(dataname, rank, dims, EH + (k*2 + reim)*N*Nfreq);
+                ff.write(dataname, rank, dims,
+                         EH + (k*2 + reim) * size_t(N) * Nfreq);
             }
     }
 
     delete[] EH;
 }
 
+/* The radiation pattern.  In the limit r -> infinity in a direction
+   rhat, the distance from a surface point x0 is R - rhat.x0, and the
+   basis spectra (U,V,W) of green3d become amp * (1, -1, 1), while those
+   (V,W,X) of green2d become omega a f0 * (2, 1, 1), with a =
+   sqrt(2/(pi k)) exp(-i pi/4) (U, and its coefficient, decay faster),
+   times the outgoing wave exp(ikR)/R or exp(ikR)/sqrt(R).  So the
+   pattern is fixed coefficients (depending only on rhat) times the
+   "radiation vectors" A[c0] = sum of f0 exp(-ik rhat.x0) over the
+   currents of each source component c0, which cost only a phase factor
+   per surface point and frequency. */
+
+/* index (Ex,Ey,Ez,Hx,Hy,Hz) of the component c */
+static int EH_index(component c) {
+    return (is_electric(c) ? 0 : 3) + int(component_direction(c));
+}
+
+/* the dimension of the grid_volume of n2f, the same on all processes */
+static ndim near2far_dim(const dft_near2far &n2f) {
+    const int dim = max_to_all(n2f.F ? int(n2f.F->fc->gv.dim) : -1);
+    if (dim != D3 && dim != D2)
+        abort("only 2d or 3d radiation patterns are supported");
+    return ndim(dim);
+}
+
+/* ph = exp(-i k dist) for the N equally spaced k, re/im split */
+static void phase_spectrum(const farfield_data &d, double dist, double *ph) {
+    const int N = d.Nfreq;
+    std::complex<double> e = polar(1.0, -d.k0 * dist);
+    const std::complex<double> de = polar(1.0, -d.dk * dist);
+    for (int i = 0; i < N; ++i) {
+        ph[i] = real(e);
+        ph[N + i] = imag(e);
+        e *= de;
+    }
+}
+
+/* o += f * ph for N complex numbers (re/im split); separate restrict
+   arguments so that the compiler can vectorize it */
+static void add_product(int N, const double * restrict fr,
+                        const double * restrict fi,
+                        const double * restrict pr,
+                        const double * restrict pi_,
+                        double * restrict or_, double * restrict oi) {
+    for (int i = 0; i < N; ++i) {
+        or_[i] += fr[i] * pr[i] - fi[i] * pi_[i];
+        oi[i] += fr[i] * pi_[i] + fi[i] * pr[i];
+    }
+}
+
+struct xy_less { // orders surface points by (x,y)
+    const double *x0;
+    bool operator()(int a, int b) const {
+        return x0[a*3] < x0[b*3]
+            || (x0[a*3] == x0[b*3] && x0[a*3 + 1] < x0[b*3 + 1]);
+    }
+};
+
+/* add to A (Ntheta x Nphi x 6 x 2 x Nfreq) the radiation vectors of the
+   currents in d in the directions (theta[it], phi[ip]).  The surface
+   points with the same (x,y) are first summed, for each theta, with the
+   phases exp(-ik cos(theta) z), which do not depend on phi, so that
+   this is much faster than summing over every point for every
+   direction, except for the surfaces normal to z. */
+static void add_radiation_vectors(const farfield_data &d,
+                                  const double *theta, int Ntheta,
+                                  const double *phi, int Nphi, double *A) {
+    const int N = d.Nfreq;
+    for (int p = 0; p < d.nsrc; ++p) {
+        const near2far_sources &s = d.src[p];
+        if (!s.n) continue;
+        const int m = EH_index(s.c0);
+
+        // the "columns" of points with the same (x,y)
+        int *order = new int[s.n], *col = new int[s.n + 1], ncol = 0;
+        for (int j = 0; j < s.n; ++j) order[j] = j;
+        xy_less less = { s.x0 };
+        std::sort(order, order + s.n, less);
+        for (int j = 0; j < s.n; ++j)
+            if (j == 0 || less(order[j-1], order[j])) col[ncol++] = j;
+        col[ncol] = s.n;
+
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1)
+#endif
+        for (int it = 0; it < Ntheta; ++it) {
+            const double ct = cos(theta[it]), st = sin(theta[it]);
+            double *T = new double[ncol * 2*N], *ph = new double[2*N];
+            for (int i = 0; i < ncol * 2*N; ++i) T[i] = 0;
+            for (int ic = 0; ic < ncol; ++ic) {
+                double *t = T + ic * 2*N;
+                for (int jj = col[ic]; jj < col[ic+1]; ++jj) {
+                    const int j = order[jj];
+                    const double *f = s.f + size_t(j) * 2*N;
+                    phase_spectrum(d, ct * s.x0[j*3 + 2], ph);
+                    add_product(N, f, f + N, ph, ph + N, t, t + N);
+                }
+            }
+            for (int ip = 0; ip < Nphi; ++ip) {
+                const double ux = st * cos(phi[ip]), uy = st * sin(phi[ip]);
+                double *a = A + ((it * Nphi + ip) * 6 + m) * 2*N;
+                for (int ic = 0; ic < ncol; ++ic) {
+                    const int j = order[col[ic]];
+                    const double *t = T + ic * 2*N;
+                    phase_spectrum(d, ux * s.x0[j*3] + uy * s.x0[j*3 + 1], ph);
+                    add_product(N, t, t + N, ph, ph + N, a, a + N);
+                }
+            }
+            delete[] ph;
+            delete[] T;
+        }
+        delete[] col;
+        delete[] order;
+    }
+}
+
+/* add to EH (Nfreq x 6, as for farfield) the radiation pattern in the
+   direction rhat, given the radiation vectors A (6 x 2 x Nfreq) */
+static void add_radiation_fields(const farfield_data &d, const double *rhat,
+                                 const double *A, std::complex<double> *EH) {
+    const int N = d.Nfreq;
+    const component cs[6] = {Ex,Ey,Ez,Hx,Hy,Hz};
+    double coef[6][4], w[6];
+    for (int jc = 0; jc < 6; ++jc) {
+        const component c0 = cs[jc];
+        if (d.dim == D3) {
+            green3d_coefs(d, c0, rhat, coef);
+            for (int m = 0; m < 6; ++m)
+                w[m] = coef[m][0] - coef[m][1] + coef[m][2];
+        }
+        else {
+            green2d_coefs(d, c0, rhat, 1.0, coef);
+            for (int m = 0; m < 6; ++m)
+                w[m] = 2 * coef[m][1] + coef[m][2] + coef[m][3];
+        }
+        const double *a = A + EH_index(c0) * 2*N;
+        for (int i = 0; i < N; ++i) {
+            const std::complex<double> scale = d.dim == D3 ?
+                std::complex<double>(0, d.n * d.k[i] / (4*pi)
+                                     / (is_electric(c0) ? d.eps : d.mu)) :
+                d.omega[i] * sqrt(2 / (pi * d.k[i])) * polar(1.0, -0.25*pi);
+            const std::complex<double> v = scale
+                * std::complex<double>(a[i], a[N + i]);
+            for (int m = 0; m < 6; ++m)
+                if (w[m] != 0) EH[i*6 + m] += w[m] * v;
+        }
+    }
+}
+
+std::complex<double> *dft_near2far::radiation(double theta, double phi) {
+    const ndim dim = near2far_dim(*this);
+    if (dim == D2) theta = 0.5*pi;
+    farfield_data d;
+    get_farfield_data(*this, &d, dim, true);
+    double *A_ = new double[6*2*Nfreq], *A = new double[6*2*Nfreq];
+    for (int i = 0; i < 6*2*Nfreq; ++i) A_[i] = 0;
+    add_radiation_vectors(d, &theta, 1, &phi, 1, A_);
+    sum_to_all(A_, A, 6*2*Nfreq);
+
+    const double rhat[3] = {sin(theta) * cos(phi), sin(theta) * sin(phi),
+                            cos(theta)};
+    std::complex<double> *EH = new std::complex<double>[6*Nfreq];
+    for (int i = 0; i < 6*Nfreq; ++i) EH[i] = 0;
+    add_radiation_fields(d, rhat, A, EH);
+    free_farfield_data(&d);
+    delete[] A;
+    delete[] A_;
+    return EH;
+}
+
+void dft_near2far::save_radiation(const char *fname, const char *prefix,
+                                  double theta_min, double theta_max,
+                                  int Ntheta, double phi_min, double phi_max,
+                                  int Nphi) {
+    const ndim dim = near2far_dim(*this);
+    if (dim == D2) { theta_min = theta_max = 0.5*pi; Ntheta = 1; }
+    const int N = Ntheta * Nphi;
+    if (N < 1 || Nfreq < 1) return; /* nothing to output */
+
+    double *theta = new double[Ntheta], *phi = new double[Nphi];
+    for (int i = 0; i < Ntheta; ++i)
+        theta[i] = Ntheta > 1 ?
+            theta_min + i * (theta_max - theta_min) / (Ntheta - 1) : theta_min;
+    for (int i = 0; i < Nphi; ++i)
+        phi[i] = Nphi > 1 ? phi_min + i * (phi_max - phi_min) / (Nphi - 1)
+            : phi_min;
+
+    /* each process sums over its own currents for all the directions */
+    farfield_data d;
+    get_farfield_data(*this, &d, dim, true);
+    const size_t nA = size_t(N) * 6*2*Nfreq;
+    double *A_ = new double[nA], *A = am_master() ? new double[nA] : NULL;
+    for (size_t i = 0; i < nA; ++i) A_[i] = 0;
+    add_radiation_vectors(d, theta, Ntheta, phi, Nphi, A_);
+    sum_to_master_blocks(A_, A, nA);
+    delete[] A_;
+
+    if (am_master()) {
+        /* 6 x 2 x N x Nfreq array of fields in row-major order */
+        realnum *EH = new realnum[nA];
+        std::complex<double> *EH1 = new std::complex<double>[6*Nfreq];
+        for (int idx = 0; idx < N; ++idx) {
+            const double t = theta[idx / Nphi], p = phi[idx % Nphi];
+            const double rhat[3] = {sin(t) * cos(p), sin(t) * sin(p), cos(t)};
+            for (int i = 0; i < 6*Nfreq; ++i) EH1[i] = 0;
+            add_radiation_fields(d, rhat, A + size_t(idx) * 6*2*Nfreq, EH1);
+            for (int k = 0; k < 6; ++k)
+                for (int i = 0; i < Nfreq; ++i) {
+                    EH[(size_t(k*2) * N + idx) * Nfreq + i] = real(EH1[i*6 + k]);
+                    EH[(size_t(k*2 + 1) * N + idx) * Nfreq + i] =
+                        imag(EH1[i*6 + k]);
+                }
+        }
+        delete[] EH1;
+
+        /* dimensions theta, phi and frequency, omitting singletons */
+        int dims[3], rank = 0;
+        if (Ntheta > 1) dims[rank++] = Ntheta;
+        if (Nphi > 1) dims[rank++] = Nphi;
+        if (Nfreq > 1) dims[rank++] = Nfreq;
+
+        /* output to a file with one dataset per component & real/imag part */
+        const int buflen = 1024;
+        static char filename[buflen];
+        snprintf(filename, buflen, "%s%s%s.h5",
+                 prefix ? prefix : "", prefix && prefix[0] ? "-" : "",
+                 fname);
+        h5file ff(filename, h5file::WRITE, false);
+        component c[6] = {Ex,Ey,Ez,Hx,Hy,Hz};
+        char dataname[128];
+        for (int k = 0; k < 6; ++k)
+            for (int reim = 0; reim < 2; ++reim) {
+                snprintf(dataname, 128, "%s.%c",
+                         component_name(c[k]), "ri"[reim]);
+                ff.write(dataname, rank, dims,
+                         EH + (k*2 + reim) * size_t(N) * Nfreq);
+            }
+        delete[] EH;
+    }
+
+    free_farfield_data(&d);
+    delete[] A;
+    delete[] phi;
+    delete[] theta;
+}
+
 static double approxeq(double a, double b) { return fabs(a - b) < 0.5e-11 * (fabs(a) + fabs(b)); }
 
 dft_near2far fields::add_dft_near2far(const volume_list *where,
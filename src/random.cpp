@@ -56,28 +56,53 @@ void set_random_seed(unsigned long seed) {
 #endif
 }
 
+/* The generator state is shared, so with OpenMP (where e.g. noisy
+   susceptibilities in different chunks are updated concurrently)
+   each draw is serialized by a critical section. */
+
 int random_int(int a, int b) {
-  init_rand();
+  int r;
+#ifdef _OPENMP
+#  pragma omp critical(meep_rng)
+#endif
+  {
+    init_rand();
 #ifdef HAVE_LIBGSL
-  return ((int) gsl_rng_uniform_int(rng, b-a+1)) + a;
+    r = ((int) gsl_rng_uniform_int(rng, b-a+1)) + a;
 #else
-  return a + rand() % (b-a+1);
+    r = a + rand() % (b-a+1);
 #endif
+  }
+  return r;
 }
 
 double uniform_random(double a, double b) {
-  init_rand();
+  double r;
+#ifdef _OPENMP
+#  pragma omp critical(meep_rng)
+#endif
+  {
+    init_rand();
 #ifdef HAVE_LIBGSL
-  return a + gsl_rng_uniform(rng) * (b-a);
+    r = a + gsl_rng_uniform(rng) * (b-a);
 #else
-  return a + rand() * (b-a) / RAND_MAX;
+    r = a + rand() * (b-a) / RAND_MAX;
 #endif
+  }
+  return r;
 }
 
 double gaussian_random(double mean, double stddev) {
-  init_rand();
 #ifdef HAVE_LIBGSL
-  return mean + gsl_ran_gaussian(rng, stddev);
+  double r;
+#  ifdef _OPENMP
+#    pragma omp critical(meep_rng)
+#  endif
+  {
+    init_rand();
+    r = mean + gsl_ran_gaussian(rng, stddev);
+  }
+  return r;
 #else
   // Box-Muller algorithm to generate Gaussian from uniform
   // see Knuth vol II algorithm P, sec. 3.4.1
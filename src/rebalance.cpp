@@ -0,0 +1,383 @@
+/* Copyright (C) 2005-2015 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* Dynamic load balancing.  fields::rebalance compares the wall time
+   that each process spent updating its chunks since the last call
+   (fields_chunk::work_time, measured in step_db, update_eh,
+   update_pols and update_dfts), and if the busiest process took more
+   than threshold times the mean, it moves whole chunks from the
+   busiest processes to the least busy ones.  The chunk division
+   itself is not changed, so this only helps if there are more chunks
+   than processes (see the num_chunks argument of structure).
+
+   A chunk is moved by sending its per-process data (the material
+   arrays, the fields and PML auxiliary fields, the polarization
+   state, the sources, and the DFTs) to its new owner and changing its
+   n_proc() on every process.  The structure, fields and dft_chunk
+   objects themselves exist on every process and stay where they
+   are; the chunks are simply reconnected before the next step. */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "meep.hpp"
+#include "meep_internals.hpp"
+
+using namespace std;
+
+namespace meep {
+
+// the material index arrays (see material_index.cpp), sent as bytes
+static void send(int from, int to, unsigned char *data, int size) {
+  send(from, to, (char *) data, size);
+}
+static void send(int from, int to, unsigned short *data, int size) {
+  send(from, to, (char *) data, size * int(sizeof(unsigned short)));
+}
+
+/* send for arrays whose size may not fit in an int */
+static void send_blocks(int from, int to, double *data, size_t size) {
+  const size_t block = size_t(1) << 30;
+  for (size_t k = 0; k < size; k += block)
+    send(from, to, data + k, int(size - k < block ? size - k : block));
+}
+
+/* Move the n-element array a from process from to process to: if a
+   is non-NULL on from, it is allocated on to and deleted on from.
+   Every process may call this, but only from and to do anything. */
+template<class T> static void move_array(T *&a, int n, int from, int to) {
+  const int me = my_rank();
+  if (me != from && me != to) return;
+  int have = me == from && a;
+  send(from, to, &have, 1);
+  if (!have) return;
+  if (me == to) a = new T[n];
+  send(from, to, a, n);
+  if (me == from) {
+    delete[] a;
+    a = NULL;
+  }
+}
+
+static void move_flags(bool *b, int n, int from, int to) {
+  int *flags = new int[n];
+  for (int i = 0; i < n; ++i) flags[i] = b[i];
+  send(from, to, flags, n);
+  if (my_rank() == to)
+    for (int i = 0; i < n; ++i) b[i] = flags[i];
+  delete[] flags;
+}
+
+void structure_chunk::move_to(int proc) {
+  const int from = n_proc(), n = gv.ntot();
+  if (proc == from) return;
+
+  FOR_COMPONENTS(c) {
+    move_array(chi3[c], n, from, proc);
+    move_array(chi2[c], n, from, proc);
+    send(from, proc, &chi1inv_rows[c], 1);
+    move_array(chi1inv_index8[c], n, from, proc);
+    move_array(chi1inv_index16[c], n, from, proc);
+    const int nrows = chi1inv_rows[c] ? chi1inv_rows[c] : n;
+    if (my_rank() == from) chi1inv_rows[c] = 0;
+    FOR_DIRECTIONS(d) {
+      move_array(chi1inv[c][d], nrows, from, proc);
+      move_array(conductivity[c][d], n, from, proc);
+      move_array(condinv[c][d], n, from, proc);
+    }
+  }
+  move_flags(&trivial_chi1inv[0][0], NUM_FIELD_COMPONENTS * 5, from, proc);
+  move_flags(&condinv_stale, 1, from, proc);
+
+  FOR_DIRECTIONS(d) {
+    send(from, proc, &sigsize[d], 1);
+    move_array(sig[d], sigsize[d], from, proc);
+    move_array(kap[d], sigsize[d], from, proc);
+    move_array(siginv[d], sigsize[d], from, proc);
+    if (my_rank() == from) sigsize[d] = 0;
+  }
+
+  FOR_FIELD_TYPES(ft)
+    for (susceptibility *sus = chiP[ft]; sus; sus = sus->next) {
+      FOR_COMPONENTS(c) FOR_DIRECTIONS(d)
+	move_array(sus->sigma[c][d], n, from, proc);
+      move_flags(&sus->trivial_sigma[0][0], NUM_FIELD_COMPONENTS * 5,
+		 from, proc);
+    }
+
+  the_proc = proc;
+  the_is_mine = my_rank() == proc;
+}
+
+/* Whether the chunk can be moved by move_to (on its owner, at least;
+   see also fields::movable_chunks). */
+bool fields_chunk::can_move() const {
+  if (bands || s->refcount > 2) // structure shared with other fields
+    return false;
+  if (is_mine())
+    FOR_FIELD_TYPES(ft)
+      for (polarization_state *p = pol[ft]; p; p = p->next)
+	if (p->data && !p->s->size_internal_data(p->data)) return false;
+  return true;
+}
+
+void fields_chunk::move_to(int proc, src_time *all_sources) {
+  const int from = n_proc(), me = my_rank(), n = gv.ntot();
+  if (proc == from) return;
+
+  // H == B (see alloc_f) is restored after B has been moved
+  int alias[NUM_FIELD_COMPONENTS][2];
+  FOR_COMPONENTS(c) DOCMP2 {
+    const component bc = is_magnetic(c) ?
+      direction_component(Bx, component_direction(c)) : c;
+    alias[c][cmp] = me == from && bc != c && f[c][cmp]
+      && f[c][cmp] == f[bc][cmp];
+    if (alias[c][cmp]) f[c][cmp] = NULL;
+  }
+  send(from, proc, &alias[0][0], NUM_FIELD_COMPONENTS * 2);
+  FOR_COMPONENTS(c) DOCMP2 {
+    move_array(f[c][cmp], n, from, proc);
+    move_array(f_u[c][cmp], n, from, proc);
+    move_array(f_w[c][cmp], n, from, proc);
+    move_array(f_cond[c][cmp], n, from, proc);
+    move_array(f_minus_p[c][cmp], n, from, proc);
+    move_array(f_w_prev[c][cmp], n, from, proc);
+  }
+  if (me == proc)
+    FOR_COMPONENTS(c) DOCMP2 if (alias[c][cmp])
+      f[c][cmp] = f[direction_component(Bx, component_direction(c))][cmp];
+
+  if (me == from) { // caches that the new owner recomputes
+    delete[] f_rderiv_int;
+    f_rderiv_int = NULL;
+    FOR_FIELD_TYPES(ft) {
+      delete[] zeroes[ft];
+      zeroes[ft] = NULL;
+      num_zeroes[ft] = 0;
+    }
+    if (new_s) { // left over from a finished phase_in_material
+      if (new_s->refcount-- <= 1) delete new_s;
+      new_s = NULL;
+    }
+  }
+
+  // the internal data are sent as a block, as for copy_internal_data
+  FOR_FIELD_TYPES(ft)
+    for (polarization_state *p = pol[ft]; p; p = p->next) {
+      int sz = me == from && p->data ?
+	int(p->s->size_internal_data(p->data)) : 0;
+      send(from, proc, &sz, 1);
+      if (!sz) continue;
+      if (me == from) {
+	send(from, proc, (char *) p->data, sz);
+	p->s->delete_internal_data(p->data);
+	p->data = NULL;
+      }
+      else {
+	char *buf = (char *) malloc(sz);
+	send(from, proc, buf, sz);
+	p->data = p->s->copy_internal_data(buf);
+	free(buf);
+      }
+    }
+
+  /* the src_time of a src_vol is identified by its position in the
+     fields' list of sources, which is the same on every process */
+  FOR_FIELD_TYPES(ft) {
+    int nsrc = 0;
+    if (me == from)
+      for (src_vol *sv = sources[ft]; sv; sv = sv->next) ++nsrc;
+    send(from, proc, &nsrc, 1);
+    src_vol *sv = me == from ? sources[ft] : NULL, *last = NULL;
+    for (int j = 0; j < nsrc; ++j) {
+      int hdr[3] = {0, 0, 0}; // component, source number, npts
+      if (me == from) {
+	hdr[0] = sv->c;
+	for (src_time *t = all_sources; t && t != sv->t; t = t->next)
+	  ++hdr[1];
+	hdr[2] = sv->npts;
+      }
+      send(from, proc, hdr, 3);
+      int *index = me == from ? sv->index : new int[hdr[2]];
+      complex<double> *A = me == from ? sv->A : new complex<double>[hdr[2]];
+      send(from, proc, index, hdr[2]);
+      send(from, proc, (double *) A, 2 * hdr[2]);
+      if (me == from)
+	sv = sv->next;
+      else {
+	src_time *t = all_sources;
+	for (int k = 0; k < hdr[1] && t; ++k) t = t->next;
+	if (!t) abort("bug: unknown source time in fields_chunk::move_to");
+	src_vol *tmp = new src_vol(component(hdr[0]), t, hdr[2], index, A);
+	if (last) last->next = tmp; else sources[ft] = tmp;
+	last = tmp;
+      }
+    }
+    if (me == from) {
+      delete sources[ft];
+      sources[ft] = NULL;
+    }
+  }
+
+  // every process has the same dft_chunks list (placeholders if not ours)
+  for (dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_chunk) {
+    const size_t ndft = size_t(cur->N) * cur->Nomega * 2;
+    if (me == proc) cur->alloc_dft();
+    if (me == from) cur->flush_dft();
+    send_blocks(from, proc, cur->dft, ndft);
+    if (cur->decimation > 1) { // the partially summed k steps
+      double st[3] = {double(cur->nstep), cur->t_first, cur->favg ? 1.0 : 0.0};
+      send(from, proc, st, 3);
+      if (me == proc) {
+	cur->nstep = int(st[0]);
+	cur->t_first = st[1];
+	if (st[2] != 0 && !cur->favg) cur->favg = new double[cur->N * 2];
+      }
+      if (st[2] != 0) send(from, proc, cur->favg, cur->N * 2);
+    }
+    if (me == from) {
+      cur->free_dft();
+      delete[] cur->fbuf;
+      cur->fbuf = NULL;
+      delete[] cur->favg;
+      cur->favg = NULL;
+    }
+  }
+
+  s->move_to(proc);
+  if (me == proc) figure_out_step_plan();
+  work_time = 0;
+}
+
+void fields::use_rebalancing(double threshold, int interval) {
+  if (threshold < 1 || interval < 0)
+    abort("invalid use_rebalancing threshold %g or interval %d",
+	  threshold, interval);
+  rebalance_threshold = threshold;
+  rebalance_interval = interval;
+}
+
+/* Set movable[i] to whether chunk i can be moved on every process.
+   The DFT chunks of a chunk must have placeholders on every process,
+   i.e. they must have been added after use_rebalancing. */
+void fields::movable_chunks(int *movable) {
+  double *ndft = new double[num_chunks], *ndft_sum = new double[num_chunks];
+  for (int i = 0; i < num_chunks; ++i) {
+    ndft[i] = 0;
+    for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+      ndft[i] += 1;
+  }
+  sum_to_all(ndft, ndft_sum, num_chunks);
+  int *ok = new int[num_chunks];
+  for (int i = 0; i < num_chunks; ++i)
+    ok[i] = chunks[i]->can_move() && ndft_sum[i] == count_processors()*ndft[i];
+  and_to_all(ok, movable, num_chunks);
+  delete[] ok;
+  delete[] ndft_sum;
+  delete[] ndft;
+}
+
+void fields::move_chunks(const int *chunk_procs) {
+  if (synchronized_magnetic_fields || is_phasing() || bands)
+    abort("can't move chunks with synchronized fields, while phasing in "
+	  "materials, or while recording bands");
+  for (int i = 0; i < num_chunks; ++i)
+    if (chunk_procs[i] < 0 || chunk_procs[i] >= count_processors())
+      abort("invalid process %d for chunk %d", chunk_procs[i], i);
+  am_now_working_on(Connecting);
+  int *movable = new int[num_chunks];
+  movable_chunks(movable);
+  bool disconnected = false;
+  for (int i = 0; i < num_chunks; ++i)
+    if (movable[i] && chunk_procs[i] != chunks[i]->n_proc()) {
+      if (!disconnected) { // the connections point into the fields
+	disconnect_chunks();
+	disconnected = true;
+      }
+      chunks[i]->move_to(chunk_procs[i], sources);
+    }
+  delete[] movable;
+  finished_working();
+}
+
+/* Greedily move chunks from the busiest process to the least busy one
+   as long as this reduces the difference between them, each time
+   choosing the chunk whose cost is closest to half the difference,
+   unless the imbalance is within threshold already. */
+static void balance_chunks(int n, const double *cost, const int *movable,
+			   int *procs, int nprocs, double threshold) {
+  double *load = new double[nprocs];
+  for (int p = 0; p < nprocs; ++p) load[p] = 0;
+  double total = 0;
+  for (int i = 0; i < n; ++i) {
+    load[procs[i]] += cost[i];
+    total += cost[i];
+  }
+  double maxload = 0;
+  for (int p = 0; p < nprocs; ++p) maxload = max(maxload, load[p]);
+  const bool unbalanced = maxload > threshold * total / nprocs;
+  for (int iter = 0; unbalanced && iter < n; ++iter) {
+    int pmax = 0, pmin = 0;
+    for (int p = 1; p < nprocs; ++p) {
+      if (load[p] > load[pmax]) pmax = p;
+      if (load[p] < load[pmin]) pmin = p;
+    }
+    const double gap = load[pmax] - load[pmin];
+    int best = -1;
+    for (int i = 0; i < n; ++i)
+      if (procs[i] == pmax && movable[i] && cost[i] > 0 && cost[i] < gap
+	  && (best < 0 || fabs(cost[i] - 0.5*gap) < fabs(cost[best] - 0.5*gap)))
+	best = i;
+    if (best < 0) break;
+    procs[best] = pmin;
+    load[pmax] -= cost[best];
+    load[pmin] += cost[best];
+  }
+  delete[] load;
+}
+
+bool fields::rebalance(double threshold) {
+  if (synchronized_magnetic_fields || is_phasing() || bands) return false;
+  double *cost_mine = new double[num_chunks], *cost = new double[num_chunks];
+  for (int i = 0; i < num_chunks; ++i) {
+    cost_mine[i] = chunks[i]->is_mine() ? chunks[i]->work_time : 0;
+    chunks[i]->work_time = 0;
+  }
+  sum_to_all(cost_mine, cost, num_chunks);
+  int *movable = new int[num_chunks], *procs = new int[num_chunks];
+  movable_chunks(movable);
+  for (int i = 0; i < num_chunks; ++i) procs[i] = chunks[i]->n_proc();
+  balance_chunks(num_chunks, cost, movable, procs, count_processors(),
+		 threshold);
+  broadcast(0, procs, num_chunks); // in case of roundoff differences
+  int nmoved = 0;
+  for (int i = 0; i < num_chunks; ++i)
+    if (procs[i] != chunks[i]->n_proc()) ++nmoved;
+  if (nmoved) {
+    if (!quiet)
+      master_printf("rebalancing: moving %d of %d chunks\n",
+		    nmoved, num_chunks);
+    move_chunks(procs);
+  }
+  delete[] procs;
+  delete[] movable;
+  delete[] cost;
+  delete[] cost_mine;
+  return nmoved > 0;
+}
+
+} // namespace meep
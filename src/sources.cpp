@@ -368,9 +368,9 @@ static void src_vol_chunkloop(fields_chunk *fc, int ichunk, component c,
        right because it doesn't handle non-diagonal chi1inv! 
        similarly, for "B" sources, multiply by mu. */
     if (is_D(c) && fc->s->chi1inv[c-Dx+Ex][cd]) 
-      amps_array[idx_vol] /= fc->s->chi1inv[c-Dx+Ex][cd][idx];
+      amps_array[idx_vol] /= fc->s->chi1inv_at(component(c-Dx+Ex), cd, idx);
     if (is_B(c) && fc->s->chi1inv[c-Bx+Hx][cd]) 
-      amps_array[idx_vol] /= fc->s->chi1inv[c-Bx+Hx][cd][idx];
+      amps_array[idx_vol] /= fc->s->chi1inv_at(component(c-Bx+Hx), cd, idx);
 
     index_array[idx_vol++] = idx;
   }
@@ -412,6 +412,7 @@ void fields::add_volume_source(component c, const src_time &src,
   data.center = (where.get_min_corner() + where.get_max_corner()) * 0.5;
   loop_in_chunks(src_vol_chunkloop, (void *) &data, where, c, false);
   require_component(c);
+  may_allocate_fields = true; // e.g. for D - P with integrated sources
 }
 
 } // namespace meep
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
@@ -60,9 +61,7 @@ void fields::step() {
   for (int i=0;i<num_chunks;i++) chunks[i]->s->update_condinv();
 
   calc_sources(time()); // for B sources
-  step_db(B_stuff);
-  step_source(B_stuff);
-  step_boundaries(B_stuff);
+  step_db_overlapped(B_stuff); // = step_db, step_source, step_boundaries
   calc_sources(time() + 0.5*dt); // for integrated H sources
   update_eh(H_stuff);
   step_boundaries(WH_stuff);
@@ -73,9 +72,7 @@ void fields::step() {
   if (fluxes) fluxes->update_half();
 
   calc_sources(time() + 0.5*dt); // for D sources
-  step_db(D_stuff);
-  step_source(D_stuff);
-  step_boundaries(D_stuff);
+  step_db_overlapped(D_stuff); // = step_db, step_source, step_boundaries
   calc_sources(time() + dt); // for integrated E sources
   update_eh(E_stuff);
   step_boundaries(WE_stuff);
@@ -88,6 +85,9 @@ void fields::step() {
   update_dfts();
   finished_working();
 
+  if (rebalance_interval > 0 && t % rebalance_interval == 0)
+    rebalance(rebalance_threshold);
+
   // re-synch magnetic fields if they were previously synchronized
   if (save_synchronized_magnetic_fields) {
     synchronize_magnetic_fields();
@@ -111,16 +111,16 @@ double fields_chunk::peek_field(component c, const vec &where) {
 }
 
 void fields::phase_material() {
+  if (!is_phasing()) return; // the same on every process
   bool changed = false;
-  if (is_phasing()) {
-    for (int i=0;i<num_chunks;i++)
-      if (chunks[i]->is_mine()) {
-	chunks[i]->phase_material(phasein_time);
-	changed = changed || chunks[i]->new_s;
-      }
-    phasein_time--;
-  }
+  for (int i=0;i<num_chunks;i++)
+    if (chunks[i]->is_mine()) {
+      chunks[i]->phase_material(phasein_time);
+      changed = changed || chunks[i]->new_s;
+    }
+  phasein_time--;
   if (or_to_all(changed)) {
+    may_allocate_fields = true; // the new materials may need E != D etc.
     calc_sources(time() + 0.5*dt); // for integrated H sources
     update_eh(H_stuff); // ensure H = 1/mu * B
     step_boundaries(H_stuff);
@@ -139,7 +139,89 @@ void fields_chunk::phase_material(int phasein_time) {
 
 void fields::step_boundaries(field_type ft) {
   connect_chunks(); // re-connect if !chunk_connections_valid
+  start_step_boundaries(ft);
+  finish_step_boundaries(ft);
+}
+
+/* Gather the elements of the connection runs into block, returning
+   the position in block after them. */
+static realnum *pack_runs(realnum *block, const connection_run *runs,
+			  int nruns) {
+  for (int r = 0; r < nruns; ++r) {
+    const connection_run &run = runs[r];
+    const realnum *f0 = run.f[0] + run.offset;
+    if (run.f[1]) {
+      const realnum *f1 = run.f[1] + run.offset;
+      for (int k = 0; k < run.count; ++k) {
+	block[2*k] = f0[k*run.stride];
+	block[2*k+1] = f1[k*run.stride];
+      }
+      block += 2*run.count;
+    }
+    else {
+      if (run.stride == 1)
+	memcpy(block, f0, run.count * sizeof(realnum));
+      else
+	for (int k = 0; k < run.count; ++k) block[k] = f0[k*run.stride];
+      block += run.count;
+    }
+  }
+  return block;
+}
+
+/* Scatter block into the elements of the connection runs, negated if
+   negate, returning the position in block after them. */
+static const realnum *unpack_runs(const realnum *block,
+				  const connection_run *runs, int nruns,
+				  bool negate) {
+  const double sign = negate ? -1 : 1;
+  for (int r = 0; r < nruns; ++r) {
+    const connection_run &run = runs[r];
+    realnum *f0 = run.f[0] + run.offset;
+    if (run.f[1]) {
+      realnum *f1 = run.f[1] + run.offset;
+      for (int k = 0; k < run.count; ++k) {
+	f0[k*run.stride] = sign * block[2*k];
+	f1[k*run.stride] = sign * block[2*k+1];
+      }
+      block += 2*run.count;
+    }
+    else {
+      if (run.stride == 1 && !negate)
+	memcpy(f0, block, run.count * sizeof(realnum));
+      else
+	for (int k = 0; k < run.count; ++k) f0[k*run.stride] = sign * block[k];
+      block += run.count;
+    }
+  }
+  return block;
+}
+
+/* As unpack_runs, for the (real, imaginary) pairs of CONNECT_PHASE,
+   multiplying the n-th pair by phase[n]. */
+static const realnum *unpack_phase_runs(const realnum *block,
+					const connection_run *runs, int nruns,
+					const complex<realnum> *phase) {
+  for (int r = 0; r < nruns; ++r) {
+    const connection_run &run = runs[r];
+    realnum *f0 = run.f[0] + run.offset;
+    realnum *f1 = run.f[1] + run.offset;
+    for (int k = 0; k < run.count; ++k) {
+      const double phr = real(phase[k]);
+      const double phi = imag(phase[k]);
+      f0[k*run.stride] = phr*block[2*k] - phi*block[2*k+1];
+      f1[k*run.stride] = phr*block[2*k+1] + phi*block[2*k];
+    }
+    block += 2*run.count;
+    phase += run.count;
+  }
+  return block;
+}
 
+/* The first half of step_boundaries: zero the metals, copy the
+   outgoing data to comm_blocks and start sending it.  The connections
+   must be valid. */
+void fields::start_step_boundaries(field_type ft) {
   am_now_working_on(MpiTime);
 
   // Do the metals first!
@@ -153,61 +235,63 @@ void fields::step_boundaries(field_type ft) {
      of the connections for process i' for i < i'  */
 
   // First copy outgoing data to buffers...
-  for (int j=0;j<num_chunks;j++)
-    if (chunks[j]->is_mine()) {
-      int wh[3] = {0,0,0};
-      for (int i=0;i<num_chunks;i++) {
-	const int pair = j+i*num_chunks;
-	int n0 = 0;
-	for (int ip=0;ip<3;ip++) {
-	  for (int n=0;n<comm_sizes[ft][ip][pair];n++)
-	    comm_blocks[ft][pair][n0 + n] =
-	      *(chunks[j]->connections[ft][ip][Outgoing][wh[ip]++]);
-	  n0 += comm_sizes[ft][ip][pair];
-	}
-      }
-    }
+  const int nout = num_comm_pairs[ft][Outgoing];
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1)
+#endif
+  for (int k=0;k<nout;k++) {
+    const comm_pair &p = comm_pairs[ft][Outgoing][k];
+    realnum *block = comm_blocks[ft][p.pair];
+    for (int ip=0;ip<3;ip++)
+      block = pack_runs(block, chunks[p.chunk]->connection_runs[ft][ip][Outgoing]
+			+ p.run_start[ip], p.num_runs[ip]);
+  }
+
+  start_boundary_communications(ft);
+  finished_working();
+}
 
-  boundary_communications(ft);
+void fields::finish_step_boundaries(field_type ft) {
+  am_now_working_on(MpiTime);
+  finish_boundary_communications(ft);
   
   // Finally, copy incoming data to the fields themselves, multiplying phases:
-  for (int i=0;i<num_chunks;i++)
-    if (chunks[i]->is_mine()) {
-      int wh[3] = {0,0,0};
-      for (int j=0;j<num_chunks;j++) {
-        const int pair = j+i*num_chunks;
-	connect_phase ip = CONNECT_PHASE;
-        for (int n = 0; n < comm_sizes[ft][ip][pair]; n += 2, wh[ip] += 2) {
-          const double phr = real(chunks[i]->connection_phases[ft][wh[ip]/2]);
-          const double phi = imag(chunks[i]->connection_phases[ft][wh[ip]/2]);
-          *(chunks[i]->connections[ft][ip][Incoming][wh[ip]]) =
-            phr*comm_blocks[ft][pair][n] - phi*comm_blocks[ft][pair][n+1];
-          *(chunks[i]->connections[ft][ip][Incoming][wh[ip]+1]) =
-            phr*comm_blocks[ft][pair][n+1] + phi*comm_blocks[ft][pair][n];
-        }
-	int n0 = comm_sizes[ft][ip][pair];
-	ip = CONNECT_NEGATE;
-        for (int n = 0; n < comm_sizes[ft][ip][pair]; ++n)
-          *(chunks[i]->connections[ft][ip][Incoming][wh[ip]++])
-	    = -comm_blocks[ft][pair][n0 + n];
-	n0 += comm_sizes[ft][ip][pair];
-	ip = CONNECT_COPY;
-        for (int n = 0; n < comm_sizes[ft][ip][pair]; ++n)
-          *(chunks[i]->connections[ft][ip][Incoming][wh[ip]++])
-	    = comm_blocks[ft][pair][n0 + n];
-      }
-    }
+  const int nin = num_comm_pairs[ft][Incoming];
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1)
+#endif
+  for (int k=0;k<nin;k++) {
+    const comm_pair &p = comm_pairs[ft][Incoming][k];
+    const realnum *block = comm_blocks[ft][p.pair];
+    fields_chunk *fc = chunks[p.chunk];
+    connection_run * const (*runs)[Outgoing+1] = fc->connection_runs[ft];
+    block = unpack_phase_runs(block, runs[CONNECT_PHASE][Incoming]
+			      + p.run_start[CONNECT_PHASE],
+			      p.num_runs[CONNECT_PHASE],
+			      fc->connection_phases[ft]
+			      + p.start[CONNECT_PHASE]/2);
+    block = unpack_runs(block, runs[CONNECT_NEGATE][Incoming]
+			+ p.run_start[CONNECT_NEGATE],
+			p.num_runs[CONNECT_NEGATE], true);
+    unpack_runs(block, runs[CONNECT_COPY][Incoming]
+		+ p.run_start[CONNECT_COPY], p.num_runs[CONNECT_COPY], false);
+  }
 
   finished_working();
 }
 
-void fields::step_source(field_type ft, bool including_integrated) {
+void fields::step_source(field_type ft, bool including_integrated,
+			 halo_part part) {
   if (ft != D_stuff && ft != B_stuff) abort("only step_source(D/B) is okay");
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1)
+#endif
   for (int i=0;i<num_chunks;i++)
     if (chunks[i]->is_mine())
-      chunks[i]->step_source(ft, including_integrated);
+      chunks[i]->step_source(ft, including_integrated, part);
 }
-void fields_chunk::step_source(field_type ft, bool including_integrated) {
+void fields_chunk::step_source(field_type ft, bool including_integrated,
+			       halo_part part) {
   if (doing_solve_cw && !including_integrated) return;
   for (src_vol *sv = sources[ft]; sv; sv = sv->next) {
     component c = direction_component(first_field_component(ft), 
@@ -216,20 +300,25 @@ void fields_chunk::step_source(field_type ft, bool including_integrated) {
     if ((including_integrated || !sv->t->is_integrated)	&& f[c][0]
 	&& ((ft == D_stuff && is_electric(sv->c))
 	    || (ft == B_stuff && is_magnetic(sv->c)))) {
+#define SKIP_PART(i) if (part != ALL_POINTS && \
+      in_halo(c, gv.iloc(c, i)) != (part == HALO_POINTS)) continue
       if (cndinv)
 	for (int j=0; j<sv->npts; j++) {
 	  const int i = sv->index[j];
+	  SKIP_PART(i);
 	  const complex<double> A = sv->current(j) * dt * double(cndinv[i]);
 	  f[c][0][i] -= real(A);
 	  if (!is_real) f[c][1][i] -= imag(A);
 	}
       else
 	for (int j=0; j<sv->npts; j++) {
-	  const complex<double> A = sv->current(j) * dt;
 	  const int i = sv->index[j];
+	  SKIP_PART(i);
+	  const complex<double> A = sv->current(j) * dt;
 	  f[c][0][i] -= real(A);
 	  if (!is_real) f[c][1][i] -= imag(A);
 	}
+#undef SKIP_PART
     }
   }
 }
@@ -29,21 +29,164 @@ using namespace std;
 
 namespace meep {
 
-void fields::step_db(field_type ft) {
+void fields::step_db(field_type ft, halo_part part) {
+  bool allocated = false;
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1) reduction(||:allocated)
+#endif
   for (int i=0;i<num_chunks;i++)
-    if (chunks[i]->is_mine())
-      if (chunks[i]->step_db(ft))
-	chunk_connections_valid = false;
+    if (chunks[i]->is_mine()) {
+      const double start = wall_time();
+      if (chunks[i]->step_db(ft, part))
+	allocated = true;
+      chunks[i]->work_time += wall_time() - start;
+    }
+  sync_chunk_connections(allocated);
+}
 
-  /* synchronize to avoid deadlocks in connect_the_chunks */
-  chunk_connections_valid = and_to_all(chunk_connections_valid);
+void fields::use_tiling(int tile_size) {
+  for (int i=0;i<num_chunks;i++) chunks[i]->tile_size = tile_size;
 }
 
-bool fields_chunk::step_db(field_type ft) {
+void fields::use_comm_overlap(bool overlap) { overlap_comm = overlap; }
+
+/* The same as step_db(ft), step_source(ft), step_boundaries(ft), but
+   with use_comm_overlap the points that are sent to other chunks (the
+   halo, see fields_chunk::in_halo) are updated first, so that their
+   communication can proceed while the interior points are updated.
+   The results are identical either way. */
+void fields::step_db_overlapped(field_type ft) {
+  if (!overlap_comm || gv.dim == Dcyl || beta != 0) {
+    step_db(ft);
+    step_source(ft);
+    step_boundaries(ft);
+    return;
+  }
+
+  connect_chunks(); // computes the halos along with the connections
+  step_db(ft, HALO_POINTS);
+  step_source(ft, false, HALO_POINTS);
+  if (!chunk_connections_valid) { // PML allocation: must reconnect first
+    step_db(ft, INTERIOR_POINTS);
+    step_source(ft, false, INTERIOR_POINTS);
+    step_boundaries(ft);
+    return;
+  }
+
+  start_step_boundaries(ft);
+  const double start = wall_time();
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1)
+#endif
+  for (int i=0;i<num_chunks;i++)
+    if (chunks[i]->is_mine()) {
+      const double start_i = wall_time();
+      chunks[i]->step_db(ft, INTERIOR_POINTS);
+      chunks[i]->work_time += wall_time() - start_i;
+    }
+  step_source(ft, false, INTERIOR_POINTS);
+  // metals in the interior were overwritten by step_db
+  for (int i=0;i<num_chunks;i++)
+    if (chunks[i]->is_mine()) chunks[i]->zero_metal(ft);
+  comm_overlap_time += wall_time() - start;
+  finish_step_boundaries(ft);
+}
+
+// arguments of a step_curl call, saved so that the calls can be tiled
+typedef struct {
+  realnum *f, *fu, *fcnd;
+  const realnum *g1, *g2;
+  int s1, s2;
+  component c;
+  direction dsig, dsigu;
+  const realnum *cnd, *cndinv;
+} curl_args;
+
+static void step_curl_block(const curl_args &a, const ivec &is, const ivec &ie,
+			    const grid_volume &gv, double Courant, double dt,
+			    const structure_chunk *s) {
+  STEP_CURL(a.f, is, ie, a.g1, a.g2, a.s1, a.s2, gv, Courant, 
+	    a.dsig, s->sig[a.dsig], s->kap[a.dsig], s->siginv[a.dsig], 
+	    a.fu, a.dsigu, s->sig[a.dsigu], s->kap[a.dsigu], s->siginv[a.dsigu], 
+	    dt, a.cnd, a.cndinv, a.fcnd);
+}
+
+/* step_curl_block, but leaving out the points in the box lo..hi if
+   skip (see fields_chunk::skip_box) */
+static void step_curl_skip(const curl_args &a, const ivec &is, const ivec &ie,
+			   bool skip, const ivec &lo, const ivec &hi,
+			   const grid_volume &gv, double Courant, double dt,
+			   const structure_chunk *s) {
+  if (!skip) {
+    step_curl_block(a, is, ie, gv, Courant, dt, s);
+    return;
+  }
+  ivec bs[10], be[10];
+  const int n = subtract_box(gv, is, ie, lo, hi, bs, be);
+  for (int k = 0; k < n; ++k)
+    step_curl_block(a, bs[k], be[k], gv, Courant, dt, s);
+}
+
+/* Split the loop range is..ie of a component into the boxes of halo
+   points within depth[d][side] of its faces (see fields_chunk::in_halo),
+   returned in hs..he, and the remaining interior, returned in is..ie.
+   Returns the number of halo boxes. */
+static int split_halo(const grid_volume &gv, const int depth[5][2],
+		      ivec &is, ivec &ie, ivec hs[10], ivec he[10]) {
+  int n = 0;
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    // the last point looped over, e.g. big_corner()-1 for odd is
+    ie.set_direction(d, ie.in_direction(d)
+		     - ((ie.in_direction(d) - is.in_direction(d)) & 1));
+    if (is.in_direction(d) > ie.in_direction(d)) break; // empty interior
+    const int nlo = (depth[d][Low] + 1) / 2, nhi = (depth[d][High] + 1) / 2;
+    if (nlo > 0) {
+      hs[n] = is; he[n] = ie;
+      he[n].set_direction(d, min(ie.in_direction(d),
+				 is.in_direction(d) + 2*(nlo-1)));
+      is.set_direction(d, he[n].in_direction(d) + 2);
+      ++n;
+    }
+    if (nhi > 0 && is.in_direction(d) <= ie.in_direction(d)) {
+      hs[n] = is; he[n] = ie;
+      hs[n].set_direction(d, max(is.in_direction(d),
+				 ie.in_direction(d) - 2*(nhi-1)));
+      ie.set_direction(d, hs[n].in_direction(d) - 2);
+      ++n;
+    }
+  }
+  return n;
+}
+
+/* restrict the loop range is..ie in direction d to the t-th block of
+   T points, returning false if the block is empty */
+static bool clip_to_tile(ivec &is, ivec &ie, direction d, int t, int T) {
+  const int i0 = is.in_direction(d) + 2*t*T;
+  if (i0 > ie.in_direction(d)) return false;
+  is.set_direction(d, i0);
+  ie.set_direction(d, min(i0 + 2*(T-1), ie.in_direction(d)));
+  return true;
+}
+
+bool fields_chunk::step_db(field_type ft, halo_part part) {
   bool allocated_u = false;
 
   if (ft != B_stuff && ft != D_stuff)
     abort("bug - step_db should only be called for B or D");
+  if (part != ALL_POINTS && (gv.dim == Dcyl || beta != 0))
+    abort("bug - step_db of the halo only is not supported here");
+
+  /* With tiling (3d only, see fields::use_tiling), the curl updates are
+     deferred and then done in blocks of tile_size x tile_size points in
+     the two outer loop directions (the inner, usually stride-1, loop is
+     left alone).  All components are updated in each block before moving
+     on to the next, so that the g arrays shared between the components
+     are still in cache when they are reused. */
+  const int T = (tile_size > 0 && gv.dim == D3) ? tile_size : 0;
+  ivec slo, shi; // see fields::step_wavefront
+  const bool skip = skip_box(ft, slo, shi);
+  curl_args curl[2 * NUM_FIELD_COMPONENTS];
+  int ncurl = 0;
 
   DOCMP FOR_FT_COMPONENTS(ft, cc)
     if (f[cc][cmp]) {
@@ -117,12 +260,53 @@ bool fields_chunk::step_db(field_type ft) {
       default: abort("bug - non-cylindrical field component in Dcyl");
       }
       
-      STEP_CURL(the_f, cc, f_p, f_m, stride_p, stride_m, gv, Courant, 
-		dsig, s->sig[dsig], s->kap[dsig], s->siginv[dsig], 
-		f_u[cc][cmp], dsigu, s->sig[dsigu], s->kap[dsigu], s->siginv[dsigu], 
-		dt, 
-		s->conductivity[cc][d_c], s->condinv[cc][d_c],f_cond[cc][cmp]);
+      curl_args &a = curl[ncurl];
+      a.f = the_f; a.c = cc;
+      a.g1 = f_p; a.g2 = f_m; a.s1 = stride_p; a.s2 = stride_m;
+      a.dsig = dsig; a.fu = f_u[cc][cmp]; a.dsigu = dsigu;
+      a.cnd = s->conductivity[cc][d_c]; a.cndinv = s->condinv[cc][d_c];
+      a.fcnd = f_cond[cc][cmp];
+      if (T || part != ALL_POINTS || skip) ++ncurl;
+      else // f_rderiv_int may be overwritten by the next component
+	step_curl_block(a, gv.little_owned_corner0(cc), gv.big_corner(),
+			gv, Courant, dt, s);
+    }
+
+  // loop ranges of the deferred curls (the interior, if part != ALL_POINTS)
+  ivec cis[2 * NUM_FIELD_COMPONENTS], cie[2 * NUM_FIELD_COMPONENTS];
+  for (int j = 0; j < ncurl; ++j) {
+    cis[j] = gv.little_owned_corner0(curl[j].c);
+    cie[j] = gv.big_corner();
+    if (part != ALL_POINTS) {
+      ivec hs[10], he[10];
+      const int nh = split_halo(gv, halo_depth, cis[j], cie[j], hs, he);
+      if (part == HALO_POINTS)
+	for (int k = 0; k < nh; ++k)
+	  step_curl_skip(curl[j], hs[k], he[k], skip, slo, shi,
+			 gv, Courant, dt, s);
+    }
+  }
+
+  if (part != HALO_POINTS) {
+    if (T) {
+      const direction d1 = gv.yucky_direction(0), d2 = gv.yucky_direction(1);
+      const int nt1 = (gv.num_direction(d1) + T) / T;
+      const int nt2 = (gv.num_direction(d2) + T) / T;
+      for (int t1 = 0; t1 < nt1; ++t1)
+	for (int t2 = 0; t2 < nt2; ++t2)
+	  for (int j = 0; j < ncurl; ++j) {
+	    ivec is(cis[j]), ie(cie[j]);
+	    if (clip_to_tile(is, ie, d1, t1, T)
+		&& clip_to_tile(is, ie, d2, t2, T))
+	      step_curl_skip(curl[j], is, ie, skip, slo, shi,
+			     gv, Courant, dt, s);
+	  }
     }
+    else
+      for (int j = 0; j < ncurl; ++j)
+	step_curl_skip(curl[j], cis[j], cie[j], skip, slo, shi,
+		       gv, Courant, dt, s);
+  }
 
   /* In 2d with beta != 0, add beta terms.  This is a trick to model
      an exp(i beta z) z-dependence but without requiring a "3d"
@@ -58,8 +58,79 @@ namespace meep {
    in which case f solves:
        df/dt = dfu/dt - sigma_u * f
    and fu replaces f in the equations above (fu += dt curl g etcetera).
+
+   Only the points from is to ie (inclusive) are updated; normally
+   this is the owned volume of the component, i.e.
+   gv.little_owned_corner0(c) to gv.big_corner(), but it may also be
+   a sub-block of it (for tiling in fields_chunk::step_db).
+
+   The "MOST GENERAL CASE" loop is written once, as a template whose
+   parameters say which terms are present (PML in f, fu, conductivity,
+   g2), and step_curl picks the instantiation for the given arguments,
+   so that the compiler throws out the missing terms and every branch
+   is gone from the inner loop.  The arithmetic (and its order) in each
+   case is the same as in the most general case with the missing terms
+   dropped.
 */
-void step_curl(RPR f, component c, const RPR g1, const RPR g2,
+template <bool PML, bool FU, bool CND, bool G2>
+static void curl_kernel(RPR f, const ivec &is, const ivec &ie,
+			const RPR g1, const RPR g2, int s1, int s2,
+			const grid_volume &gv, double dtdx,
+			direction dsig, const DPR sig, const DPR kap,
+			const DPR siginv,
+			RPR fu, direction dsigu, const DPR sigu, const DPR kapu,
+			const DPR siginvu,
+			double dt, const RPR cnd, const RPR cndinv, RPR fcnd)
+{
+  const double dt2 = dt * 0.5;
+  KSTRIDE_DEF((PML ? dsig : X), k, is);
+  KSTRIDE_DEF((FU ? dsigu : X), ku, is);
+  LOOP_OVER_IVECS(gv, is, ie, i) {
+    DEF_k; DEF_ku;
+    realnum &x = FU ? fu[i] : f[i]; // the field updated by the curl
+    const double fprev = x;
+    const double c = G2 ? g1[i+s1] - g1[i] + g2[i] - g2[i+s2]
+                        : g1[i+s1] - g1[i];
+    if (PML) {
+      if (CND) {
+	realnum fcnd_prev = fcnd[i];
+	fcnd[i] = ((1 - dt2 * cnd[i]) * fcnd[i] - dtdx * c) * cndinv[i];
+	x = ((kap[k] - sig[k]) * x + (fcnd[i] - fcnd_prev)) * siginv[k];
+      }
+      else
+	x = ((kap[k] - sig[k]) * x - dtdx * c) * siginv[k];
+    }
+    else if (CND)
+      x = ((1 - dt2 * cnd[i]) * x - dtdx * c) * cndinv[i];
+    else
+      x -= dtdx * c;
+    if (FU)
+      f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
+  }
+}
+
+typedef void (*curl_kernel_func)(RPR f, const ivec &is, const ivec &ie,
+				 const RPR g1, const RPR g2, int s1, int s2,
+				 const grid_volume &gv, double dtdx,
+				 direction dsig, const DPR sig, const DPR kap,
+				 const DPR siginv,
+				 RPR fu, direction dsigu, const DPR sigu,
+				 const DPR kapu, const DPR siginvu,
+				 double dt, const RPR cnd, const RPR cndinv,
+				 RPR fcnd);
+
+#define CURL_KERNELS(PML, FU)						\
+  curl_kernel<PML, FU, false, false>, curl_kernel<PML, FU, false, true>, \
+  curl_kernel<PML, FU, true, false>, curl_kernel<PML, FU, true, true>
+
+// indexed by 8*PML + 4*FU + 2*CND + G2
+static const curl_kernel_func curl_kernels[16] = {
+  CURL_KERNELS(false, false), CURL_KERNELS(false, true),
+  CURL_KERNELS(true, false), CURL_KERNELS(true, true)
+};
+
+void step_curl(RPR f, const ivec &is, const ivec &ie,
+	       const RPR g1, const RPR g2,
 	       int s1, int s2, // strides for g1/g2 shift
 	       const grid_volume &gv, double dtdx,
 	       direction dsig, const DPR sig, const DPR kap, const DPR siginv,
@@ -73,170 +144,63 @@ void step_curl(RPR f, component c, const RPR g1, const RPR g2,
     dtdx = -dtdx; // need to flip derivative sign
   }
 
-  /* The following are a bunch of special cases of the "MOST GENERAL CASE"
-     loop below.  We make copies of the loop for each special case in
-     order to keep the innermost loop efficient.  This is especially
-     important because the non-PML cases are actually more common. 
-     (The "right" way to do this is by partial evaluation of the 
-      most general case, but that would require a code generator.) */
-
-  if (dsig == NO_DIRECTION) { // no PML in f update
-    if (dsigu == NO_DIRECTION) { // no fu update
-      if (cnd) {
-	double dt2 = dt * 0.5;
-	if (g2) {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i)
-	    f[i] = ((1 - dt2 * cnd[i]) * f[i] - 
-		    dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2])) * cndinv[i];
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i)
-	    f[i] = ((1 - dt2 * cnd[i]) * f[i] 
-		    - dtdx * (g1[i+s1] - g1[i])) * cndinv[i];
-	}
-      }
-      else { // no conductivity
-	if (g2) {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i)
-	    f[i] -= dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2]);
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i)
-	    f[i] -= dtdx * (g1[i+s1] - g1[i]);
-	}
-      }
-    }
-    else { // fu update, no PML in f update
-      KSTRIDE_DEF(dsigu, ku, gv.little_owned_corner0(c));
-      if (cnd) {
-	double dt2 = dt * 0.5;
-	if (g2) {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_ku; double fprev = fu[i];
-	    fu[i] = ((1 - dt2 * cnd[i]) * fprev - 
-		    dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2])) * cndinv[i];
-	    f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-	  }
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_ku; double fprev = fu[i];
-	    fu[i] = ((1 - dt2 * cnd[i]) * fprev
-		    - dtdx * (g1[i+s1] - g1[i])) * cndinv[i];
-	    f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-	  }
-	}
-      }
-      else { // no conductivity
-	if (g2) {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_ku; double fprev = fu[i];
-	    fu[i] -= dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2]);
-	    f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-	  }
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_ku; double fprev = fu[i];
-	    fu[i] -= dtdx * (g1[i+s1] - g1[i]);
-	    f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-	  }
-	}
-      }
-    }
-  }
-  else { /* PML in f update */
-    KSTRIDE_DEF(dsig, k, gv.little_owned_corner0(c));
-    if (dsigu == NO_DIRECTION) { // no fu update
-      if (cnd) {
-	double dt2 = dt * 0.5;
-	if (g2) {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_k;
-	    realnum fcnd_prev = fcnd[i];
-	    fcnd[i] = ((1 - dt2 * cnd[i]) * fcnd[i] - 
-		       dtdx * (g1[i+s1]-g1[i] + g2[i]-g2[i+s2])) * cndinv[i];
-	    f[i] = ((kap[k] - sig[k]) * f[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
-	  }
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_k;
-	    realnum fcnd_prev = fcnd[i];
-	    fcnd[i] = ((1 - dt2 * cnd[i]) * fcnd[i] - 
-		       dtdx * (g1[i+s1] - g1[i])) * cndinv[i];
-	    f[i] = ((kap[k] - sig[k]) * f[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
-	  }
-	}
-      }
-      else { // no conductivity (other than PML conductivity)
-	if (g2) {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_k;
-	    f[i] = ((kap[k] - sig[k]) * f[i] -
-		    dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2])) * siginv[k];
-	  }
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_k;
-	    f[i] = ((kap[k] - sig[k]) * f[i] - dtdx * (g1[i+s1]-g1[i])) * siginv[k];
-	  }
-	}
-      }
-    }
-    else { // fu update + PML in f update
-      KSTRIDE_DEF(dsigu, ku, gv.little_owned_corner0(c));
-      if (cnd) {
-	double dt2 = dt * 0.5;
-	if (g2) {
-	  //////////////////// MOST GENERAL CASE //////////////////////
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_k; DEF_ku; double fprev = fu[i];
-	    realnum fcnd_prev = fcnd[i];
-	    fcnd[i] = ((1 - dt2 * cnd[i]) * fcnd[i] - 
-		       dtdx * (g1[i+s1]-g1[i] + g2[i]-g2[i+s2])) * cndinv[i];
-	    fu[i] = ((kap[k] - sig[k]) * fu[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
-	    f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-	  }
-	  /////////////////////////////////////////////////////////////
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_k; DEF_ku; double fprev = fu[i];
-	    realnum fcnd_prev = fcnd[i];
-	    fcnd[i] = ((1 - dt2 * cnd[i]) * fcnd[i] - 
-		       dtdx * (g1[i+s1] - g1[i])) * cndinv[i];
-	    fu[i] = ((kap[k] - sig[k]) * fu[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
-	    f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-	  }
-	}
-      }
-      else { // no conductivity (other than PML conductivity)
-	if (g2) {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_k; DEF_ku; double fprev = fu[i];
-	    fu[i] = ((kap[k] - sig[k]) * fu[i] -
-		    dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2])) * siginv[k];
-	    f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-	  }
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	    DEF_k; DEF_ku; double fprev = fu[i];
-	    fu[i] = ((kap[k] - sig[k]) * fu[i] - dtdx * (g1[i+s1]-g1[i])) * siginv[k];
-	    f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-	  }
-	}
-      }
-    }
+  const bool pml = dsig != NO_DIRECTION, have_fu = dsigu != NO_DIRECTION;
+  if (!pml && !have_fu && !cnd && LOOPS_ARE_STRIDE1(gv)) {
+    // the most common case, so use SIMD
+    LOOP_OVER_IVEC_ROWS(gv, is, ie, i)
+      simd_curl_row(f+i, g1+i, g2 ? g2+i : NULL, s1, s2, dtdx, loop_n3);
+    return;
   }
+  curl_kernels[8*pml + 4*have_fu + 2*(cnd != NULL) + (g2 != NULL)]
+    (f, is, ie, g1, g2, s1, s2, gv, dtdx, dsig, sig, kap, siginv,
+     fu, dsigu, sigu, kapu, siginvu, dt, cnd, cndinv, fcnd);
 }
 
 /* field-update equation f += betadt * g (plus variants for conductivity 
    and/or PML).  This is used in 2d calculations to add an exp(i beta z)
    time dependence, which gives an additional i \beta \hat{z} \times
-   cross-product in the curl equations. */
+   cross-product in the curl equations.  As in step_curl, the variants
+   are instantiations of one template. */
+template <bool PML, bool FU, bool CND>
+static void beta_kernel(RPR f, component c, const RPR g,
+			const grid_volume &gv, double betadt,
+			direction dsig, const DPR siginv,
+			RPR fu, direction dsigu, const DPR siginvu,
+			const RPR cndinv, RPR fcnd)
+{
+  KSTRIDE_DEF((PML ? dsig : X), k, gv.little_owned_corner0(c));
+  KSTRIDE_DEF((FU ? dsigu : X), ku, gv.little_owned_corner0(c));
+  LOOP_OVER_VOL_OWNED0(gv, c, i) {
+    DEF_k; DEF_ku;
+    double df = betadt * g[i];
+    if (CND) {
+      df = df * cndinv[i];
+      if (PML) fcnd[i] += df;
+    }
+    if (PML) df = df * siginv[k];
+    if (FU) {
+      fu[i] += df;
+      f[i] += siginvu[ku] * df;
+    }
+    else
+      f[i] += df;
+  }
+}
+
+typedef void (*beta_kernel_func)(RPR f, component c, const RPR g,
+				 const grid_volume &gv, double betadt,
+				 direction dsig, const DPR siginv,
+				 RPR fu, direction dsigu, const DPR siginvu,
+				 const RPR cndinv, RPR fcnd);
+
+// indexed by 4*PML + 2*FU + CND
+static const beta_kernel_func beta_kernels[8] = {
+  beta_kernel<false, false, false>, beta_kernel<false, false, true>,
+  beta_kernel<false, true, false>, beta_kernel<false, true, true>,
+  beta_kernel<true, false, false>, beta_kernel<true, false, true>,
+  beta_kernel<true, true, false>, beta_kernel<true, true, true>
+};
+
 void step_beta(RPR f, component c, const RPR g,
 	       const grid_volume &gv, double betadt,
 	       direction dsig, const DPR siginv,
@@ -244,75 +208,9 @@ void step_beta(RPR f, component c, const RPR g,
 	       const RPR cndinv, RPR fcnd)
 {
   if (!g) return;
-  if (dsig != NO_DIRECTION) { // PML in f update
-    KSTRIDE_DEF(dsig, k, gv.little_owned_corner0(c));
-    if (dsigu != NO_DIRECTION) { // PML in f + fu
-      KSTRIDE_DEF(dsigu, ku, gv.little_owned_corner0(c));
-      if (cndinv) { // conductivity + PML
-	//////////////////// MOST GENERAL CASE //////////////////////
-	LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	  DEF_k; DEF_ku; double df;
-	  double dfcnd = betadt * g[i] * cndinv[i];
-	  fcnd[i] += dfcnd;
-	  fu[i] += (df = dfcnd * siginv[k]);
-	  f[i] += siginvu[ku] * df;
-	}
-	/////////////////////////////////////////////////////////////
-      }
-      else { // PML only
-	LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	  DEF_k; DEF_ku; double df;
-	  fu[i] += (df = betadt * g[i] * siginv[k]);
-	  f[i] += siginvu[ku] * df;
-	}
-      }
-    }
-    else { // PML in f, no fu
-      if (cndinv) { // conductivity + PML
-	LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	  DEF_k;
-	  double dfcnd = betadt * g[i] * cndinv[i];
-	  fcnd[i] += dfcnd;
-	  f[i] += dfcnd * siginv[k];
-	}
-      }
-      else { // PML only
-	LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	  DEF_k;
-	  f[i] += betadt * g[i] * siginv[k];
-	}
-      }
-    }
-  }
-  else { // no PML in f update
-    if (dsigu != NO_DIRECTION) { // fu, no PML in f
-      KSTRIDE_DEF(dsigu, ku, gv.little_owned_corner0(c));
-      if (cndinv) { // conductivity, no PML
-	LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	  DEF_ku; double df;
-	  fu[i] += (df = betadt * g[i] * cndinv[i]);
-	  f[i] += siginvu[ku] * df;
-	}
-      }
-      else { // no conductivity or PML
-	LOOP_OVER_VOL_OWNED0(gv, c, i) {
-	  DEF_ku; double df;
-	  fu[i] += (df = betadt * g[i]);
-	  f[i] += siginvu[ku] * df;
-	}
-      }
-    }
-    else { // no PML, no fu
-      if (cndinv) { // conductivity, no PML
-	LOOP_OVER_VOL_OWNED0(gv, c, i)
-	  f[i] += betadt * g[i] * cndinv[i];
-      }
-      else { // no conductivity or PML
-	LOOP_OVER_VOL_OWNED0(gv, c, i)
-	  f[i] += betadt * g[i];
-      }
-    }
-  }
+  beta_kernels[4*(dsig != NO_DIRECTION) + 2*(dsigu != NO_DIRECTION)
+	       + (cndinv != NULL)]
+    (f, c, g, gv, betadt, dsig, siginv, fu, dsigu, siginvu, cndinv, fcnd);
 }
 
 /* Given Dsqr = |D|^2 and Di = component of D, compute the factor f so
@@ -339,6 +237,10 @@ inline double calc_nonlinear_u(const double Dsqr,
    Here, g = (g,g1,g2) where g1 and g2 are the off-diagonal
    components, if any (g2 may be NULL).
 
+   Only the points from is to ie (inclusive) are updated; normally
+   this is the owned volume of fc, gv.little_owned_corner(fc) to
+   gv.big_corner(), but step_wavefront also updates parts of it.
+
    In PML (dsigw != NO_DIR), we have an additional auxiliary field fw,
    which is updated by the equations:
           fw = u * g
@@ -346,11 +248,134 @@ inline double calc_nonlinear_u(const double Dsqr,
    That is, fw is updated like the non-PML f, and f is updated from
    fw by a little ODE.  Here, sigw[k] = sigmaw[k]*dt/2, kappaw[k] = kapw[k]
 
+   As in step_curl, the variants are instantiations of one template
+   kernel: NOFF is the number of off-diagonal u terms (u1 and u2), and
+   NG the number of off-diagonal g terms in |D|^2 for the nonlinearity.
+
+   gP[0..ngP-1] are arrays (polarizations) to subtract from g, so that
+   f = u * (D - P) is computed without first forming D - P in a
+   separate array (f_minus_p in update_eh).  This is only supported
+   for diagonal u without chi2/chi3, and NP = ngP is a template
+   parameter of the kernel, up to MAX_FUSED_P.
+
+   If uidx is not NULL, the u arrays are tables of the distinct rows of
+   the material, indexed by uidx[i] (an unsigned char or unsigned
+   short array, see material_index.cpp); IDX is the corresponding way
+   of looking up the u's of point i.
 */
 
-void step_update_EDHB(RPR f, component fc, const grid_volume &gv, 
-		      const RPR g, const RPR g1, const RPR g2,
+struct direct_index {
+  direct_index(const void *) {}
+  int operator[](int i) const { return i; }
+};
+template <class T> struct table_index {
+  const T *idx;
+  table_index(const void *uidx) : idx((const T *) uidx) {}
+  int operator[](int i) const { return idx[i]; }
+};
+
+// stable averaging of offdiagonal components
+#define OFFDIAG(u,g,sx) (0.25 * ((g[i]+g[i-sx])*u[ui[i]] \
+		   	       + (g[i+s]+g[(i+s)-sx])*u[ui[i+s]]))
+
+template <class IDX, bool PML, int NOFF, bool CHI3, int NG, bool U, int NP>
+static void update_kernel(RPR f, const ivec &is, const ivec &ie,
+			  const grid_volume &gv, const RPR g, const RPR g1, const RPR g2,
+			  const realnum *const *gP,
+			  const RPR u, const RPR u1, const RPR u2,
+			  const void *uidx, int s, int s1, int s2,
+			  const RPR chi2, const RPR chi3,
+			  RPR fw, direction dsigw, const DPR sigw,
+			  const DPR kapw)
+{
+  const IDX ui(uidx);
+  const RPR p0 = NP >= 1 ? gP[0] : NULL;
+  const RPR p1 = NP >= 2 ? gP[1] : NULL;
+  const RPR p2 = NP >= 3 ? gP[2] : NULL;
+  const RPR p3 = NP >= 4 ? gP[3] : NULL;
+  KSTRIDE_DEF((PML ? dsigw : X), kw, is);
+  LOOP_OVER_IVECS(gv, is, ie, i) {
+    double gs = g[i]; double us = U ? u[ui[i]] : 1.0;
+    if (NP >= 1) gs = gs - p0[i];
+    if (NP >= 2) gs = gs - p1[i];
+    if (NP >= 3) gs = gs - p2[i];
+    if (NP >= 4) gs = gs - p3[i];
+    double fnew = U ? gs * us : gs;
+    if (NOFF >= 1) fnew = fnew + OFFDIAG(u1,g1,s1);
+    if (NOFF >= 2) fnew = fnew + OFFDIAG(u2,g2,s2);
+    if (CHI3) {
+      double g1s = NG >= 1 ? g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)] : 0;
+      double g2s = NG >= 2 ? g2[i]+g2[i+s]+g2[i-s2]+g2[i+(s-s2)] : 0;
+      double Dsqr = NG == 2 ? gs * gs + 0.0625 * (g1s*g1s + g2s*g2s)
+	: (NG == 1 ? gs * gs + 0.0625 * (g1s*g1s) : gs * gs);
+      fnew = fnew * calc_nonlinear_u(Dsqr, gs, us, chi2[i], chi3[i]);
+    }
+    if (PML) {
+      DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
+      fw[i] = fnew;
+      f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
+    }
+    else
+      f[i] = fnew;
+  }
+}
+
+typedef void (*update_kernel_func)(RPR f, const ivec &is, const ivec &ie,
+				   const grid_volume &gv, const RPR g, const RPR g1, const RPR g2,
+				   const realnum *const *gP,
+				   const RPR u, const RPR u1, const RPR u2,
+				   const void *uidx, int s, int s1, int s2,
+				   const RPR chi2, const RPR chi3,
+				   RPR fw, direction dsigw, const DPR sigw,
+				   const DPR kapw);
+
+/* The valid combinations of the template parameters, other than PML:
+   off-diagonal u (in which case u is also present), or diagonal u
+   with chi3 and 0-2 off-diagonal g's for |D|^2, or diagonal u or no
+   u at all.  (chi3 requires u, as it is multiplied by chi1inv.) */
+#define UPDATE_KERNELS(I, PML)						\
+  update_kernel<I, PML, 2, true, 2, true, 0>,				\
+  update_kernel<I, PML, 2, false, 0, true, 0>,				\
+  update_kernel<I, PML, 1, true, 1, true, 0>,				\
+  update_kernel<I, PML, 1, false, 0, true, 0>,				\
+  update_kernel<I, PML, 0, true, 2, true, 0>,				\
+  update_kernel<I, PML, 0, true, 1, true, 0>,				\
+  update_kernel<I, PML, 0, true, 0, true, 0>,				\
+  update_kernel<I, PML, 0, false, 0, true, 0>,				\
+  update_kernel<I, PML, 0, false, 0, false, 0>
+
+static const update_kernel_func update_kernels[3][2][9] = {
+  { { UPDATE_KERNELS(direct_index, false) },
+    { UPDATE_KERNELS(direct_index, true) } },
+  { { UPDATE_KERNELS(table_index<unsigned char>, false) },
+    { UPDATE_KERNELS(table_index<unsigned char>, true) } },
+  { { UPDATE_KERNELS(table_index<unsigned short>, false) },
+    { UPDATE_KERNELS(table_index<unsigned short>, true) } }
+};
+
+// the kernels with 1 to MAX_FUSED_P polarizations, with and without u
+#define UPDATE_P_KERNELS(I, PML, U)					\
+  { update_kernel<I, PML, 0, false, 0, U, 1>,				\
+    update_kernel<I, PML, 0, false, 0, U, 2>,				\
+    update_kernel<I, PML, 0, false, 0, U, 3>,				\
+    update_kernel<I, PML, 0, false, 0, U, 4> }
+#define UPDATE_P_KERNELS_U(I, PML)					\
+  { UPDATE_P_KERNELS(I, PML, false), UPDATE_P_KERNELS(I, PML, true) }
+
+static const update_kernel_func update_p_kernels[3][2][2][MAX_FUSED_P] = {
+  { UPDATE_P_KERNELS_U(direct_index, false),
+    UPDATE_P_KERNELS_U(direct_index, true) },
+  { UPDATE_P_KERNELS_U(table_index<unsigned char>, false),
+    UPDATE_P_KERNELS_U(table_index<unsigned char>, true) },
+  { UPDATE_P_KERNELS_U(table_index<unsigned short>, false),
+    UPDATE_P_KERNELS_U(table_index<unsigned short>, true) }
+};
+
+void step_update_EDHB(RPR f, const ivec &is, const ivec &ie,
+		      const grid_volume &gv, const RPR g, const RPR g1, const RPR g2,
+		      const realnum *const *gP, int ngP,
 		      const RPR u, const RPR u1, const RPR u2,
+		      const unsigned char *uidx8, const unsigned short *uidx16,
 		      int s, int s1, int s2,
 		      const RPR chi2, const RPR chi3,
 		      RPR fw, direction dsigw, const DPR sigw, const DPR kapw)
@@ -362,194 +387,39 @@ void step_update_EDHB(RPR f, component fc, const grid_volume &gv,
     SWAP(const RPR, u1, u2);
     SWAP(int, s1, s2);
   }
+  if (u2 && !u1) abort("bug - didn't swap off-diagonal terms!?");
 
-  // stable averaging of offdiagonal components
-#define OFFDIAG(u,g,sx) (0.25 * ((g[i]+g[i-sx])*u[i] \
-		   	       + (g[i+s]+g[(i+s)-sx])*u[i+s]))
-
-  /* As with step_curl, these loops are all essentially copies
-     of the "MOST GENERAL CASE" loop with various terms thrown out. */
-  
-  if (dsigw != NO_DIRECTION) { //////// PML case (with fw) /////////////
-    KSTRIDE_DEF(dsigw, kw, gv.little_owned_corner0(fc));
-    if (u1 && u2) { // 3x3 off-diagonal u
-      if (chi3) {
-	//////////////////// MOST GENERAL CASE //////////////////////
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double g1s = g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)];
-	  double g2s = g2[i]+g2[i+s]+g2[i-s2]+g2[i+(s-s2)];
-	  double gs = g[i]; double us = u[i];
-	  DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	  fw[i] = (gs * us + OFFDIAG(u1,g1,s1) + OFFDIAG(u2,g2,s2))
-	    * calc_nonlinear_u(gs * gs + 0.0625 * (g1s*g1s + g2s*g2s),
-			       gs, us, chi2[i], chi3[i]);	  
-	  f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	}
-	/////////////////////////////////////////////////////////////
-      }
-      else {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double gs = g[i]; double us = u[i];
-	  DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	  fw[i] = (gs * us + OFFDIAG(u1,g1,s1) + OFFDIAG(u2,g2,s2));
-	  f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	}
-      }
-    }
-    else if (u1) { // 2x2 off-diagonal u
-      if (chi3) {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double g1s = g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)];
-	  double gs = g[i]; double us = u[i];
-	  DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	  fw[i] = (gs * us + OFFDIAG(u1,g1,s1))
-	    * calc_nonlinear_u(gs * gs + 0.0625 * (g1s*g1s),
-			       gs, us, chi2[i], chi3[i]);
-	  f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	}
-      }
-      else {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double gs = g[i]; double us = u[i];
-	  DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	  fw[i] = (gs * us + OFFDIAG(u1,g1,s1));
-	  f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	}
-      }
-    }
-    else if (u2) { // 2x2 off-diagonal u
-      abort("bug - didn't swap off-diagonal terms!?");
-    }
-    else { // diagonal u
-      if (chi3) {
-	if (g1 && g2) {
-	  LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	    double g1s = g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)];
-	    double g2s = g2[i]+g2[i+s]+g2[i-s2]+g2[i+(s-s2)];
-	    double gs = g[i]; double us = u[i];
-	    DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	    fw[i] = (gs*us)*calc_nonlinear_u(gs*gs+0.0625*(g1s*g1s+g2s*g2s),
-					     gs, us, chi2[i], chi3[i]);
-	    f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	  }
-	}
-	else if (g1) {
-	  LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	    double g1s = g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)];
-	    double gs = g[i]; double us = u[i];
-	    DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	    fw[i] = (gs*us)*calc_nonlinear_u(gs*gs + 0.0625*(g1s*g1s),
-					     gs, us, chi2[i], chi3[i]);
-	    f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	  }
-	}
-	else if (g2) {
-	  abort("bug - didn't swap off-diagonal terms!?");
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	    double gs = g[i]; double us = u[i];
-	    DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	    fw[i] = (gs*us)*calc_nonlinear_u(gs*gs, gs,us, chi2[i],chi3[i]);
-	    f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	  }
-	}
-      }
-      else if (u) {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double gs = g[i]; double us = u[i];
-	  DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	  fw[i] = (gs * us);
-	  f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	}
-      }
-      else {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  DEF_kw; double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-	  fw[i] = g[i];
-	  f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-	}
-      }
-    }
+  const bool pml = dsigw != NO_DIRECTION;
+  const int idx = uidx8 ? 1 : (uidx16 ? 2 : 0);
+  const void *uidx = uidx8 ? (const void *) uidx8 : (const void *) uidx16;
+  if (ngP > 0) {
+    if (u1 || chi3 || ngP > MAX_FUSED_P)
+      abort("bug - unsupported polarizations in step_update_EDHB");
+    update_p_kernels[idx][pml][u != NULL][ngP-1]
+      (f, is, ie, gv, g, g1, g2, gP, u, u1, u2, uidx, s, s1, s2, chi2, chi3,
+       fw, dsigw, sigw, kapw);
+    return;
   }
-  else { /////////////// no PML (no fw) ///////////////////
-    if (u1 && u2) { // 3x3 off-diagonal u
-      if (chi3) {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double g1s = g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)];
-	  double g2s = g2[i]+g2[i+s]+g2[i-s2]+g2[i+(s-s2)];
-	  double gs = g[i]; double us = u[i];
-	  f[i] = (gs * us + OFFDIAG(u1,g1,s1) + OFFDIAG(u2,g2,s2))
-	    * calc_nonlinear_u(gs * gs + 0.0625 * (g1s*g1s + g2s*g2s),
-			       gs, us, chi2[i], chi3[i]);	  
-	}
-      }
-      else {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double gs = g[i]; double us = u[i];
-	  f[i] = (gs * us + OFFDIAG(u1,g1,s1) + OFFDIAG(u2,g2,s2));
-	}
-      }
-    }
-    else if (u1) { // 2x2 off-diagonal u
-      if (chi3) {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double g1s = g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)];
-	  double gs = g[i]; double us = u[i];
-	  f[i] = (gs * us + OFFDIAG(u1,g1,s1))
-	    * calc_nonlinear_u(gs * gs + 0.0625 * (g1s*g1s),
-			       gs, us, chi2[i], chi3[i]);
-	}
-      }
-      else {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double gs = g[i]; double us = u[i];
-	  f[i] = (gs * us + OFFDIAG(u1,g1,s1));
-	}
-      }
-    }
-    else if (u2) { // 2x2 off-diagonal u
-      abort("bug - didn't swap off-diagonal terms!?");
-    }
-    else { // diagonal u
-      if (chi3) {
-	if (g1 && g2) {
-	  LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	    double g1s = g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)];
-	    double g2s = g2[i]+g2[i+s]+g2[i-s2]+g2[i+(s-s2)];
-	    double gs = g[i]; double us = u[i];
-	    f[i] = (gs*us)*calc_nonlinear_u(gs*gs+0.0625*(g1s*g1s+g2s*g2s),
-					gs, us, chi2[i], chi3[i]);
-	  }
-	}
-	else if (g1) {
-	  LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	    double g1s = g1[i]+g1[i+s]+g1[i-s1]+g1[i+(s-s1)];
-	    double gs = g[i]; double us = u[i];
-	    f[i] = (gs*us)*calc_nonlinear_u(gs*gs + 0.0625*(g1s*g1s),
-						gs, us, chi2[i], chi3[i]);
-	  }
-	}
-	else if (g2) {
-	  abort("bug - didn't swap off-diagonal terms!?");
-	}
-	else {
-	  LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	    double gs = g[i]; double us = u[i];
-	    f[i] = (gs*us)*calc_nonlinear_u(gs*gs, gs,us, chi2[i],chi3[i]);
-	  }
-	}
-      }
-      else if (u) {
-	LOOP_OVER_VOL_OWNED(gv, fc, i) {
-	  double gs = g[i]; double us = u[i];
-	  f[i] = (gs * us);
-	}
-      }
-      else
-	LOOP_OVER_VOL_OWNED(gv, fc, i) f[i] = g[i];
+  int kernel;
+  if (u1 && u2) kernel = chi3 ? 0 : 1; // 3x3 off-diagonal u
+  else if (u1) kernel = chi3 ? 2 : 3; // 2x2 off-diagonal u
+  else if (chi3) { // diagonal u
+    if (g2 && !g1) abort("bug - didn't swap off-diagonal terms!?");
+    kernel = g2 ? 4 : (g1 ? 5 : 6);
+  }
+  else if (u) {
+    if (!pml && !idx && LOOPS_ARE_STRIDE1(gv)) { // common case: use SIMD
+      LOOP_OVER_IVEC_ROWS(gv, is, ie, i)
+	simd_mult_row(f+i, g+i, u+i, loop_n3);
+      return;
     }
+    kernel = 7;
   }
+  else kernel = 8;
+  update_kernels[idx][pml][kernel](f, is, ie, gv, g, g1, g2, gP,
+				   u, u1, u2, uidx,
+				   s, s1, s2, chi2, chi3,
+				   fw, dsigw, sigw, kapw);
 }
 
 } // namespace meep
@@ -0,0 +1,166 @@
+/* Copyright (C) 2005-2015 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* Hand-vectorized versions of the innermost (stride-1) loops of the
+   most common cases in step_generic.cpp: the curl update without PML
+   or conductivity, and the multiplication by a diagonal chi1inv.
+   Compilers often fail to vectorize these through the triple loop of
+   LOOP_OVER_IVECS, so step_generic.cpp loops over rows instead (with
+   LOOP_OVER_IVEC_ROWS) and calls the functions here for each row.
+
+   The AVX2 and AVX-512 versions are compiled with gcc's target
+   attribute, so that the rest of Meep need not be compiled with
+   -mavx2 etc., and the best version supported by the CPU is picked
+   at runtime.  With MEEP_SINGLE, a vector holds twice as many
+   realnum values. */
+
+#include "meep.hpp"
+#include "meep_internals.hpp"
+#include "config.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+  && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#  define HAVE_X86_SIMD 1
+#  include <immintrin.h>
+#endif
+
+#define RPR realnum * restrict
+
+namespace meep {
+
+/* f -= dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2]), where g2 may be
+   NULL; the same order of operations as step_curl, but with dtdx
+   rounded to realnum (as in the vector versions), so that every
+   element of a row is computed in the same precision */
+static void curl_row_scalar(RPR f, const RPR g1, const RPR g2,
+			    int s1, int s2, double dtdx_, int n) {
+  const realnum dtdx = dtdx_;
+  if (g2)
+    for (int i = 0; i < n; ++i)
+      f[i] -= dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2]);
+  else
+    for (int i = 0; i < n; ++i)
+      f[i] -= dtdx * (g1[i+s1] - g1[i]);
+}
+
+static void mult_row_scalar(RPR f, const RPR g, const RPR u, int n) {
+  for (int i = 0; i < n; ++i) f[i] = g[i] * u[i];
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* The kernels are the same for each instruction set up to the
+   names of the vector type and intrinsics, so we generate them
+   with a macro.  W is the number of realnum values per vector.
+   The leftover elements are done in the same function rather than
+   by calling the scalar versions, which are compiled without AVX:
+   jumping to those with the upper halves of the vector registers
+   in use (no vzeroupper) makes every SSE instruction after it
+   pay for the transition, which made short rows several times
+   slower than the scalar code.  Contraction into fused multiply-adds
+   (which AVX-512 implies) is turned off, so that the results are the
+   same as those of the scalar versions. */
+#define SIMD_KERNELS(ISA, TARGET, V, W, LOAD, STORE, SET1, ADD, SUB, MUL) \
+__attribute__((target(TARGET), optimize("fp-contract=off")))		\
+static void curl_row_##ISA(RPR f, const RPR g1, const RPR g2,		\
+			   int s1, int s2, double dtdx_, int n) {	\
+  const realnum dtdx = dtdx_;						\
+  const V vdtdx = SET1(dtdx);						\
+  int i = 0;								\
+  if (g2)								\
+    for (; i + W <= n; i += W) {					\
+      V d = SUB(LOAD(g1+i+s1), LOAD(g1+i));				\
+      d = SUB(ADD(d, LOAD(g2+i)), LOAD(g2+i+s2));			\
+      STORE(f+i, SUB(LOAD(f+i), MUL(vdtdx, d)));			\
+    }									\
+  else									\
+    for (; i + W <= n; i += W) {					\
+      V d = SUB(LOAD(g1+i+s1), LOAD(g1+i));				\
+      STORE(f+i, SUB(LOAD(f+i), MUL(vdtdx, d)));			\
+    }									\
+  if (g2)								\
+    for (; i < n; ++i)							\
+      f[i] -= dtdx * (g1[i+s1] - g1[i] + g2[i] - g2[i+s2]);		\
+  else									\
+    for (; i < n; ++i)							\
+      f[i] -= dtdx * (g1[i+s1] - g1[i]);				\
+}									\
+__attribute__((target(TARGET), optimize("fp-contract=off")))		\
+static void mult_row_##ISA(RPR f, const RPR g, const RPR u, int n) {	\
+  int i = 0;								\
+  for (; i + W <= n; i += W)						\
+    STORE(f+i, MUL(LOAD(g+i), LOAD(u+i)));				\
+  for (; i < n; ++i) f[i] = g[i] * u[i];				\
+}
+
+#if MEEP_SINGLE
+SIMD_KERNELS(avx2, "avx2", __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+	     _mm256_set1_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps)
+SIMD_KERNELS(avx512, "avx512f", __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps,
+	     _mm512_set1_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps)
+#else
+SIMD_KERNELS(avx2, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd,
+	     _mm256_set1_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)
+SIMD_KERNELS(avx512, "avx512f", __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd,
+	     _mm512_set1_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd)
+#endif
+
+#endif /* HAVE_X86_SIMD */
+
+typedef void (*curl_row_func)(RPR f, const RPR g1, const RPR g2,
+			      int s1, int s2, double dtdx, int n);
+typedef void (*mult_row_func)(RPR f, const RPR g, const RPR u, int n);
+
+#ifdef HAVE_X86_SIMD
+enum simd_isa { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+
+static simd_isa best_simd_isa() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+  return SIMD_SCALAR;
+}
+
+static const simd_isa isa = best_simd_isa();
+static const curl_row_func curl_row = isa == SIMD_AVX512 ? curl_row_avx512
+  : (isa == SIMD_AVX2 ? curl_row_avx2 : curl_row_scalar);
+static const mult_row_func mult_row = isa == SIMD_AVX512 ? mult_row_avx512
+  : (isa == SIMD_AVX2 ? mult_row_avx2 : mult_row_scalar);
+#else
+static const curl_row_func curl_row = curl_row_scalar;
+static const mult_row_func mult_row = mult_row_scalar;
+#endif
+
+void simd_curl_row(realnum *f, const realnum *g1, const realnum *g2,
+		   int s1, int s2, double dtdx, int n) {
+  curl_row(f, g1, g2, s1, s2, dtdx, n);
+}
+
+void simd_mult_row(realnum *f, const realnum *g, const realnum *u, int n) {
+  mult_row(f, g, u, n);
+}
+
+void scalar_curl_row(realnum *f, const realnum *g1, const realnum *g2,
+		     int s1, int s2, double dtdx, int n) {
+  curl_row_scalar(f, g1, g2, s1, s2, dtdx, n);
+}
+
+void scalar_mult_row(realnum *f, const realnum *g, const realnum *u, int n) {
+  mult_row_scalar(f, g, u, n);
+}
+
+} // namespace meep
@@ -0,0 +1,460 @@
+/* Copyright (C) 2005-2015 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* Temporal blocking ("wavefront" time stepping) of the FDTD update.
+   Instead of sweeping over the whole chunk once per half step, we
+   advance several time steps in a single sweep over the planes of the
+   outermost (largest-stride) direction dw: plane p of time step s+1
+   only depends on planes p-1..p+1 of time step s, so time step s can
+   trail time step s-1 by two planes and the planes in between are
+   still in cache when they are reused.
+
+   Only the curl and E = chi1inv D updates (including PML and
+   conductivity) are done this way; the sources, polarizations, DFTs
+   and the communication between chunks need the fields of one time
+   step at a time.  So each chunk is split into an interior box free of
+   those (fields_chunk::wavefront_box) and the shell around it.  Half
+   step h of the block (B of step s for h = 2s, D of step s for h =
+   2s+1) is done by the sweep in the box shrunk by h points on each
+   side, which only depends on the fields in the box at the start of
+   the block.  Then the shell is filled in by ordinary fields::step
+   calls, one time step at a time, which leave out the points already
+   done by the sweep (fields_chunk::skip_box).  Since the box of each
+   half step is the previous one shrunk by one point, the neighbors of
+   a shell point are never ahead of it, so the shell sees exactly the
+   fields it would see in ordinary stepping.  Faces of the box that are
+   faces of the chunk with nothing to communicate (e.g. a metal wall)
+   have no shell beyond them, so the box is not shrunk there; a chunk
+   without any sources, DFTs, polarizations or neighbors is thus done
+   entirely by the sweep.
+
+   Chunks with cylindrical coordinates, beta != 0, chi2/chi3 or an
+   off-diagonal chi1inv are not blocked (their updates are not
+   point-by-point), nor are fields that are phasing in a material, have
+   synchronized magnetic fields or old-style flux planes (fluxes), or
+   still need to allocate auxiliary arrays; fields::step_wavefront
+   falls back to fields::step for those.  The arithmetic is exactly the
+   same as in fields::step, so the results are bit-for-bit identical. */
+
+#include <string.h>
+#include <algorithm>
+
+#include "meep.hpp"
+#include "meep_internals.hpp"
+
+using namespace std;
+
+namespace meep {
+
+void fields::step_wavefront(int nsteps, int block) {
+  if (block < 1) abort("step_wavefront requires a positive block size");
+  ivec *lo = new ivec[num_chunks], *hi = new ivec[num_chunks];
+  ivec *dlo = new ivec[num_chunks], *dhi = new ivec[num_chunks];
+  while (nsteps > 0) {
+    int n = min(nsteps, block);
+    if (rebalance_interval > 0) // only rebalance at the end of a block
+      n = min(n, rebalance_interval - t % rebalance_interval);
+    if (n > 1 && can_step_wavefront()) {
+      const bool sources_on = last_source_time() >= time(); // collective
+      am_now_working_on(Stepping);
+      for (int i=0;i<num_chunks;i++) chunks[i]->s->update_condinv();
+      bool shells = false;
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1) reduction(||:shells)
+#endif
+      for (int i=0;i<num_chunks;i++)
+	if (chunks[i]->is_mine()) {
+	  const double start = wall_time();
+	  if (!chunks[i]->wavefront_box(sources_on, n, lo[i], hi[i],
+					dlo[i], dhi[i]))
+	    shells = true;
+	  chunks[i]->step_wavefront(n, lo[i], hi[i], dlo[i], dhi[i]);
+	  chunks[i]->work_time += wall_time() - start;
+	}
+      finished_working();
+      if (or_to_all(shells))
+	for (int s = 0; s < n; ++s) {
+	  for (int i=0;i<num_chunks;i++)
+	    if (chunks[i]->is_mine())
+	      chunks[i]->skip_wavefront(s, lo[i], hi[i], dlo[i], dhi[i]);
+	  step();
+	}
+      else { // the boxes are the whole chunks: nothing else to do
+	t += n;
+	if (rebalance_interval > 0 && t % rebalance_interval == 0)
+	  rebalance(rebalance_threshold);
+      }
+      for (int i=0;i<num_chunks;i++)
+	chunks[i]->skip_wavefront(-1, lo[i], hi[i], dlo[i], dhi[i]);
+      nsteps -= n;
+    }
+    else {
+      step();
+      nsteps -= 1;
+    }
+  }
+  delete[] lo;
+  delete[] hi;
+  delete[] dlo;
+  delete[] dhi;
+}
+
+bool fields::can_step_wavefront() {
+  if (synchronized_magnetic_fields || is_phasing() || fluxes) return false;
+  connect_chunks(); // make sure the halos (see wavefront_box) are up to date
+  bool ok = true;
+  for (int i=0;i<num_chunks && ok;i++)
+    if (chunks[i]->is_mine()) ok = chunks[i]->can_step_wavefront();
+  return and_to_all(ok);
+}
+
+bool fields_chunk::can_step_wavefront() {
+  if (gv.dim == Dcyl || beta != 0 || may_allocate()) return false;
+  FOR_COMPONENTS(c) {
+    if (s->chi2[c] || s->chi3[c]) return false;
+    if (is_electric(c) || is_magnetic(c)) {
+      const direction d_c = component_direction(c);
+      FOR_DIRECTIONS(d) if (d != d_c && s->chi1inv[c][d]) return false;
+    }
+    if (is_D(c) || is_B(c)) { // f_cond is allocated lazily by step_db
+      const direction d_c = component_direction(c);
+      const direction dsig = cycle_direction(gv.dim, d_c, 1);
+      DOCMP if (f[c][cmp] && s->sigsize[dsig] > 1
+		&& s->conductivity[c][d_c] && !f_cond[c][cmp]) return false;
+    }
+  }
+  return true;
+}
+
+/* Cut the box lo..hi down so that it no longer overlaps rlo..rhi, by
+   keeping the largest part of it on one side of rlo..rhi. */
+static void cut_box(const grid_volume &gv, ivec &lo, ivec &hi,
+		    const ivec &rlo, const ivec &rhi) {
+  LOOP_OVER_DIRECTIONS(gv.dim, d)
+    if (rhi.in_direction(d) < lo.in_direction(d)
+	|| rlo.in_direction(d) > hi.in_direction(d)) return;
+  direction dbest = NO_DIRECTION;
+  bool keep_low = true;
+  double best = 0;
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    const int nlow = rlo.in_direction(d) - lo.in_direction(d);
+    const int nhigh = hi.in_direction(d) - rhi.in_direction(d);
+    double size = max(nlow, nhigh);
+    LOOP_OVER_DIRECTIONS(gv.dim, d2)
+      if (d2 != d) size *= hi.in_direction(d2) - lo.in_direction(d2) + 1;
+    if (dbest == NO_DIRECTION || size > best) {
+      dbest = d;
+      keep_low = nlow >= nhigh;
+      best = size;
+    }
+  }
+  if (keep_low) hi.set_direction(dbest, rlo.in_direction(dbest) - 1);
+  else lo.set_direction(dbest, rhi.in_direction(dbest) + 1);
+}
+
+/* The box (ivec coordinates, empty if lo > hi) that step_wavefront
+   can update by itself: the owned points, less the halo of points
+   sent to other chunks (see in_halo), the sources (if sources_on) and
+   the points within one pixel of a DFT or polarization.  dlo and dhi
+   are 1 in the directions where the box must shrink by a point per
+   half step on the low and high side, and 0 where it reaches a face
+   of the chunk without a halo, beyond which there are only not-owned
+   points that nothing updates (a chunk receives from a neighbor only
+   through a face that it also sends through).  The box is left empty
+   if it would shrink to nothing within nblock steps.  Returns true if
+   there is nothing to do outside of the box, i.e. no shell. */
+bool fields_chunk::wavefront_box(bool sources_on, int nblock,
+				 ivec &lo, ivec &hi,
+				 ivec &dlo, ivec &dhi) const {
+  ivec lo0 = gv.little_corner(), hi0 = gv.big_corner();
+  // owned points are > little_corner; for in_halo, see extend_halo
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    const int l = lo0.in_direction(d), h = hi0.in_direction(d);
+    const int dl = halo_depth[d][Low], dh = halo_depth[d][High];
+    lo0.set_direction(d, dl ? l + 2 + dl : l + 1);
+    hi0.set_direction(d, dh ? h - 1 - dh : h);
+  }
+  lo = lo0;
+  hi = hi0;
+
+  if (sources_on)
+    FOR_FIELD_TYPES(ft) for (src_vol *sv = sources[ft]; sv; sv = sv->next) {
+      if (sv->npts < 1) continue;
+      ivec rlo(gv.iloc(sv->c, sv->index[0])), rhi(rlo);
+      for (int j = 1; j < sv->npts; ++j) {
+	const ivec here = gv.iloc(sv->c, sv->index[j]);
+	LOOP_OVER_DIRECTIONS(gv.dim, d) {
+	  rlo.set_direction(d, min(rlo.in_direction(d), here.in_direction(d)));
+	  rhi.set_direction(d, max(rhi.in_direction(d), here.in_direction(d)));
+	}
+      }
+      cut_box(gv, lo, hi, rlo, rhi);
+    }
+
+  const ivec pixel(gv.dim, 2); // DFTs average over neighboring points
+  for (dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_chunk)
+    cut_box(gv, lo, hi, cur->is - pixel, cur->ie + pixel);
+
+  FOR_FIELD_TYPES(ft) for (polarization_state *p = pol[ft]; p; p = p->next)
+    FOR_COMPONENTS(c) FOR_DIRECTIONS(d) if (p->s->sigma[c][d]) {
+      const realnum *sig = p->s->sigma[c][d];
+      ivec rlo(gv.dim), rhi(gv.dim);
+      bool found = false;
+      LOOP_OVER_VOL(gv, c, i) if (sig[i] != 0) {
+	IVEC_LOOP_ILOC(gv, here);
+	if (!found) rlo = rhi = here;
+	found = true;
+	LOOP_OVER_DIRECTIONS(gv.dim, dd) {
+	  rlo.set_direction(dd, min(rlo.in_direction(dd), here.in_direction(dd)));
+	  rhi.set_direction(dd, max(rhi.in_direction(dd), here.in_direction(dd)));
+	}
+      }
+      if (found) cut_box(gv, lo, hi, rlo - pixel, rhi + pixel);
+    }
+
+  dlo = dhi = zero_ivec(gv.dim);
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    if (halo_depth[d][Low] || lo.in_direction(d) != lo0.in_direction(d))
+      dlo.set_direction(d, 1);
+    if (halo_depth[d][High] || hi.in_direction(d) != hi0.in_direction(d))
+      dhi.set_direction(d, 1);
+  }
+
+  const ivec lo1 = lo + dlo * (2*nblock - 1), hi1 = hi - dhi * (2*nblock - 1);
+  LOOP_OVER_DIRECTIONS(gv.dim, d)
+    if (lo1.in_direction(d) > hi1.in_direction(d)) {
+      lo = ivec(gv.dim, 1);
+      hi = ivec(gv.dim, 0);
+      return false;
+    }
+  if (dlo != zero_ivec(gv.dim) || dhi != zero_ivec(gv.dim)
+      || dft_chunks) return false;
+  FOR_FIELD_TYPES(ft)
+    if (pol[ft] || (sources_on && sources[ft])) return false;
+  return true;
+}
+
+bool fields_chunk::skip_box(field_type ft, ivec &lo, ivec &hi) const {
+  const int i = (ft == B_stuff || ft == H_stuff) ? 0 : 1;
+  lo = skip_lo[i];
+  hi = skip_hi[i];
+  LOOP_OVER_DIRECTIONS(gv.dim, d)
+    if (lo.in_direction(d) > hi.in_direction(d)) return false;
+  return true;
+}
+
+/* Make step_db and update_eh skip the points of time step s that
+   step_wavefront(nblock, lo, hi, dlo, dhi) has done, or nothing if
+   s < 0. */
+void fields_chunk::skip_wavefront(int s, const ivec &lo, const ivec &hi,
+				  const ivec &dlo, const ivec &dhi) {
+  for (int i = 0; i < 2; ++i)
+    if (s < 0) {
+      skip_lo[i] = ivec(gv.dim, 1);
+      skip_hi[i] = ivec(gv.dim, 0);
+    }
+    else {
+      skip_lo[i] = lo + dlo * (2*s + i);
+      skip_hi[i] = hi - dhi * (2*s + i);
+    }
+}
+
+/* Clip the loop range is..ie of a component to the points in the box
+   lo..hi, returning false if there are none. */
+bool clip_to_box(const grid_volume &gv, ivec &is, ivec &ie,
+		 const ivec &lo, const ivec &hi) {
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    int i0 = is.in_direction(d), i1 = ie.in_direction(d);
+    i1 -= (i1 - i0) & 1; // the last point looped over
+    if (i0 < lo.in_direction(d)) i0 += (lo.in_direction(d) - i0 + 1) & ~1;
+    if (i1 > hi.in_direction(d)) i1 -= (i1 - hi.in_direction(d) + 1) & ~1;
+    if (i0 > i1) return false;
+    is.set_direction(d, i0);
+    ie.set_direction(d, i1);
+  }
+  return true;
+}
+
+/* Split the points of the loop range is..ie of a component outside of
+   the box lo..hi into (at most 2 per direction) loop ranges bs..be,
+   returning their number. */
+int subtract_box(const grid_volume &gv, ivec is, ivec ie,
+		 const ivec &lo, const ivec &hi, ivec bs[10], ivec be[10]) {
+  int n = 0;
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    int i0 = is.in_direction(d), i1 = ie.in_direction(d);
+    i1 -= (i1 - i0) & 1; // the last point looped over
+    if (i0 > i1) break;
+    if (i0 < lo.in_direction(d)) {
+      const int j1 = min(i1, i0 + ((lo.in_direction(d) - 1 - i0) & ~1));
+      bs[n] = is; be[n] = ie;
+      be[n].set_direction(d, j1);
+      ++n;
+      i0 = j1 + 2;
+    }
+    if (i1 > hi.in_direction(d) && i0 <= i1) {
+      const int j0 = max(i0, i1 - ((i1 - hi.in_direction(d) - 1) & ~1));
+      bs[n] = is; be[n] = ie;
+      bs[n].set_direction(d, j0);
+      be[n].set_direction(d, i1);
+      ++n;
+      i1 = j0 - 2;
+    }
+    is.set_direction(d, i0);
+    ie.set_direction(d, i1);
+  }
+  return n;
+}
+
+/* Restrict the loop range is..ie of a component to the points stored
+   in memory plane p of direction d, returning false if it has none. */
+static bool clip_to_plane(ivec &is, ivec &ie, const grid_volume &gv,
+			  component c, direction d, int p) {
+  const int x = gv.little_corner().in_direction(d)
+    + gv.iyee_shift(c).in_direction(d) + 2*p;
+  if (x < is.in_direction(d) || x > ie.in_direction(d)) return false;
+  is.set_direction(d, x);
+  ie.set_direction(d, x);
+  return true;
+}
+
+/* The metal points (see fields::find_metals) of one field type, sorted
+   by the memory plane of direction d that they lie in, so that they
+   can be zeroed a plane at a time. */
+class plane_metals {
+public:
+  plane_metals(realnum **zeroes, int num_zeroes, realnum *f[][2],
+	       field_type ft, int ntot, int stride, int nplanes) {
+    start = new int[nplanes + 1];
+    pts = new realnum*[num_zeroes];
+    int *plane = new int[num_zeroes];
+    for (int p = 0; p <= nplanes; ++p) start[p] = 0;
+    for (int i = 0; i < num_zeroes; ++i) {
+      plane[i] = 0;
+      DOCMP2 FOR_FT_COMPONENTS(ft, c)
+	if (f[c][cmp] && zeroes[i] >= f[c][cmp] && zeroes[i] < f[c][cmp]+ntot)
+	  plane[i] = (zeroes[i] - f[c][cmp]) / stride;
+      start[plane[i] + 1]++;
+    }
+    for (int p = 0; p < nplanes; ++p) start[p+1] += start[p];
+    int *fill = new int[nplanes];
+    for (int p = 0; p < nplanes; ++p) fill[p] = start[p];
+    for (int i = 0; i < num_zeroes; ++i) pts[fill[plane[i]]++] = zeroes[i];
+    delete[] fill;
+    delete[] plane;
+  }
+  ~plane_metals() { delete[] start; delete[] pts; }
+  void zero(int p) const {
+    for (int i = start[p]; i < start[p+1]; ++i) *(pts[i]) = 0.0;
+  }
+private:
+  int *start;
+  realnum **pts;
+};
+
+void fields_chunk::step_wavefront(int nblock, const ivec &lo, const ivec &hi,
+				  const ivec &dlo, const ivec &dhi) {
+  LOOP_OVER_DIRECTIONS(gv.dim, d)
+    if (lo.in_direction(d) > hi.in_direction(d)) return; // empty box
+  direction dw = NO_DIRECTION;
+  LOOP_OVER_DIRECTIONS(gv.dim, d)
+    if (dw == NO_DIRECTION || gv.stride(d) > gv.stride(dw)) dw = d;
+  const int np = gv.num_direction(dw) + 1;
+  const int ntot = gv.ntot();
+
+  plane_metals *metals[NUM_FIELD_TYPES];
+  FOR_FIELD_TYPES(ft)
+    metals[ft] = new plane_metals(zeroes[ft], num_zeroes[ft], f, ft,
+				  ntot, gv.stride(dw), np);
+
+  // the box of half step h, shrunk by h points (see wavefront_box)
+  ivec *hlo = new ivec[2*nblock], *hhi = new ivec[2*nblock];
+  for (int h = 0; h < 2*nblock; ++h) {
+    hlo[h] = lo + dlo * h;
+    hhi[h] = hi - dhi * h;
+  }
+
+  /* Step s (0 <= s < nblock) of B/H in plane p is done in sweep
+     q = p + 2s, and of D/E in sweep q = p + 2s + 1.  Within a sweep,
+     earlier steps come first, so that each plane of step s-1 is read
+     by step s before it is overwritten by step s+1. */
+  for (int q = 0; q < np + 2*nblock - 1; ++q)
+    for (int s = 0; s < nblock; ++s) {
+      step_plane(B_stuff, dw, q - 2*s, hlo[2*s], hhi[2*s], metals);
+      step_plane(D_stuff, dw, q - 2*s - 1, hlo[2*s+1], hhi[2*s+1], metals);
+    }
+
+  delete[] hlo;
+  delete[] hhi;
+  FOR_FIELD_TYPES(ft) delete metals[ft];
+}
+
+/* One half step (B then H, or D then E) of the fields in plane p of
+   direction dw and in the box lo..hi, as in step_db and update_eh for
+   the cases accepted by can_step_wavefront.  The polarizations are
+   zero in the box (see wavefront_box), so there is no D - P. */
+void fields_chunk::step_plane(field_type ft, direction dw, int p,
+			      const ivec &lo, const ivec &hi,
+			      plane_metals *metals[NUM_FIELD_TYPES]) {
+  if (p < 0 || p > gv.num_direction(dw)) return;
+  const field_type ft2 = ft == B_stuff ? H_stuff : E_stuff;
+
+  DOCMP FOR_FT_COMPONENTS(ft, cc) if (f[cc][cmp]) {
+    ivec is(gv.little_owned_corner0(cc)), ie(gv.big_corner());
+    if (!clip_to_plane(is, ie, gv, cc, dw, p)
+	|| !clip_to_box(gv, is, ie, lo, hi)) continue;
+    const direction d_c = component_direction(cc);
+    const bool have_p = have_plus_deriv[cc];
+    const bool have_m = have_minus_deriv[cc];
+    const direction dsig0 = cycle_direction(gv.dim,d_c,1);
+    const direction dsig = s->sigsize[dsig0] > 1 ? dsig0 : NO_DIRECTION;
+    const direction dsigu0 = cycle_direction(gv.dim,d_c,2);
+    const direction dsigu = s->sigsize[dsigu0] > 1 ? dsigu0 : NO_DIRECTION;
+    int stride_p = have_p?gv.stride(plus_deriv_direction[cc]):0;
+    int stride_m = have_m?gv.stride(minus_deriv_direction[cc]):0;
+    const realnum *f_p = have_p?f[plus_component[cc]][cmp]:NULL;
+    const realnum *f_m = have_m?f[minus_component[cc]][cmp]:NULL;
+    if (ft == D_stuff) { // strides are opposite sign for H curl
+      stride_p = -stride_p;
+      stride_m = -stride_m;
+    }
+    STEP_CURL(f[cc][cmp], is, ie, f_p, f_m, stride_p, stride_m, gv, Courant,
+	      dsig, s->sig[dsig], s->kap[dsig], s->siginv[dsig],
+	      f_u[cc][cmp], dsigu, s->sig[dsigu], s->kap[dsigu],
+	      s->siginv[dsigu], dt, s->conductivity[cc][d_c],
+	      s->condinv[cc][d_c], f_cond[cc][cmp]);
+  }
+  metals[ft]->zero(p);
+
+  DOCMP FOR_FT_COMPONENTS(ft2, ec) if (f[ec][cmp]) {
+    const component dc = field_type_component(ft, ec);
+    if (f[ec][cmp] == f[dc][cmp]) continue;
+    ivec is(gv.little_owned_corner(ec)), ie(gv.big_corner());
+    if (!clip_to_plane(is, ie, gv, ec, dw, p)
+	|| !clip_to_box(gv, is, ie, lo, hi)) continue;
+    const direction d_ec = component_direction(ec);
+    const direction dsigw = s->sigsize[d_ec] > 1 ? d_ec : NO_DIRECTION;
+    STEP_UPDATE_EDHB(f[ec][cmp], is, ie, gv, f[dc][cmp], NULL, NULL,
+		     NULL, 0, s->chi1inv[ec][d_ec], NULL, NULL,
+		     s->chi1inv_index8[ec], s->chi1inv_index16[ec],
+		     0, 0, 0, NULL, NULL,
+		     f_w[ec][cmp], dsigw, s->sig[dsigw], s->kap[dsigw]);
+  }
+  metals[ft2]->zero(p);
+}
+
+} // namespace meep
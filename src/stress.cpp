@@ -70,12 +70,20 @@ static void stress_sum(int Nfreq, double *F,
 {
   for (const dft_chunk *curF1 = F1, *curF2 = F2; curF1 && curF2;
        curF1 = curF1->next_in_dft, curF2 = curF2->next_in_dft) {
-    complex<realnum> extra_weight(real(curF1->extra_weight),
-				  imag(curF1->extra_weight));
-    for (int k = 0; k < curF1->N; ++k)
-      for (int i = 0; i < Nfreq; ++i)
-	F[i] += real(extra_weight * curF1->dft[k*Nfreq + i]
-		     * conj(curF2->dft[k*Nfreq + i]));  
+    if (!curF1->dft) continue; // placeholder for another process's chunk
+    curF1->flush_dft();
+    curF2->flush_dft();
+    const complex<double> extra_weight = curF1->extra_weight;
+    const double wr = real(extra_weight), wi = imag(extra_weight);
+    for (int k = 0; k < curF1->N; ++k) {
+      const double *f1 = curF1->dft + size_t(k) * 2*Nfreq;
+      const double *f2 = curF2->dft + size_t(k) * 2*Nfreq;
+      for (int i = 0; i < Nfreq; ++i) { // Re(extra_weight f1 conj(f2))
+	const double re = f1[i] * f2[i] + f1[Nfreq+i] * f2[Nfreq+i];
+	const double im = f1[Nfreq+i] * f2[i] - f1[i] * f2[Nfreq+i];
+	F[i] += wr * re - wi * im;
+      }
+    }
   }
 }
 
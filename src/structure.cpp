@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <typeinfo>
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
@@ -45,12 +46,12 @@ structure::structure(const grid_volume &thegv, material_function &eps,
 		     const boundary_region &br,
 		     const symmetry &s,
 		     int num, double Courant, bool use_anisotropic_averaging,
-		     double tol, int maxeval) :
+		     double tol, int maxeval, cost_model *costs) :
   Courant(Courant), v(D1) // Aaack, this is very hokey.
 {
   outdir = ".";
   if (!br.check_ok(thegv)) abort("invalid boundary absorbers for this grid_volume");
-  choose_chunkdivision(thegv, num, br, s);
+  choose_chunkdivision(thegv, num, br, s, &eps, costs);
   set_materials(eps, use_anisotropic_averaging, tol, maxeval);
 }
 
@@ -58,20 +59,27 @@ structure::structure(const grid_volume &thegv, double eps(const vec &),
 		     const boundary_region &br,
 		     const symmetry &s,
 		     int num, double Courant, bool use_anisotropic_averaging,
-		     double tol, int maxeval) :
+		     double tol, int maxeval, cost_model *costs) :
   Courant(Courant), v(D1) // Aaack, this is very hokey.
 {
   outdir = ".";
   if (!br.check_ok(thegv)) abort("invalid boundary absorbers for this grid_volume");
-  choose_chunkdivision(thegv, num, br, s);
   simple_material_function epsilon(eps);
+  choose_chunkdivision(thegv, num, br, s, &epsilon, costs);
   set_materials(epsilon, use_anisotropic_averaging, tol, maxeval);
 }
 
 void structure::choose_chunkdivision(const grid_volume &thegv, 
 				     int desired_num_chunks, 
 				     const boundary_region &br,
-				     const symmetry &s) {
+				     const symmetry &s,
+				     material_function *mat,
+				     cost_model *costs) {
+  cost_model default_costs;
+  if (!costs) {
+    default_costs.pml = 0.6; // the traditional PML effort (see cost_model)
+    costs = &default_costs;
+  }
   user_volume = thegv;
   if (desired_num_chunks == 0)
     desired_num_chunks = count_processors();
@@ -124,7 +132,28 @@ void structure::choose_chunkdivision(const grid_volume &thegv,
   effort[0] = 1.0;
 
   // Next, add effort volumes for PML boundary regions:
-  br.apply(this);
+  br.apply(this, costs->pml);
+
+  /* The chunks are cut along the effort volumes, to keep the PML in
+     chunks of its own, but the split is also balanced with the effort
+     of the materials etc., which does not cut the chunks: */
+  grid_volume *cost_volumes;
+  double *cost_effort;
+  const int num_cost_volumes =
+    costs->get_effort_volumes(gv, mat, &cost_volumes, &cost_effort);
+  const int num_split_volumes = num_effort_volumes + num_cost_volumes;
+  grid_volume *split_volumes = new grid_volume[num_split_volumes];
+  double *split_effort = new double[num_split_volumes];
+  for (int j = 0; j < num_effort_volumes; j++) {
+    split_volumes[j] = effort_volumes[j];
+    split_effort[j] = effort[j];
+  }
+  for (int j = 0; j < num_cost_volumes; j++) {
+    split_volumes[num_effort_volumes + j] = cost_volumes[j];
+    split_effort[num_effort_volumes + j] = cost_effort[j];
+  }
+  delete[] cost_volumes;
+  delete[] cost_effort;
 
   // Finally, create the chunks:
   num_chunks = 0;
@@ -132,7 +161,8 @@ void structure::choose_chunkdivision(const grid_volume &thegv,
   for (int i = 0; i < desired_num_chunks; i++) {
     const int proc = i * count_processors() / desired_num_chunks;
     grid_volume vi = gv.split_by_effort(desired_num_chunks, i,
-                                  num_effort_volumes, effort_volumes, effort);
+					num_split_volumes, split_volumes,
+					split_effort, costs->boundary);
     for (int j = 0; j < num_effort_volumes; j++) {
       grid_volume vc;
       if (vi.intersect_with(effort_volumes[j], &vc)) {
@@ -141,21 +171,23 @@ void structure::choose_chunkdivision(const grid_volume &thegv,
       }
     }
   }
+  delete[] split_volumes;
+  delete[] split_effort;
 
   check_chunks();
 }
 
-void boundary_region::apply(structure *s) const {
+void boundary_region::apply(structure *s, double pml_effort) const {
   if (has_direction(s->gv.dim, d) && s->user_volume.has_boundary(side, d)
       && s->user_volume.num_direction(d) > 1) {
     switch (kind) {
     case NOTHING_SPECIAL: break;
-    case PML: s->use_pml(d, side, thickness); break;
+    case PML: s->use_pml(d, side, thickness, pml_effort); break;
     default: abort("unknown boundary region kind");
     }
   }
   if (next)
-    next->apply(s);
+    next->apply(s, pml_effort);
 }
 
 void boundary_region::apply(const structure *s, structure_chunk *sc) const {
@@ -482,12 +514,95 @@ void structure::add_susceptibility(material_function &sigma, field_type ft, cons
     FOR_FT_COMPONENTS(ft,c) FOR_DIRECTIONS(d)
       newsus->trivial_sigma[c][d] = trivial_sigma_sync[c][d];
   }
+  merge_poles(ft);
+}
+
+// whether sus is a plain Lorentzian (or Drude), not a subclass thereof
+static bool is_lorentzian(const susceptibility *sus) {
+  return typeid(*sus) == typeid(lorentzian_susceptibility);
+}
+
+/* Return whether the sigma arrays of s1 are r times those of s2, at
+   the points where they are used, to within rounding.  If r is 0, set
+   it to the ratio of the first nonzero values, if any. */
+static bool proportional_sigma(const susceptibility *s1,
+			       const susceptibility *s2,
+			       const grid_volume &gv, double &r) {
+  const double tol = sizeof(realnum) == sizeof(float) ? 1e-6 : 1e-12;
+  FOR_COMPONENTS(c) FOR_DIRECTIONS(d) {
+    if (s1->trivial_sigma[c][d] != s2->trivial_sigma[c][d]) return false;
+    const realnum *a = s1->sigma[c][d], *b = s2->sigma[c][d];
+    if (!a && !b) continue;
+    if (!a || !b) return false;
+    LOOP_OVER_VOL(gv, c, i) {
+      if (r == 0 && b[i] != 0) r = a[i] / b[i];
+      if (fabs(a[i] - r * b[i]) > tol * fabs(a[i])) return false;
+    }
+  }
+  return true;
+}
+
+/* If the susceptibility just added to chiP[ft] and the previous one
+   are Lorentzians (or a multipole_susceptibility) whose sigma arrays
+   are proportional, replace them by one multipole_susceptibility, so
+   that update_P sweeps over W once for all the poles.  Since all the
+   chunks must have the same susceptibilities, this is decided
+   collectively, with the same factor on every chunk. */
+void structure::merge_poles(field_type ft) {
+  if (!num_chunks) return;
+  const susceptibility *sus = chunks[0]->chiP[ft];
+  if (!sus || !sus->next || !is_lorentzian(sus)) return;
+  const multipole_susceptibility *mp =
+    dynamic_cast<const multipole_susceptibility *>(sus->next);
+  if (!is_lorentzian(sus->next)
+      && (!mp || mp->num_poles() == MAX_POLES)) return;
+
+  double r = 0;
+  bool ok = true;
+  for (int i = 0; i < num_chunks && ok; i++)
+    if (chunks[i]->is_mine())
+      ok = proportional_sigma(chunks[i]->chiP[ft], chunks[i]->chiP[ft]->next,
+			      chunks[i]->gv, r);
+  if (!and_to_all(ok)) return;
+  const double rmax = max_to_all(r), rmin = -max_to_all(-r);
+  r = rmax != 0 ? rmax : rmin; // the chunks with sigma == 0 have r == 0
+  if (r == 0) return; // sigma is zero everywhere: nothing to merge
+  for (int i = 0; i < num_chunks && ok; i++)
+    if (chunks[i]->is_mine())
+      ok = proportional_sigma(chunks[i]->chiP[ft], chunks[i]->chiP[ft]->next,
+			      chunks[i]->gv, r);
+  if (!and_to_all(ok)) return;
+
+  multipole_susceptibility merged = mp ? *mp :
+    multipole_susceptibility(*(const lorentzian_susceptibility *) sus->next);
+  merged.add_pole(*(const lorentzian_susceptibility *) sus, r);
+  for (int i = 0; i < num_chunks; i++) {
+    susceptibility *cur = chunks[i]->chiP[ft], *prev = cur->next;
+    susceptibility *newsus = merged.clone();
+    newsus->ntot = prev->ntot;
+    FOR_COMPONENTS(c) FOR_DIRECTIONS(d) { // take over the sigma of prev
+      newsus->sigma[c][d] = prev->sigma[c][d];
+      newsus->trivial_sigma[c][d] = prev->trivial_sigma[c][d];
+      prev->sigma[c][d] = NULL;
+    }
+    newsus->next = prev->next;
+    prev->next = NULL;
+    delete cur; // also deletes prev
+    chunks[i]->chiP[ft] = newsus;
+  }
 }
 
-void structure::use_pml(direction d, boundary_side b, double dx) {
+void structure::use_pml(direction d, boundary_side b, double dx,
+			double effort) {
   if (dx <= 0.0) return;
+  /* The PML gets chunks of its own, so that the auxiliary PML fields
+     are only allocated (and the PML step_curl etc. only run) there.
+     The volume is just wide enough to own the points where
+     structure_chunk::use_pml finds a nonzero sigma (the 2*dx*a half
+     pixels nearest the boundary), so that the neighboring chunks
+     have no PML at all. */
   grid_volume pml_volume = gv;
-  pml_volume.set_num_direction(d, int(dx*user_volume.a + 1 + 0.5)); //FIXME: exact value?
+  pml_volume.set_num_direction(d, (int(dx*user_volume.a*2 + 0.5) + 1) / 2);
   if (b == High)
     pml_volume.set_origin(d, user_volume.big_corner().in_direction(d)
   			  - pml_volume.num_direction(d) * 2);
@@ -495,7 +610,7 @@ void structure::use_pml(direction d, boundary_side b, double dx) {
 			       - gv.little_corner().in_direction(d)) / 2;
   if (b == Low && v_to_user_shift != 0)
     pml_volume.set_num_direction(d, pml_volume.num_direction(d) + v_to_user_shift);
-  add_to_effort_volumes(pml_volume, 0.60); // FIXME: manual value for pml effort
+  add_to_effort_volumes(pml_volume, effort);
 }
 
 bool structure::has_chi(component c, direction d) const {
@@ -539,6 +654,8 @@ structure_chunk::~structure_chunk() {
     }
     delete[] chi2[c];
     delete[] chi3[c];
+    delete[] chi1inv_index8[c];
+    delete[] chi1inv_index16[c];
   }
   FOR_DIRECTIONS(d) { 
     delete[] sig[d];
@@ -549,6 +666,7 @@ structure_chunk::~structure_chunk() {
 }
 
 void structure_chunk::mix_with(const structure_chunk *n, double f) {
+  expand_chi1inv();
   FOR_COMPONENTS(c) FOR_DIRECTIONS(d) {
     if (!chi1inv[c][d] && n->chi1inv[c][d]) {
       chi1inv[c][d] = new realnum[gv.ntot()];
@@ -567,7 +685,7 @@ void structure_chunk::mix_with(const structure_chunk *n, double f) {
 	trivial_chi1inv[c][d] && n->trivial_chi1inv[c][d];
       if (n->chi1inv[c][d])
 	for (int i=0;i<gv.ntot();i++)
-	  chi1inv[c][d][i] += f*(n->chi1inv[c][d][i] - chi1inv[c][d][i]);
+	  chi1inv[c][d][i] += f*(n->chi1inv_at(c, d, i) - chi1inv[c][d][i]);
       else {
 	double nval = component_direction(c) == d ? 1.0 : 0.0; // default
 	for (int i=0;i<gv.ntot();i++)
@@ -585,6 +703,7 @@ void structure_chunk::mix_with(const structure_chunk *n, double f) {
     }
     condinv_stale = true;
   }
+  compress_chi1inv();
   // Mix in the susceptibility....FIXME.
 }
 
@@ -612,10 +731,13 @@ void structure_chunk::use_pml(direction d, double dx, double bloc,
 
   // Don't bother with PML if we don't even overlap with the PML region
   // ...note that we should calculate overlap in exactly the same
-  // way that "x > 0" is computed below.
+  // way that "x > 0" is computed below.  (The sigma arrays below also
+  // cover the point past big_corner, for the Yee-shifted components,
+  // but that point is never owned by this chunk, so we ignore it here;
+  // see structure::use_pml.)
   bool found_pml = false;
   for (int i=gv.little_corner().in_direction(d);
-       i<=gv.big_corner().in_direction(d)+1;++i)
+       i<=gv.big_corner().in_direction(d);++i)
     if (pml_x(i, dx, bloc, a) > 0) {
       found_pml = true;
       break;
@@ -712,11 +834,27 @@ structure_chunk::structure_chunk(const structure_chunk *o) : v(o->v) {
     }
   }
   FOR_COMPONENTS(c) FOR_DIRECTIONS(d) trivial_chi1inv[c][d] = true;
+  use_material_index = o->use_material_index;
+  FOR_COMPONENTS(c) {
+    chi1inv_rows[c] = is_mine() ? o->chi1inv_rows[c] : 0;
+    chi1inv_index8[c] = NULL;
+    chi1inv_index16[c] = NULL;
+    if (is_mine() && o->chi1inv_index8[c]) {
+      chi1inv_index8[c] = new unsigned char[gv.ntot()];
+      memcpy(chi1inv_index8[c], o->chi1inv_index8[c], gv.ntot());
+    }
+    if (is_mine() && o->chi1inv_index16[c]) {
+      chi1inv_index16[c] = new unsigned short[gv.ntot()];
+      memcpy(chi1inv_index16[c], o->chi1inv_index16[c],
+	     gv.ntot()*sizeof(unsigned short));
+    }
+  }
   FOR_COMPONENTS(c) FOR_DIRECTIONS(d) if (is_mine()) {
     trivial_chi1inv[c][d] = o->trivial_chi1inv[c][d];
     if (o->chi1inv[c][d]) {
-      chi1inv[c][d] = new realnum[gv.ntot()];
-      memcpy(chi1inv[c][d], o->chi1inv[c][d], gv.ntot()*sizeof(realnum));
+      const int n = chi1inv_rows[c] ? chi1inv_rows[c] : gv.ntot();
+      chi1inv[c][d] = new realnum[n];
+      memcpy(chi1inv[c][d], o->chi1inv[c][d], n*sizeof(realnum));
     } else chi1inv[c][d] = NULL;
     if (o->conductivity[c][d]) {
       conductivity[c][d] = new realnum[gv.ntot()];
@@ -739,11 +877,11 @@ structure_chunk::structure_chunk(const structure_chunk *o) : v(o->v) {
   if (is_mine())
     FOR_DIRECTIONS(d) 
       if (o->sig[d]) {
-	sig[d] = new double[2*gv.num_direction(d)+1];
-	kap[d] = new double[2*gv.num_direction(d)+1];
-	siginv[d] = new double[2*gv.num_direction(d)+1];
 	sigsize[d] = o->sigsize[d];
-	for (int i=0;i<2*gv.num_direction(d)+1;i++) {
+	sig[d] = new double[sigsize[d]];
+	kap[d] = new double[sigsize[d]];
+	siginv[d] = new double[sigsize[d]];
+	for (int i=0;i<sigsize[d];i++) {
 	  sig[d][i] = o->sig[d][i];
 	  kap[d][i] = o->kap[d][i];
 	  siginv[d][i] = o->siginv[d][i];
@@ -758,9 +896,11 @@ void structure_chunk::set_chi3(component c, material_function &epsilon) {
   epsilon.set_volume(gv.pad().surroundings());
 
   if (!chi1inv[c][component_direction(c)]) { // require chi1 if we have chi3
+    expand_chi1inv(c);
     chi1inv[c][component_direction(c)] = new realnum[gv.ntot()];
     for (int i = 0; i < gv.ntot(); ++i)
       chi1inv[c][component_direction(c)][i] = 1.0;
+    compress_chi1inv(c);
   }
 
   if (!chi3[c]) chi3[c] = new realnum[gv.ntot()];
@@ -794,9 +934,11 @@ void structure_chunk::set_chi2(component c, material_function &epsilon) {
   epsilon.set_volume(gv.pad().surroundings());
 
   if (!chi1inv[c][component_direction(c)]) { // require chi1 if we have chi2
+    expand_chi1inv(c);
     chi1inv[c][component_direction(c)] = new realnum[gv.ntot()];
     for (int i = 0; i < gv.ntot(); ++i)
       chi1inv[c][component_direction(c)][i] = 1.0;
+    compress_chi1inv(c);
   }
 
   if (!chi2[c]) chi2[c] = new realnum[gv.ntot()];
@@ -834,7 +976,7 @@ void structure_chunk::set_conductivity(component c, material_function &C) {
   direction c_d = component_direction(c);
   component c_C = is_electric(c) ? direction_component(Dx, c_d) :
     (is_magnetic(c) ? direction_component(Bx, c_d) : c);
-  realnum *multby = is_electric(c) || is_magnetic(c) ? chi1inv[c][c_d] : 0;
+  const bool multby = (is_electric(c) || is_magnetic(c)) && chi1inv[c][c_d];
   if (!conductivity[c_C][c_d]) 
     conductivity[c_C][c_d] = new realnum[gv.ntot()]; 
   if (!conductivity[c_C][c_d]) abort("Memory allocation error.\n");
@@ -843,7 +985,7 @@ void structure_chunk::set_conductivity(component c, material_function &C) {
   if (multby) {
     LOOP_OVER_VOL(gv, c_C, i) {
       IVEC_LOOP_LOC(gv, here);
-      cnd[i] = C.conductivity(c, here) * multby[i];
+      cnd[i] = C.conductivity(c, here) * chi1inv_at(c, c_d, i);
       trivial = trivial && (cnd[i] == 0.0);
     }
   }
@@ -879,6 +1021,12 @@ structure_chunk::structure_chunk(const grid_volume &thegv,
   // initialize materials arrays to NULL
   FOR_COMPONENTS(c) chi3[c] = NULL;
   FOR_COMPONENTS(c) chi2[c] = NULL;
+  FOR_COMPONENTS(c) {
+    chi1inv_index8[c] = NULL;
+    chi1inv_index16[c] = NULL;
+    chi1inv_rows[c] = 0;
+  }
+  use_material_index = false;
   FOR_COMPONENTS(c) FOR_DIRECTIONS(d) {
     trivial_chi1inv[c][d] = true;
     chi1inv[c][d] = NULL;
@@ -914,8 +1062,9 @@ double structure_chunk::max_eps() const {
   double themax = 0.0;
   FOR_COMPONENTS(c) { 
     direction d = component_direction(c); 
+    const int n = chi1inv_rows[c] ? chi1inv_rows[c] : gv.ntot();
     if (chi1inv[c][d])
-      for (int i=0;i<gv.ntot();i++) themax = max(themax,1/chi1inv[c][d][i]);
+      for (int i=0;i<n;i++) themax = max(themax,1/chi1inv[c][d][i]);
   }
   return themax;
 }
@@ -167,6 +167,9 @@ void *lorentzian_susceptibility::copy_internal_data(void *data) const {
   return (void*) dnew;
 }
 
+size_t lorentzian_susceptibility::size_internal_data(void *data) const {
+  return data ? ((lorentzian_data *) data)->sz_data : 0;
+}
 
 #define SWAP(t,a,b) { t SWAP_temp = a; a = b; b = SWAP_temp; }
 
@@ -261,6 +264,14 @@ void lorentzian_susceptibility::subtract_P(field_type ft,
   }
 }
 
+bool lorentzian_susceptibility::get_P_arrays(
+				    realnum *P[NUM_FIELD_COMPONENTS][2],
+				    void *P_internal_data) const {
+  lorentzian_data *d = (lorentzian_data *) P_internal_data;
+  FOR_COMPONENTS(c) DOCMP2 P[c][cmp] = d->P[c][cmp];
+  return true;
+}
+
 int lorentzian_susceptibility::num_cinternal_notowned_needed(component c,
 				   void *P_internal_data) const {
   lorentzian_data *d = (lorentzian_data *) P_internal_data;
@@ -303,4 +314,226 @@ void noisy_lorentzian_susceptibility::update_P
   }
 }
 
+/* multipole_susceptibility: the P and P_prev of the npoles poles at
+   each point n are interleaved, as P[c][cmp][n*2*npoles + k] and
+   P[c][cmp][n*2*npoles + npoles + k] for pole k, so that update_P
+   reads W (and sigma) only once for all the poles.  Psum[c][cmp] is
+   the sum of the P of the poles, which is what subtract_P subtracts
+   and what is communicated between chunks. */
+
+bool multipole_susceptibility::add_pole(double omega_0_, double gamma_,
+					bool no_omega_0_denominator_,
+					double strength_) {
+  if (npoles == MAX_POLES) return false;
+  omega_0[npoles] = omega_0_;
+  gamma[npoles] = gamma_;
+  no_omega_0_denominator[npoles] = no_omega_0_denominator_;
+  strength[npoles] = strength_;
+  ++npoles;
+  return true;
+}
+
+typedef struct {
+  size_t sz_data;
+  int ntot, npoles;
+  realnum *P[NUM_FIELD_COMPONENTS][2];
+  realnum *Psum[NUM_FIELD_COMPONENTS][2];
+  realnum data[1];
+} multipole_data;
+
+void *multipole_susceptibility::new_internal_data(
+			 realnum *W[NUM_FIELD_COMPONENTS][2],
+			 const grid_volume &gv) const {
+  int num = 0;
+  FOR_COMPONENTS(c) DOCMP2 if (needs_P(c, cmp, W))
+    num += (2 * npoles + 1) * gv.ntot();
+  size_t sz = sizeof(multipole_data) + sizeof(realnum) * (num - 1);
+  multipole_data *d = (multipole_data *) malloc(sz);
+  d->sz_data = sz;
+  return (void*) d;
+}
+
+// set the P/Psum pointers of d for the components where have[c][cmp]
+static void multipole_pointers(multipole_data *d,
+			       realnum *const have[NUM_FIELD_COMPONENTS][2]) {
+  const int ntot = d->ntot, n2 = 2 * d->npoles * ntot;
+  realnum *P = d->data;
+  FOR_COMPONENTS(c) DOCMP2 {
+    if (have[c][cmp]) {
+      d->P[c][cmp] = P;
+      d->Psum[c][cmp] = P + n2;
+      P += n2 + ntot;
+    }
+    else
+      d->P[c][cmp] = d->Psum[c][cmp] = NULL;
+  }
+}
+
+void multipole_susceptibility::init_internal_data(
+			  realnum *W[NUM_FIELD_COMPONENTS][2],
+			  double dt, const grid_volume &gv, void *data) const {
+  multipole_data *d = (multipole_data *) data;
+  size_t sz_data = d->sz_data;
+  memset(d, 0, sz_data);
+  d->sz_data = sz_data;
+  d->ntot = gv.ntot();
+  d->npoles = npoles;
+  realnum *have[NUM_FIELD_COMPONENTS][2];
+  FOR_COMPONENTS(c) DOCMP2 have[c][cmp] = needs_P(c, cmp, W) ? W[c][cmp] : 0;
+  multipole_pointers(d, have);
+
+  for (int k = 0; k < npoles; ++k)
+    if (!no_omega_0_denominator[k] && gamma[k] >= 0
+	&& lorentzian_unstable(omega_0[k], gamma[k], dt))
+      master_printf("Warning: Lorentzian may be unstable according to the Von Neumann stability analysis (omega_0=%g, gamma=%g, dt=%g). Proceed with caution.\n", omega_0[k], gamma[k], dt);
+}
+
+void *multipole_susceptibility::copy_internal_data(void *data) const {
+  multipole_data *d = (multipole_data *) data;
+  if (!d) return 0;
+  multipole_data *dnew = (multipole_data *) malloc(d->sz_data);
+  memcpy(dnew, d, d->sz_data);
+  multipole_pointers(dnew, d->P);
+  return (void*) dnew;
+}
+
+size_t multipole_susceptibility::size_internal_data(void *data) const {
+  return data ? ((multipole_data *) data)->sz_data : 0;
+}
+
+/* The update of the K poles at the points of c, as in
+   lorentzian_susceptibility::update_P, with the coefficients of pole
+   k (including its strength) in cf[k], cf[K+k], cf[2K+k] and
+   cf[3K+k].  K and NOFF (the number of off-diagonal sigma terms) are
+   template parameters, so that the loop over the poles is unrolled
+   and vectorized in the isotropic case. */
+template <int K, int NOFF>
+static void update_poles(realnum *P, realnum *Psum, const double *cf,
+			 const realnum *w, const realnum *s,
+			 const realnum *w1, const realnum *s1, int is1,
+			 const realnum *w2, const realnum *s2, int is2,
+			 int is, component c, const grid_volume &gv) {
+  const double *gamma1inv = cf, *twominus = cf + K;
+  const double *gamma1 = cf + 2*K, *omega0dtsqr = cf + 3*K;
+  LOOP_OVER_VOL_OWNED(gv, c, i) {
+    double sw = s[i] * w[i];
+    if (NOFF >= 1) sw += OFFDIAG(s1,w1,is1,is);
+    if (NOFF >= 2) sw += OFFDIAG(s2,w2,is2,is);
+    realnum *p = P + i * (2*K), *pp = p + K;
+    double psum = 0;
+    for (int k = 0; k < K; ++k) {
+      const realnum pcur = p[k];
+      p[k] = gamma1inv[k] * (pcur * twominus[k] - gamma1[k] * pp[k]
+			     + omega0dtsqr[k] * sw);
+      pp[k] = pcur;
+      psum += p[k];
+    }
+    Psum[i] = psum;
+  }
+}
+
+typedef void (*update_poles_func)(realnum *P, realnum *Psum, const double *cf,
+				  const realnum *w, const realnum *s,
+				  const realnum *w1, const realnum *s1, int is1,
+				  const realnum *w2, const realnum *s2, int is2,
+				  int is, component c, const grid_volume &gv);
+
+#define UPDATE_POLES(K) \
+  { update_poles<K,0>, update_poles<K,1>, update_poles<K,2> }
+static const update_poles_func update_poles_kernels[MAX_POLES][3] = {
+  UPDATE_POLES(1), UPDATE_POLES(2), UPDATE_POLES(3), UPDATE_POLES(4),
+  UPDATE_POLES(5), UPDATE_POLES(6), UPDATE_POLES(7), UPDATE_POLES(8)
+};
+
+void multipole_susceptibility::update_P
+       (realnum *W[NUM_FIELD_COMPONENTS][2],
+	realnum *W_prev[NUM_FIELD_COMPONENTS][2], 
+	double dt, const grid_volume &gv, void *P_internal_data) const {
+  multipole_data *d = (multipole_data *) P_internal_data;
+  (void) W_prev; // unused;
+  if (!npoles) return;
+
+  double cf[4 * MAX_POLES];
+  for (int k = 0; k < npoles; ++k) {
+    const double omega2pi = 2*pi*omega_0[k], g2pi = gamma[k]*2*pi;
+    const double omega0dtsqr = omega2pi * omega2pi * dt * dt;
+    cf[k] = 1 / (1 + g2pi*dt/2);
+    cf[npoles + k] = 2 - (no_omega_0_denominator[k] ? 0 : omega0dtsqr);
+    cf[2*npoles + k] = 1 - g2pi*dt/2;
+    cf[3*npoles + k] = omega0dtsqr * strength[k];
+  }
+
+  FOR_COMPONENTS(c) DOCMP2 if (d->P[c][cmp]) {
+    const realnum *w = W[c][cmp], *s = sigma[c][component_direction(c)];
+    if (w && s) {
+      realnum *p = d->P[c][cmp], *psum = d->Psum[c][cmp];
+
+      // directions/strides for offdiagonal terms, similar to update_eh
+      const direction d = component_direction(c);
+      const int is = gv.stride(d) * (is_magnetic(c) ? -1 : +1);
+      direction d1 = cycle_direction(gv.dim, d, 1);
+      component c1 = direction_component(c, d1);
+      int is1 = gv.stride(d1) * (is_magnetic(c) ? -1 : +1);
+      const realnum *w1 = W[c1][cmp];
+      const realnum *s1 = w1 ? sigma[c][d1] : NULL;
+      direction d2 = cycle_direction(gv.dim, d, 2);
+      component c2 = direction_component(c, d2);
+      int is2 = gv.stride(d2) * (is_magnetic(c) ? -1 : +1);
+      const realnum *w2 = W[c2][cmp];
+      const realnum *s2 = w2 ? sigma[c][d2] : NULL;
+
+      if (s2 && !s1) { // make s1 the non-NULL one if possible
+	SWAP(direction, d1, d2);
+	SWAP(component, c1, c2);
+	SWAP(int, is1, is2);
+	SWAP(const realnum *, w1, w2);
+	SWAP(const realnum *, s1, s2);
+      }
+      update_poles_kernels[npoles-1][s2 ? 2 : (s1 ? 1 : 0)]
+	(p, psum, cf, w, s, w1, s1, is1, w2, s2, is2, is, c, gv);
+    }
+  }
+}
+
+void multipole_susceptibility::subtract_P(field_type ft,
+					  realnum *f_minus_p[NUM_FIELD_COMPONENTS][2], 
+					  void *P_internal_data) const {
+  multipole_data *d = (multipole_data *) P_internal_data;
+  field_type ft2 = ft == E_stuff ? D_stuff : B_stuff; // for sources etc.
+  int ntot = d->ntot;
+  FOR_FT_COMPONENTS(ft, ec) DOCMP2 if (d->Psum[ec][cmp]) {
+    component dc = field_type_component(ft2, ec);
+    if (f_minus_p[dc][cmp]) {
+      realnum *p = d->Psum[ec][cmp];
+      realnum *fmp = f_minus_p[dc][cmp];
+      for (int i = 0; i < ntot; ++i) fmp[i] -= p[i];
+    }
+  }
+}
+
+bool multipole_susceptibility::get_P_arrays(
+				    realnum *P[NUM_FIELD_COMPONENTS][2],
+				    void *P_internal_data) const {
+  multipole_data *d = (multipole_data *) P_internal_data;
+  FOR_COMPONENTS(c) DOCMP2 P[c][cmp] = d->Psum[c][cmp];
+  return true;
+}
+
+int multipole_susceptibility::num_cinternal_notowned_needed(component c,
+				   void *P_internal_data) const {
+  multipole_data *d = (multipole_data *) P_internal_data;
+  return d->Psum[c][0] ? 1 : 0;
+}
+
+realnum *multipole_susceptibility::cinternal_notowned_ptr(
+				        int inotowned, component c, int cmp, 
+					int n, 
+					void *P_internal_data) const {
+  multipole_data *d = (multipole_data *) P_internal_data;
+  (void) inotowned; // always = 0
+  if (!d || !d->Psum[c][cmp])
+    return NULL;
+  return d->Psum[c][cmp] + n;
+}
+
 } // namespace meep
@@ -68,6 +68,11 @@ void fields::print_times() {
   master_printf("\nField time usage:\n");
   for (int i=0;i<=Other;i++)
     pt(times_spent, (time_sink) i);
+  /* With use_comm_overlap, "communicating" is only the exposed part of
+     the communication, and this is how long messages were in flight
+     while we were time stepping (an upper bound on the hidden part). */
+  if (comm_overlap_time)
+    master_printf("    %18s: %g s\n", "comm. overlapped", comm_overlap_time);
   master_printf("\n");
 }
 
@@ -26,14 +26,18 @@ namespace meep {
   
 void fields::update_eh(field_type ft, bool skip_w_components) {
   if (ft != E_stuff && ft != H_stuff) abort("update_eh only works with E/H");
+  bool allocated = false;
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1) reduction(||:allocated)
+#endif
   for (int i=0;i<num_chunks;i++)
-    if (chunks[i]->is_mine())
+    if (chunks[i]->is_mine()) {
+      const double start = wall_time();
       if (chunks[i]->update_eh(ft, skip_w_components))
-	chunk_connections_valid = false; // E/H allocated - reconnect chunks 
-
-  /* synchronize to avoid deadlocks if one process decides it needs
-     to allocate E or H ... */
-  chunk_connections_valid = and_to_all(chunk_connections_valid);
+	allocated = true;
+      chunks[i]->work_time += wall_time() - start;
+    }
+  sync_chunk_connections(allocated); // reconnect chunks if allocated
 }
 
 bool fields_chunk::needs_W_prev(component c) const
@@ -43,6 +47,75 @@ bool fields_chunk::needs_W_prev(component c) const
   return false;
 }
 
+/* Whether step_db, update_eh or update_pols might still report an
+   allocation (their return values) for this chunk.  This may err on
+   the side of true, which merely costs a collective per half step
+   until the next reconnection; see fields::connect_chunks. */
+bool fields_chunk::may_allocate() {
+  DOCMP FOR_COMPONENTS(cc) if (f[cc][cmp] && (is_B(cc) || is_D(cc))) {
+    const direction dsigu = cycle_direction(gv.dim, component_direction(cc), 2);
+    if (s->sigsize[dsigu] > 1 && !f_u[cc][cmp]) return true; // step_db
+  }
+
+  for (int i = 0; i < 2; ++i) { // update_eh
+    const field_type ft = i ? H_stuff : E_stuff;
+    const field_type ft2 = i ? B_stuff : D_stuff;
+    bool have_f_minus_p = false;
+    for (src_vol *sv = sources[ft2]; sv; sv = sv->next)
+      if (sv->t->is_integrated) have_f_minus_p = true;
+    DOCMP FOR_FT_COMPONENTS(ft, ec) if (f[ec][cmp]) {
+      if (f_minus_p[field_type_component(ft2, ec)][cmp]) have_f_minus_p = true;
+      for (polarization_state *p = pol[ft]; p; p = p->next)
+	if (p->s->needs_P(ec, cmp, f)) have_f_minus_p = true;
+    }
+    DOCMP FOR_FT_COMPONENTS(ft, ec) if (f[ec][cmp]) {
+      const component dc = field_type_component(ft2, ec);
+      const direction d_ec = component_direction(ec);
+      const bool dsigw = s->sigsize[d_ec] > 1;
+      if (f[ec][cmp] == f[dc][cmp]
+	  && (s->chi1inv[ec][d_ec] || have_f_minus_p || dsigw))
+	return true;
+      if (!f_w[ec][cmp] && dsigw && needs_W_notowned(ec))
+	return true;
+    }
+  }
+
+  FOR_FIELD_TYPES(ft) // update_pols
+    for (polarization_state *p = pol[ft]; p; p = p->next)
+      if (!p->data) return true;
+  return false;
+}
+
+/* With only Lorentzian-type polarizations (see
+   susceptibility::get_P_arrays), no integrated sources, and a diagonal
+   chi1inv without chi2/chi3, step_update_EDHB can subtract the
+   polarizations from D itself, so that we need not form D - P in
+   f_minus_p first.  In that case, return true and set Ps[ec][cmp] to
+   the nP[ec][cmp] arrays to subtract from the D of ec. */
+static bool fuse_P(const fields_chunk *fc, field_type ft,
+		   bool have_int_sources,
+		   const realnum *Ps[NUM_FIELD_COMPONENTS][2][MAX_FUSED_P],
+		   int nP[NUM_FIELD_COMPONENTS][2]) {
+  FOR_COMPONENTS(c) DOCMP2 nP[c][cmp] = 0;
+  if (have_int_sources) return false;
+  const structure_chunk *s = fc->s;
+  FOR_FT_COMPONENTS(ft, ec) if (fc->f[ec][0]) {
+    if (s->chi2[ec] || s->chi3[ec]) return false;
+    FOR_DIRECTIONS(d)
+      if (d != component_direction(ec) && s->chi1inv[ec][d]) return false;
+  }
+  for (polarization_state *p = fc->pol[ft]; p; p = p->next)
+    if (p->data) {
+      realnum *P[NUM_FIELD_COMPONENTS][2];
+      if (!p->s->get_P_arrays(P, p->data)) return false;
+      FOR_FT_COMPONENTS(ft, ec) DOCMP2 if (P[ec][cmp]) {
+	if (nP[ec][cmp] == MAX_FUSED_P) return false;
+	Ps[ec][cmp][nP[ec][cmp]++] = P[ec][cmp];
+      }
+    }
+  return true;
+}
+
 bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
   field_type ft2 = ft == E_stuff ? D_stuff : B_stuff; // for sources etc.
   bool allocated_eh = false;
@@ -56,6 +129,12 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
       }
   }
 
+  const realnum *Ps[NUM_FIELD_COMPONENTS][2][MAX_FUSED_P];
+  int nP[NUM_FIELD_COMPONENTS][2];
+  const bool fused = fuse_P(this, ft, have_int_sources, Ps, nP);
+  if (!fused) FOR_COMPONENTS(c) DOCMP2 nP[c][cmp] = 0;
+
+  bool have_f_minus_p = false; // whether E/H is computed from D/B - P
   FOR_FT_COMPONENTS(ft, ec) {
     component dc = field_type_component(ft2, ec);
     DOCMP {
@@ -65,7 +144,8 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
 	for (polarization_state *p = pol[ft]; p && !need_fmp; p = p->next)
 	  need_fmp = need_fmp || p->s->needs_P(ec, cmp, f);
       }
-      if (need_fmp) {
+      if (need_fmp && !cmp) have_f_minus_p = true;
+      if (need_fmp && !fused) {
 	if (!f_minus_p[dc][cmp]) f_minus_p[dc][cmp] = new realnum[gv.ntot()];
       }
       else if (f_minus_p[dc][cmp]) { // remove unneeded f_minus_p
@@ -74,11 +154,6 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
       }
     }
   }
-  bool have_f_minus_p = false;
-  FOR_FT_COMPONENTS(ft2, dc) if (f_minus_p[dc][0]) {
-    have_f_minus_p = true;
-    break;
-  }
 
   const int ntot = s->gv.ntot();
 
@@ -96,14 +171,15 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
     }
   }
 
-  for (polarization_state *p = pol[ft]; p; p = p->next)
-    if (p->data)
-      p->s->subtract_P(ft, f_minus_p, p->data);
+  if (!fused)
+    for (polarization_state *p = pol[ft]; p; p = p->next)
+      if (p->data)
+	p->s->subtract_P(ft, f_minus_p, p->data);
 
   //////////////////////////////////////////////////////////////////////////
   // Next, subtract time-integrated sources (i.e. polarizations, not currents)
 
-  if (have_f_minus_p && !doing_solve_cw) {
+  if (have_f_minus_p && !fused && !doing_solve_cw) {
     for (src_vol *sv = sources[ft2]; sv; sv = sv->next) {  
       if (sv->t->is_integrated && f[sv->c][0] && ft == type(sv->c)) {
 	component c = field_type_component(ft2, sv->c);
@@ -121,6 +197,9 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
   //////////////////////////////////////////////////////////////////////////
   // Finally, compute E = chi1inv * D
   
+  ivec slo, shi; // see fields::step_wavefront
+  const bool skip = skip_box(ft, slo, shi);
+
   realnum *dmp[NUM_FIELD_COMPONENTS][2];
   FOR_FT_COMPONENTS(ft2,dc) DOCMP2
       dmp[dc][cmp] = f_minus_p[dc][cmp] ? f_minus_p[dc][cmp] : f[dc][cmp];
@@ -165,10 +244,18 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
 	     sizeof(realnum) * gv.ntot());
     }
 
-    if (f[ec][cmp] != f[dc][cmp])
-      STEP_UPDATE_EDHB(f[ec][cmp], ec, gv, 
+    if (f[ec][cmp] == f[dc][cmp]) continue;
+    // all of the owned points, or those outside of the skipped box
+    ivec is[10], ie[10];
+    int nbox = 1;
+    is[0] = gv.little_owned_corner(ec); ie[0] = gv.big_corner();
+    if (skip) nbox = subtract_box(gv, is[0], ie[0], slo, shi, is, ie);
+    for (int k = 0; k < nbox; ++k)
+      STEP_UPDATE_EDHB(f[ec][cmp], is[k], ie[k], gv,
 		       dmp[dc][cmp], dmp[dc_1][cmp], dmp[dc_2][cmp],
+		       Ps[ec][cmp], nP[ec][cmp],
 		       s->chi1inv[ec][d_ec], dmp[dc_1][cmp]?s->chi1inv[ec][d_1]:NULL, dmp[dc_2][cmp]?s->chi1inv[ec][d_2]:NULL,
+		       s->chi1inv_index8[ec], s->chi1inv_index16[ec],
 		       s_ec, s_1, s_2, s->chi2[ec], s->chi3[ec],
 		       f_w[ec][cmp], dsigw, s->sig[dsigw], s->kap[dsigw]);
   }
@@ -188,17 +275,13 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
       const int sR = gv.stride(R), nZ = gv.num_direction(Z);
       realnum *E = f[ec][cmp];
       const realnum *D = f_minus_p[dc][cmp] ? f_minus_p[dc][cmp] : f[dc][cmp];
-      const realnum *chi1inv = s->chi1inv[ec][d_ec];
-      if (chi1inv)
-	for (int iZ=0; iZ<nZ; iZ++) {
-	  const int i = yee_idx + iZ - sR;
-	  E[i] = chi1inv[i] * D[i];
-	}
-      else
-	for (int iZ=0; iZ<nZ; iZ++) {
-	  const int i = yee_idx + iZ - sR;
-	  E[i] = D[i];
-	}
+      for (int iZ=0; iZ<nZ; iZ++) {
+	const int i = yee_idx + iZ - sR;
+	double Di = D[i];
+	for (int k = 0; k < nP[ec][cmp]; ++k) Di = Di - Ps[ec][cmp][k][i];
+	E[i] = s->chi1inv[ec][d_ec] ?
+	  s->chi1inv_at(ec, direction(d_ec), i) * Di : Di;
+      }
     }
   
   return allocated_eh;
@@ -28,14 +28,18 @@ using namespace std;
 namespace meep {
 
 void fields::update_pols(field_type ft) {
+  bool allocated = false;
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic,1) reduction(||:allocated)
+#endif
   for (int i=0;i<num_chunks;i++)
-    if (chunks[i]->is_mine())
+    if (chunks[i]->is_mine()) {
+      const double start = wall_time();
       if (chunks[i]->update_pols(ft))
-	chunk_connections_valid = false;
-
-  /* synchronize to avoid deadlocks if one process decides it needs
-     to allocate E or H ... */
-  chunk_connections_valid = and_to_all(chunk_connections_valid);
+	allocated = true;
+      chunks[i]->work_time += wall_time() - start;
+    }
+  sync_chunk_connections(allocated);
 }
 
 bool fields_chunk::update_pols(field_type ft) {
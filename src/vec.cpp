@@ -941,49 +941,89 @@ grid_volume grid_volume::split(int n, int which) const {
     return split_at_fraction(true, split_point).split(n-num_low,which-num_low);
 }
 
-grid_volume grid_volume::split_by_effort(int n, int which, int Ngv, const grid_volume *v, double *effort) const {
+/* Split into n parts of (nearly) equal effort, where effort[j] is the
+   effort per grid point in v[j] (the v[j] may overlap, in which case
+   their efforts add), or 1 everywhere if Ngv == 0.  We try splitting
+   along every direction, longest first so that it wins ties, and
+   boundary_effort per point of the new interface between the two
+   halves is added to favor small interfaces. */
+grid_volume grid_volume::split_by_effort(int n, int which, int Ngv, const grid_volume *v, double *effort, double boundary_effort) const {
   const int grid_points_owned = nowned_min();
   if (n > grid_points_owned)
     abort("Cannot split %d grid points into %d parts\n", nowned_min(), n);
   if (n == 1) return *this;
-  int biglen = 0;
-  direction splitdir = NO_DIRECTION;
-  LOOP_OVER_DIRECTIONS(dim, d) if (num_direction(d) > biglen) { biglen = num_direction(d); splitdir = d; } 
+
+  direction dirs[3];
+  int ndirs = 0;
+  LOOP_OVER_DIRECTIONS(dim, d) {
+    int i = ndirs++;
+    for (; i > 0 && num_direction(dirs[i-1]) < num_direction(d); --i)
+      dirs[i] = dirs[i-1];
+    dirs[i] = d;
+  }
+
   double best_split_measure = 1e20, left_effort_fraction = 0;
   int best_split_point = 0;
-  vec corner = zero_vec(dim);
-  LOOP_OVER_DIRECTIONS(dim, d) corner.set_direction(d, origin.in_direction(d) + num_direction(d)/a); 
-
-  for (int split_point = 1; split_point < biglen; split_point+=1) {
-    grid_volume v_left = *this;
-    v_left.set_num_direction(splitdir, split_point);
-    grid_volume v_right = *this;
-    v_right.set_num_direction(splitdir, num_direction(splitdir) - split_point);
-    v_right.shift_origin(splitdir, split_point*2);
-
-    double total_left_effort = 0, total_right_effort = 0;
-    grid_volume vol;
-    if (Ngv == 0) {
-      total_left_effort = v_left.ntot();
-      total_right_effort = v_right.ntot();
-    }
-    else {
-      for (int j = 0; j<Ngv; j++) {
-	if (v_left.intersect_with(v[j], &vol))
-	  total_left_effort += effort[j] * vol.ntot();
-	if (v_right.intersect_with(v[j], &vol))
-	  total_right_effort += effort[j] * vol.ntot();
+  direction splitdir = NO_DIRECTION;
+  for (int id = 0; id < ndirs; ++id) {
+    const direction d = dirs[id];
+    const int len = num_direction(d);
+    if (len < 2) continue;
+
+    /* total_left_effort[s] (total_right_effort[s]) is the effort of the
+       part below (above) split point s, computed as the sum over the
+       intersections with v[j] of effort[j] * ntot() */
+    double *total_left_effort = new double[len];
+    double *total_right_effort = new double[len];
+    for (int s = 0; s < len; ++s) total_left_effort[s] = total_right_effort[s] = 0;
+    const int lo = little_corner().in_direction(d);
+    const int hi = big_corner().in_direction(d);
+    for (int j = 0; j < max(Ngv, 1); j++) {
+      const grid_volume &vj = Ngv ? v[j] : *this;
+      int cross = 1;
+      LOOP_OVER_DIRECTIONS(dim, dd) if (dd != d) {
+	const int minval = max(little_corner().in_direction(dd),
+			       vj.little_corner().in_direction(dd));
+	const int maxval = min(big_corner().in_direction(dd),
+			       vj.big_corner().in_direction(dd));
+	cross *= minval < maxval ? (maxval - minval)/2 + 1 : 0;
+      }
+      if (cross == 0) continue;
+      const double e = Ngv ? effort[j] : 1.0;
+      const int jlo = vj.little_corner().in_direction(d);
+      const int jhi = vj.big_corner().in_direction(d);
+      for (int s = 1; s < len; ++s) {
+	const int mid = lo + 2*s;
+	int minval = max(lo, jlo), maxval = min(mid, jhi);
+	if (minval < maxval)
+	  total_left_effort[s] += e * (cross * ((maxval - minval)/2 + 1));
+	minval = max(mid, jlo); maxval = min(hi, jhi);
+	if (minval < maxval)
+	  total_right_effort[s] += e * (cross * ((maxval - minval)/2 + 1));
       }
     }
-    double split_measure = max(total_left_effort/(n/2), total_right_effort/(n-n/2));
-    if (split_measure < best_split_measure) {
-      best_split_measure = split_measure;
-      best_split_point = split_point;
-      left_effort_fraction = total_left_effort/(total_left_effort + total_right_effort);
+
+    double interface_area = 1;
+    LOOP_OVER_DIRECTIONS(dim, dd) if (dd != d) interface_area *= num_direction(dd);
+    for (int s = 1; s < len; ++s) {
+      double split_measure = max(total_left_effort[s]/(n/2),
+				 total_right_effort[s]/(n-n/2))
+	+ boundary_effort * interface_area;
+      if (split_measure < best_split_measure) {
+	best_split_measure = split_measure;
+	best_split_point = s;
+	splitdir = d;
+	left_effort_fraction = total_left_effort[s]
+	  / (total_left_effort[s] + total_right_effort[s]);
+      }
     }
+    delete[] total_left_effort;
+    delete[] total_right_effort;
   }
+  if (splitdir == NO_DIRECTION) return split(n, which);
   const int split_point = best_split_point;
-    
+  const int biglen = num_direction(splitdir);
+
   const int num_low = (int)(left_effort_fraction *n + 0.5);
   // Revert to split() when effort method gives less grid points than chunks
   if (num_low > best_split_point*(grid_points_owned/biglen) || 
@@ -991,9 +1031,23 @@ grid_volume grid_volume::split_by_effort(int n, int which, int Ngv, const grid_v
     return split(n, which);
 
   if (which < num_low)
-    return split_at_fraction(false, split_point).split_by_effort(num_low,which, Ngv,v,effort);
+    return split_at_fraction(false, split_point, splitdir).split_by_effort(num_low,which, Ngv,v,effort,boundary_effort);
+  else
+    return split_at_fraction(true, split_point, splitdir).split_by_effort(n-num_low,which-num_low, Ngv,v,effort,boundary_effort);
+}
+
+// as split_at_fraction, but splitting along direction d
+grid_volume grid_volume::split_at_fraction(bool want_high, int numer, direction d) const {
+  if (numer <= 0 || numer >= num_direction(d))
+    abort("Aaack bad bug in split_at_fraction.\n");
+  grid_volume retval(*this);
+  if (want_high) {
+    retval.shift_origin(d, numer*2);
+    retval.set_num_direction(d, num_direction(d) - numer);
+  }
   else
-    return split_at_fraction(true, split_point).split_by_effort(n-num_low,which-num_low, Ngv,v,effort);
+    retval.set_num_direction(d, numer);
+  return retval;
 }
 
 grid_volume grid_volume::split_at_fraction(bool want_high, int numer) const {
@@ -209,6 +209,12 @@ bench bench_2d_te_nonlinear(const double xmax, const double ymax,
                   name, b.time, b.time*1e6/b.gridsteps); \
   }
 
+// a benchmark b of an optimization, with its speedup over the baseline b0
+void show_speedup(const char *name, const bench &b0, const bench &b) {
+  master_printf("bench:, %s, %g, %g, speedup %g\n", name, b.time,
+                b.time*1e6/b.gridsteps, b0.time / b.time);
+}
+
 // 3D benchmarks:
 
 inline double max(double a, double b) { return (a>b)?a:b; }
@@ -260,6 +266,154 @@ bench bench_3d(const double xmax, const double ymax, const double zmax,
   return b;
 }
 
+// 3D vacuum cell, optionally with PML, stepped with the given tile size
+// (0 = untiled) for the curl updates; see fields::use_tiling
+bench bench_3d_tiled(const double xmax, const double ymax, const double zmax,
+                     double eps(const vec &), double dpml, int tile_size) {
+  const double a = 10.0;
+  const double gridpts = a*a*a*xmax*ymax*zmax;
+  const double ttot = 5.0 + 1e5/gridpts;
+
+  grid_volume gv = vol3d(xmax,ymax,zmax,a);
+  structure s(gv, eps, dpml > 0 ? pml(dpml) : no_pml());
+  fields f(&s);
+  f.use_tiling(tile_size);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(xmax*.5, ymax*.5, zmax*.5));
+
+  while (f.time() < f.last_source_time()) f.step();
+  const double tend = f.time() + ttot;
+  double start = wall_time();
+  while (f.time() < tend) f.step();
+  bench b;
+  b.time = (wall_time() - start);
+  b.gridsteps = ttot*a*2*gridpts;
+  return b;
+}
+
+
+// 3D vacuum cell with metal walls, stepped after the source is off, or
+// (dpml > 0) with PML, a source that stays on and a flux plane, stepped
+// block steps at a time (1 = ordinary stepping); see fields::step_wavefront
+bench bench_3d_wavefront(const double xmax, const double ymax,
+                         const double zmax, double eps(const vec &),
+                         double dpml, int block) {
+  const double a = 10.0;
+  const double gridpts = a*a*a*xmax*ymax*zmax;
+  const double ttot = 5.0 + 1e5/gridpts;
+
+  grid_volume gv = vol3d(xmax,ymax,zmax,a);
+  structure s(gv, eps, dpml > 0 ? pml(dpml) : no_pml());
+  fields f(&s);
+  const vec center(xmax*.5, ymax*.5, zmax*.5);
+  if (dpml > 0) {
+    f.add_point_source(Ez, continuous_src_time(0.8), center);
+    f.add_dft_flux_plane(volume(vec(dpml, dpml, zmax - dpml - 0.2),
+                                vec(xmax - dpml, ymax - dpml, zmax - dpml - 0.2)),
+                         0.7, 0.9, 10);
+    f.step();
+  }
+  else {
+    f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, center);
+    while (f.time() <= f.last_source_time()) f.step();
+  }
+  const int nsteps = int(ttot / f.dt);
+  double start = wall_time();
+  f.step_wavefront(nsteps, block);
+  bench b;
+  b.time = (wall_time() - start);
+  b.gridsteps = nsteps*2*gridpts;
+  return b;
+}
+
+
+// 2D cell filled with an L-level (L <= 4) gain medium, using the
+// batched population update or the generic one-voxel-at-a-time loop
+bench bench_2d_multilevel(const double xmax, const double ymax,
+                          int L, bool batched) {
+  const double a = 10.0;
+  const double gridpts = a*a*xmax*ymax;
+  const double ttot = 5.0 + 1e5/gridpts;
+
+  const int T = L - 1;
+  realnum Gamma[16], N0[4], alpha[12], omega[3], gamma[3], sigmat[15];
+  for (int i = 0; i < L*L; ++i) Gamma[i] = 0;
+  for (int i = 0; i < L*T; ++i) alpha[i] = 0;
+  Gamma[0] = 0.01; Gamma[(L-1)*L] = -0.01; // pump 0 -> L-1
+  for (int l = 1; l < L; ++l) { // decay l -> l-1
+    Gamma[l*L + l] += 0.05;
+    Gamma[(l-1)*L + l] -= 0.05;
+  }
+  for (int t = 0; t < T; ++t) {
+    alpha[t*T + t] = 1.0;
+    alpha[(t+1)*T + t] = -1.0;
+    omega[t] = 0.8;
+    gamma[t] = 0.1;
+    for (int i = 0; i < 5; ++i) sigmat[t*5 + i] = 1.0;
+  }
+  for (int l = 0; l < L; ++l) N0[l] = l == 0;
+  multilevel_susceptibility atom(L, T, Gamma, N0, alpha, omega, gamma, sigmat);
+  atom.batched = batched;
+
+  grid_volume gv = voltwo(xmax,ymax,a);
+  structure s(gv, one);
+  s.add_susceptibility(one, E_stuff, atom);
+  fields f(&s);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.401, 0.301));
+  f.add_point_source(Hz, 0.8, 0.7, 0.0, 4.0, vec(0.431, 0.2));
+
+  while (f.time() < f.last_source_time()) f.step();
+  const double tend = f.time() + ttot;
+  double start = wall_time();
+  while (f.time() < tend) f.step();
+  bench b;
+  b.time = (wall_time() - start);
+  b.gridsteps = ttot*a*2*gridpts;
+  return b;
+}
+
+
+// 2D cell with a flux box of Nfreq frequencies around the source,
+// with the DFTs accumulated batch timesteps at a time and decimated
+// with the given Nyquist margin (0 = no decimation)
+bench bench_2d_dft(const double xmax, const double ymax, int Nfreq,
+                   int batch, double margin = 0) {
+  const double a = 10.0;
+  const double gridpts = a*a*xmax*ymax;
+  const double ttot = 5.0 + 1e5/gridpts;
+
+  grid_volume gv = voltwo(xmax,ymax,a);
+  structure s(gv, one);
+  fields f(&s);
+  f.use_real_fields();
+  f.use_dft_batching(batch);
+  f.use_dft_decimation(margin);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(xmax*.5, ymax*.5));
+  volume box(vec(xmax*.1, ymax*.1), vec(xmax*.9, ymax*.9));
+  dft_flux flux = f.add_dft_flux_box(box, 0.5, 1.0, Nfreq);
+
+  const double tend = f.time() + ttot;
+  double start = wall_time();
+  while (f.time() < tend) f.step();
+  delete[] flux.flux();
+  bench b;
+  b.time = (wall_time() - start);
+  b.gridsteps = ttot*a*2*gridpts;
+  return b;
+}
+
+// bench_2d_dft (unbatched, not decimated) with nthreads threads
+bench bench_2d_dft_threads(const double xmax, const double ymax, int Nfreq,
+                           int nthreads) {
+  const int nthreads0 = count_threads();
+  set_num_threads(nthreads);
+  bench b = bench_2d_dft(xmax, ymax, Nfreq, 1);
+  set_num_threads(nthreads0);
+  return b;
+}
+
+
+
+
 int main(int argc, char **argv) {
   initialize mpi(argc, argv);
   quiet = true;
@@ -288,10 +442,43 @@ int main(int argc, char **argv) {
   showbench("3D 10x3x0", bench_3d_periodic(10.0, 3.0, 0.0, one));
   showbench("3D 0x3x10", bench_3d_periodic(0.0, 3.0, 10.0, one));
 
+  show_speedup("3D 4x4x4 tiled 8",
+               bench_3d_tiled(4.0, 4.0, 4.0, one, 0.0, 0),
+               bench_3d_tiled(4.0, 4.0, 4.0, one, 0.0, 8));
+  show_speedup("3D 4x4x4 PML tiled 8",
+               bench_3d_tiled(4.0, 4.0, 4.0, one, 1.0, 0),
+               bench_3d_tiled(4.0, 4.0, 4.0, one, 1.0, 8));
+  show_speedup("3D 4x4x4 wavefront 8",
+               bench_3d_wavefront(4.0, 4.0, 4.0, one, 0.0, 1),
+               bench_3d_wavefront(4.0, 4.0, 4.0, one, 0.0, 8));
+  show_speedup("3D 6x6x6 PML wavefront 8",
+               bench_3d_wavefront(6.0, 6.0, 6.0, one, 1.0, 1),
+               bench_3d_wavefront(6.0, 6.0, 6.0, one, 1.0, 8));
+
   showbench("2D 6x4 ", bench_2d(6.0, 4.0, one));
   showbench("2D 12x12 ", bench_2d(12.0, 12.0, one));
   showbench("2D 12x12 ", bench_2d(12.0, 12.0, one));
 
+  for (int L = 2; L <= 4; ++L) {
+    char name[64];
+    snprintf(name, 64, "2D 6x4 %d-level atom ", L);
+    show_speedup(name, bench_2d_multilevel(6.0, 4.0, L, false),
+                 bench_2d_multilevel(6.0, 4.0, L, true));
+  }
+
+  show_speedup("2D 12x12 flux 100 freqs batched 32 ",
+               bench_2d_dft(12.0, 12.0, 100, 1),
+               bench_2d_dft(12.0, 12.0, 100, 32));
+  show_speedup("2D 12x12 flux 500 freqs batched 32 ",
+               bench_2d_dft(12.0, 12.0, 500, 1),
+               bench_2d_dft(12.0, 12.0, 500, 32));
+  show_speedup("2D 12x12 flux 100 freqs decimated ",
+               bench_2d_dft(12.0, 12.0, 100, 1),
+               bench_2d_dft(12.0, 12.0, 100, 1, 2.0));
+  show_speedup("2D 12x12 flux 500 freqs 4 threads ",
+               bench_2d_dft_threads(12.0, 12.0, 500, 1),
+               bench_2d_dft_threads(12.0, 12.0, 500, 4));
+
   showbench("2D TM 6x4 nonlinear ", bench_2d_tm_nonlinear(6.0, 4.0, one));
   showbench("2D TM 6x4 ", bench_2d_tm(6.0, 4.0, one));
   showbench("2D TM 12x12 ", bench_2d_tm(12.0, 12.0, one));
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 
 #include <meep.hpp>
+#include "config.h"
 using namespace meep;
 using namespace std;
 
@@ -308,6 +309,129 @@ int flux_cyl(const double rmax, const double zmax,
   return 1;
 }
 
+/* the parameters of the feature turned on by a compare_flux_twins option */
+struct twin_args {
+  int batch;
+  bool real_fields;
+  double nyquist_margin;
+  bool average;
+};
+
+/* Step fields f and f1 in the same structure with the same sources,
+   where option(f, f1, args) turns on the feature being tested, until
+   the pulses have decayed, and compare their flux spectra through a
+   box added before the option and a plane added after it.  The fluxes
+   are compared at the end and, if dt_check > 0, every dt_check (e.g.
+   not a multiple of a batch of steps), to within a fraction tol where
+   they are more than a fraction thresh of the largest flux.  If
+   threads > 0, f is stepped with one thread and f1 with threads
+   threads. */
+int compare_flux_twins(void option(fields &f, fields &f1,
+				   const twin_args &args),
+		       const twin_args &args, double dt_check, double tol,
+		       double thresh, int threads = 0) {
+  const double a = 8.0, xmax = 6.0, ymax = 4.0;
+  grid_volume gv = voltwo(xmax,ymax,a);
+  structure s(gv, bump2, pml(0.5));
+  fields f(&s), f1(&s);
+  f.add_point_source(Ez, 0.25, 3.5, 0., 8., vec(1.1, 1.3), 1.);
+  f1.add_point_source(Ez, 0.25, 3.5, 0., 8., vec(1.1, 1.3), 1.);
+  f.add_point_source(Hz, 0.27, 3.5, 0., 8., vec(1.2, 1.1), 1.);
+  f1.add_point_source(Hz, 0.27, 3.5, 0., 8., vec(1.2, 1.1), 1.);
+
+  volume box(vec(0.8, 0.7), vec(2.9, 2.6));
+  volume plane(vec(0.8, 0.7), vec(2.9, 0.7));
+  const double fmin = 0.1, fmax = 0.4;
+  const int Nfreq = 45;
+  dft_flux flux = f.add_dft_flux_box(box, fmin, fmax, Nfreq);
+  dft_flux flux1 = f1.add_dft_flux_box(box, fmin, fmax, Nfreq);
+  option(f, f1, args);
+  dft_flux fluxp = f.add_dft_flux_plane(plane, fmin, fmax, Nfreq);
+  dft_flux fluxp1 = f1.add_dft_flux_plane(plane, fmin, fmax, Nfreq);
+
+  const int nthreads = count_threads();
+  const double tend = f.last_source_time() + 50;
+  while (f.time() < tend) {
+    const double tcheck = dt_check > 0 ? min(f.time() + dt_check, tend) : tend;
+    while (f.time() < tcheck) {
+      if (threads > 0) set_num_threads(1);
+      f.step();
+      if (threads > 0) set_num_threads(threads);
+      f1.step();
+    }
+    set_num_threads(nthreads);
+    double *fl = flux.flux(), *fl1 = flux1.flux();
+    double *flp = fluxp.flux(), *flp1 = fluxp1.flux();
+    double flmax = 0;
+    for (int i = 0; i < Nfreq; ++i)
+      flmax = max(flmax, max(fabs(fl[i]), fabs(flp[i])));
+    bool ok = true;
+    for (int i = 0; i < Nfreq && ok; ++i)
+      ok = compare(fl1[i], fl[i], tol, flmax * thresh, "Flux box") &&
+	compare(flp1[i], flp[i], tol, flmax * thresh, "Flux plane");
+    delete[] fl; delete[] fl1; delete[] flp; delete[] flp1;
+    if (!ok) return 0;
+  }
+  return 1;
+}
+
+/* flux spectra accumulated batch timesteps at a time (fields::use_dft_batching)
+   should match the unbatched ones, including when read in mid-batch */
+void batched(fields &f, fields &f1, const twin_args &args) {
+  if (args.real_fields) { f.use_real_fields(); f1.use_real_fields(); }
+  f1.use_dft_batching(args.batch); // existing DFTs are batched too
+}
+
+int flux_batched(bool real_fields, int batch) {
+  master_printf("\nFlux batched (%s, batch %d) test...\n",
+		real_fields ? "real" : "complex", batch);
+  const twin_args args = { batch, real_fields, 0, false };
+  return compare_flux_twins(batched, args, 17.3, 1e-9, 1e-12);
+}
+
+/* flux spectra of a decayed pulse sampled every k steps (with k chosen
+   by fields::use_dft_decimation) should match the full-rate ones, also
+   for the smallest margin, where the response of the average over the
+   k steps at the top of the band is the smallest */
+void decimated(fields &f, fields &f1, const twin_args &args) {
+  f.use_real_fields(); f1.use_real_fields();
+  f1.use_dft_decimation(args.nyquist_margin, args.average);
+}
+
+int flux_decimated(bool average, double nyquist_margin) {
+  master_printf("\nFlux decimated (%s, margin %g) test...\n",
+		average ? "averaged" : "not averaged", nyquist_margin);
+  const twin_args args = { 1, true, nyquist_margin, average };
+  return compare_flux_twins(decimated, args, 0, 1e-3, 1e-2);
+}
+
+/* the DFT of a volume updated with several threads, in parts (see
+   fields::update_dfts), should equal the one updated serially */
+void threaded(fields &f, fields &f1, const twin_args &args) {
+  f.use_dft_batching(args.batch);
+  f1.use_dft_batching(args.batch);
+}
+
+int dft_threaded(int batch) {
+  master_printf("\nDFT threaded (batch %d) test...\n", batch);
+  const twin_args args = { batch, false, 0, false };
+  return compare_flux_twins(threaded, args, 17.3, 1e-9, 1e-12, 4);
+}
+
+/* DFTs kept in memory-mapped files (fields::use_dft_mmap) should give
+   the same fluxes as the ones in memory */
+void mmapped(fields &f, fields &f1, const twin_args &args) {
+  f1.use_dft_mmap(".");
+  f.use_dft_batching(args.batch);
+  f1.use_dft_batching(args.batch);
+}
+
+int flux_mmap(int batch) {
+  master_printf("\nFlux memory-mapped (batch %d) test...\n", batch);
+  const twin_args args = { batch, false, 0, false };
+  return compare_flux_twins(mmapped, args, 17.3, 1e-12, 1e-14);
+}
+
 void attempt(const char *name, int allright) {
   if (allright) master_printf("Passed %s\n", name);
   else abort("Failed %s!\n", name);
@@ -337,6 +461,21 @@ int main(int argc, char **argv) {
   width = 5.0;
   attempt("Flux cylindrical 5", flux_cyl(20.0, 10.0, bump2, 1));
 
+  attempt("Flux batched real", flux_batched(true, 16));
+  attempt("Flux batched complex", flux_batched(false, 7));
+
+  attempt("Flux decimated averaged", flux_decimated(true, 2.0));
+  attempt("Flux decimated", flux_decimated(false, 2.0));
+  attempt("Flux decimated averaged, small margin", flux_decimated(true, 1.0));
+
+  attempt("DFT threaded", dft_threaded(1));
+  attempt("DFT threaded batched", dft_threaded(8));
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+  attempt("Flux memory-mapped", flux_mmap(1));
+  attempt("Flux memory-mapped batched", flux_mmap(16));
+#endif
+
   return 0;
 }
 
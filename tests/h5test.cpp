@@ -394,6 +394,67 @@ bool check_2d_monitor(double eps(const vec &),
   return 1;
 }
 
+double vacuum(const vec &) { return 1.0; }
+double left_half(const vec &p) { return p.x() < 0.5*xsize ? 1.0 : 0.0; }
+
+/* Dump the structure and fields halfway through a run with PML, a
+   Lorentzian medium and a flux plane (decimated, and dumped in the
+   middle of its k steps, if decimated), load them into a new structure
+   and fields (with the same chunks, sources and flux plane, but
+   vacuum), and check that the rest of the run is exactly the same. */
+bool check_dump(double a, int splitting, bool decimated, const char *name) {
+  const grid_volume gv = vol2d(xsize, ysize, a);
+  const double T = 10.0;
+  const vec pt(0.7, 1.1);
+  lorentzian_susceptibility sus(1.1, 0.2);
+  structure s(gv, funky_eps_2d, pml(0.5, X), identity(), splitting);
+  s.add_susceptibility(left_half, E_stuff, sus);
+  fields f(&s);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.6, 0.9));
+  if (decimated) f.use_dft_decimation(3.0); // every 3 steps
+  dft_flux fl = f.add_dft_flux_plane(volume(vec(1.3, 0.2), vec(1.3, 1.8)),
+				     0.5, 1.0, 5);
+  while (f.time() < 0.5*T) f.step();
+
+  h5file *file = f.open_h5file(name);
+  s.dump(file);
+  f.dump(file);
+  delete file;
+  all_wait();
+
+  structure s2(gv, vacuum, pml(0.5, X), identity(), splitting);
+  s2.add_susceptibility(vacuum, E_stuff, sus);
+  file = f.open_h5file(name, h5file::READONLY);
+  s2.load(file);
+  fields f2(&s2);
+  f2.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.6, 0.9));
+  if (decimated) f2.use_dft_decimation(3.0);
+  dft_flux fl2 = f2.add_dft_flux_plane(volume(vec(1.3, 0.2), vec(1.3, 1.8)),
+				       0.5, 1.0, 5);
+  f2.load(file);
+  file->remove();
+  delete file;
+
+  if (f2.t != f.t) abort("%s: loaded time step %d instead of %d",
+			 name, f2.t, f.t);
+  while (f.time() < T) {
+    f.step();
+    f2.step();
+    if (f.get_field(Ez, pt) != f2.get_field(Ez, pt)
+	|| f.get_field(Hy, pt) != f2.get_field(Hy, pt))
+      abort("%s: fields differ after loading at t=%g", name, f.time());
+  }
+  double *flux = fl.flux(), *flux2 = fl2.flux();
+  for (int i = 0; i < 5; ++i)
+    if (flux[i] != flux2[i])
+      abort("%s: flux %d differs after loading: %g vs. %g",
+	    name, i, flux[i], flux2[i]);
+  master_printf("Passed %s (flux %g)\n", name, flux[0]);
+  delete[] flux2;
+  delete[] flux;
+  return 1;
+}
+
 int main(int argc, char **argv)
 {
   const double a = 10.0;
@@ -494,6 +555,16 @@ int main(int argc, char **argv)
 	      return 1;
 	  }
       }
+
+  for (int splitting = 1; splitting < 5; splitting += 3)
+    for (int decimated = 0; decimated < 2; ++decimated) {
+      char name[1024];
+      snprintf(name, 1024, "check_dump_%d%s", splitting,
+	       decimated ? "_decimated" : "");
+      master_printf("Checking %s...\n", name);
+      if (!check_dump(a, splitting, decimated, name))
+	return 1;
+    }
 #endif /* HAVE_HDF5 */
   return 0;
 }
@@ -20,6 +20,7 @@
 #include <signal.h>
 
 #include <meep.hpp>
+#include "meep_internals.hpp"
 using namespace meep;
 using namespace std;
 
@@ -234,6 +235,185 @@ int test_pml_splitting(double eps(const vec &), int splitting, const char *mydir
   return 1;
 }
 
+int test_tiling(double eps(const vec &), int tile_size, const char *mydirname) {
+  double a = 10.0;
+
+  grid_volume gv = vol3d(1.5, 1.0, 1.2, a);
+  structure s(gv, eps, pml(0.3));
+  s.set_output_directory(mydirname);
+
+  master_printf("Testing tiling with tile size %d...\n", tile_size);
+  fields f(&s);
+  f.use_tiling(tile_size);
+  f.add_point_source(Ez, 0.8, 1.6, 0.0, 4.0, vec(1.099,0.499,0.501), 1.0);
+  fields f1(&s);
+  f1.add_point_source(Ez, 0.8, 1.6, 0.0, 4.0, vec(1.099,0.499,0.501), 1.0);
+  const double ttot = 15.0;
+
+  while (f.time() < ttot) {
+    f.step();
+    f1.step();
+    if (!compare_point(f, f1, vec(0.5  , 0.01 , 1.0 ))) return 0;
+    if (!compare_point(f, f1, vec(0.46 , 0.33 , 0.33))) return 0;
+    if (!compare_point(f, f1, vec(1.3  , 0.3  , 0.15))) return 0;
+  }
+  return compare(f.field_energy(), f1.field_energy(), "   total energy");
+}
+
+int test_comm_overlap(double eps(const vec &), int splitting, bool bloch,
+		      const char *mydirname) {
+  double a = 10.0;
+
+  grid_volume gv = vol3d(1.5, 1.0, 1.2, a);
+  structure s(gv, eps, bloch ? no_pml() : pml(0.3), identity(), splitting);
+  s.set_output_directory(mydirname);
+
+  master_printf("Testing %s comm. overlap with %d chunks...\n",
+		bloch ? "periodic" : "PML", splitting);
+  gaussian_src_time src(0.8, 1.6);
+  const volume where(vec(0.2,0.3,0.3), vec(1.3,0.5,0.9));
+  fields f(&s);
+  f.use_comm_overlap();
+  fields f1(&s);
+  if (bloch) {
+    f.use_bloch(vec(0.1,0.7,0.3));
+    f1.use_bloch(vec(0.1,0.7,0.3));
+  }
+  f.add_volume_source(Ez, src, where);
+  f1.add_volume_source(Ez, src, where);
+  f.add_point_source(Hx, 0.8, 1.6, 0.0, 4.0, vec(0.75,0.5,0.6), 1.0);
+  f1.add_point_source(Hx, 0.8, 1.6, 0.0, 4.0, vec(0.75,0.5,0.6), 1.0);
+  const double ttot = 10.0;
+
+  while (f.time() < ttot) {
+    f.step();
+    f1.step();
+    if (!compare_point(f, f1, vec(0.5  , 0.01 , 1.0 ))) return 0;
+    if (!compare_point(f, f1, vec(0.75 , 0.5  , 0.6 ))) return 0;
+    if (!compare_point(f, f1, vec(1.3  , 0.3  , 0.15))) return 0;
+  }
+  return compare(f.field_energy(), f1.field_energy(), "   total energy");
+}
+
+double slab(const vec &pt) { return fabs(pt.x() - 0.75) < 0.3 ? 4.0 : 2.0; }
+
+int test_wavefront(double eps(const vec &), int block, const char *mydirname) {
+  double a = 10.0;
+
+  grid_volume gv = vol3d(1.5, 1.0, 1.2, a);
+  structure s(gv, eps);
+  s.set_output_directory(mydirname);
+
+  master_printf("Testing wavefront stepping with block %d...\n", block);
+  fields f(&s);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.099,0.499,0.501), 1.0);
+  fields f1(&s);
+  f1.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.099,0.499,0.501), 1.0);
+  const double ttot = 15.0;
+
+  // while the source is on, it is left out of the blocked interior
+  f.step_wavefront(int(2.0 / f.dt), block);
+  while (f1.time() < f.time()) f1.step();
+  if (!compare_point(f, f1, vec(0.46 , 0.33 , 0.33))) return 0;
+  while (f.last_source_time() >= f.time()) {
+    f.step();
+    f1.step();
+  }
+  if (!f.can_step_wavefront()) {
+    master_printf("wavefront stepping unexpectedly disabled\n");
+    return 0;
+  }
+
+  while (f.time() < ttot) {
+    f.step_wavefront(block + 3, block);
+    for (int n = 0; n < block + 3; ++n) f1.step();
+    if (!compare_point(f, f1, vec(0.5  , 0.01 , 1.0 ))) return 0;
+    if (!compare_point(f, f1, vec(0.46 , 0.33 , 0.33))) return 0;
+    if (!compare_point(f, f1, vec(1.3  , 0.3  , 0.15))) return 0;
+  }
+  return compare(f.field_energy(), f1.field_energy(), "   total energy");
+}
+
+double low_x(const vec &pt) { return pt.x() < 0.45 ? 1.0 : 0.0; }
+
+/* wavefront stepping with the PML, a source that stays on, a
+   dispersive material, a flux plane and (with splitting) the
+   connections between chunks, which are all stepped in the shells
+   around the blocked interiors of the chunks */
+int test_wavefront_shell(int splitting, int block, const char *mydirname) {
+  double a = 10.0;
+
+  grid_volume gv = vol3d(1.6, 1.6, 1.2, a);
+  structure s(gv, one, pml(0.2), identity(), splitting);
+  s.add_susceptibility(low_x, E_stuff, lorentzian_susceptibility(1.1, 0.1));
+  s.set_output_directory(mydirname);
+
+  master_printf("Testing wavefront stepping in %d chunks with block %d...\n",
+		splitting, block);
+  fields f(&s), f1(&s);
+  continuous_src_time src(0.9);
+  f.add_point_source(Ez, src, vec(1.299,0.499,0.501));
+  f1.add_point_source(Ez, src, vec(1.299,0.499,0.501));
+  const volume plane(vec(0.3, 0.3, 0.8), vec(1.3, 1.3, 0.8));
+  dft_flux flux = f.add_dft_flux_plane(plane, 0.8, 1.0, 3);
+  dft_flux flux1 = f1.add_dft_flux_plane(plane, 0.8, 1.0, 3);
+
+  f.step(); // allocates E and the PML auxiliary fields
+  f1.step();
+  if (!f.can_step_wavefront()) {
+    master_printf("wavefront stepping unexpectedly disabled\n");
+    return 0;
+  }
+
+  while (f.time() < 6.0) {
+    f.step_wavefront(block + 3, block);
+    for (int n = 0; n < block + 3; ++n) f1.step();
+    if (!compare_point(f, f1, vec(0.1  , 0.01 , 1.0 ))) return 0;
+    if (!compare_point(f, f1, vec(0.76 , 0.83 , 0.53))) return 0;
+    if (!compare_point(f, f1, vec(1.3  , 0.3  , 0.15))) return 0;
+  }
+  double *fl = flux.flux(), *fl1 = flux1.flux();
+  int ok = 1;
+  for (int i = 0; i < 3; ++i) ok = ok && compare(fl[i], fl1[i], "   flux");
+  delete[] fl;
+  delete[] fl1;
+  return ok && compare(f.field_energy(), f1.field_energy(), "   total energy");
+}
+
+/* the vectorized row kernels picked at runtime should give exactly
+   the same results as the scalar ones, for every row length (so also
+   for the leftover elements after the last full vector) */
+int test_simd_rows() {
+  master_printf("Testing vectorized rows...\n");
+  const int nmax = 70, s1 = 1, s2 = 5;
+  realnum g1[nmax + s1], g2[nmax + s2], u[nmax], f0[nmax], f[nmax], f1[nmax];
+  for (int i = 0; i < nmax + s1; ++i) g1[i] = sin(0.37 * i + 0.1);
+  for (int i = 0; i < nmax + s2; ++i) g2[i] = cos(1.13 * i) / 3;
+  for (int i = 0; i < nmax; ++i) {
+    f0[i] = 0.7 - 0.01 * i;
+    u[i] = 1 / (1.5 + sin(0.71 * i));
+  }
+  for (int n = 0; n <= nmax; ++n)
+    for (int cmp = 0; cmp < 3; ++cmp) {
+      for (int i = 0; i < nmax; ++i) f[i] = f1[i] = f0[i];
+      if (cmp < 2) {
+        simd_curl_row(f, g1, cmp ? g2 : NULL, s1, s2, 0.3141, n);
+        scalar_curl_row(f1, g1, cmp ? g2 : NULL, s1, s2, 0.3141, n);
+      }
+      else {
+        simd_mult_row(f, g1, u, n);
+        scalar_mult_row(f1, g1, u, n);
+      }
+      for (int i = 0; i < nmax; ++i)
+        if (f[i] != f1[i]) {
+          master_printf("row kernel %d differs at %d of %d: %g vs. %g\n",
+                        cmp, i, n, double(f[i]), double(f1[i]));
+          return 0;
+        }
+    }
+  return 1;
+}
+
 int main(int argc, char **argv) {
   initialize mpi(argc, argv);
   quiet = true;
@@ -241,6 +421,8 @@ int main(int argc, char **argv) {
   trash_output_directory(mydirname);
   master_printf("Testing 3D...\n");
 
+  if (!test_simd_rows()) abort("error in test_simd_rows\n");
+
   if (!test_pml(one, mydirname)) abort("error in test_pml vacuum\n");
 
   for (int s=2;s<7;s++)
@@ -254,5 +436,26 @@ int main(int argc, char **argv) {
     if (!test_pml_splitting(one, s, mydirname))
       abort("error in test_pml_splitting vacuum\n");
 
+  for (int tile_size=1;tile_size<8;tile_size+=3)
+    if (!test_tiling(targets, tile_size, mydirname))
+      abort("error in test_tiling targets\n");
+
+  for (int s=2;s<5;s++) {
+    if (!test_comm_overlap(targets, s, false, mydirname))
+      abort("error in test_comm_overlap PML\n");
+    if (!test_comm_overlap(targets, s, true, mydirname))
+      abort("error in test_comm_overlap periodic\n");
+  }
+
+  for (int block=2;block<6;block+=3) {
+    if (!test_wavefront(one, block, mydirname))
+      abort("error in test_wavefront vacuum\n");
+    if (!test_wavefront(slab, block, mydirname))
+      abort("error in test_wavefront slab\n");
+    for (int s=1;s<4;s+=2)
+      if (!test_wavefront_shell(s, block, mydirname))
+	abort("error in test_wavefront_shell\n");
+  }
+
   return 0;
 }
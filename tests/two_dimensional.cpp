@@ -331,6 +331,262 @@ int test_pml_te(double eps(const vec &), int splitting, const char *mydirname) {
   return 1;
 }
 
+double left_half(const vec &pt) { return pt.x() < 2.5 ? 1.0 : 0.0; }
+
+// the largest effort of the effort volumes of s
+double max_effort(const structure &s) {
+  double emax = 0;
+  for (int j = 0; j < s.num_effort_volumes; j++)
+    emax = max(emax, s.effort[j]);
+  return emax;
+}
+
+/* With a susceptibility in the left half of the cell, the cost model
+   should balance the chunks by giving the left chunk fewer points, and
+   the results must not depend on that.  The PML effort is 0.6 unless
+   a cost_model is given. */
+int test_cost_model(const char *mydirname) {
+  const double a = 10.0;
+  const grid_volume gv = vol2d(5.0, 2.0, a);
+  cost_model costs;
+  {
+    structure sp(gv, one, pml(0.5, X), identity(), 2);
+    structure spc(gv, one, pml(0.5, X), identity(), 2, 0.5, false,
+		  DEFAULT_SUBPIXEL_TOL, DEFAULT_SUBPIXEL_MAXEVAL, &costs);
+    if (fabs(max_effort(sp) - 1.6) > 1e-12
+	|| fabs(max_effort(spc) - (1 + costs.pml)) > 1e-12) {
+      master_printf("PML efforts %g and %g, expected 1.6 and %g\n",
+		    max_effort(sp), max_effort(spc), 1 + costs.pml);
+      return 0;
+    }
+  }
+  costs.add_susceptibility(left_half);
+  structure s(gv, one, no_pml(), identity(), 2, 0.5, false,
+	      DEFAULT_SUBPIXEL_TOL, DEFAULT_SUBPIXEL_MAXEVAL, &costs);
+  structure s1(gv, one, no_pml(), identity(), 1);
+  s.add_susceptibility(left_half, E_stuff, lorentzian_susceptibility(1.0, 0.1));
+  s1.add_susceptibility(left_half, E_stuff, lorentzian_susceptibility(1.0, 0.1));
+  s.set_output_directory(mydirname);
+  if (s.num_chunks != 2) abort("expected 2 chunks, not %d\n", s.num_chunks);
+
+  int nleft = 0, nright = 0;
+  for (int i = 0; i < s.num_chunks; i++) {
+    const int n = s.chunks[i]->gv.nowned_min();
+    if (s.chunks[i]->gv.center().x() < 2.5) nleft += n; else nright += n;
+  }
+  const double expected = 1 / (2 + costs.susceptibility);
+  master_printf("Cost model gives %g of the points to the left chunk "
+		"(expected %g)\n", nleft / double(nleft + nright), expected);
+  if (fabs(nleft / double(nleft + nright) - expected) > 0.05) return 0;
+
+  fields f(&s), f1(&s1);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.3, 0.9));
+  f1.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.3, 0.9));
+  while (f.time() < 20) {
+    f.step();
+    f1.step();
+    if (!compare_point(f, f1, vec(0.5, 0.5))) return 0;
+    if (!compare_point(f, f1, vec(3.7, 1.1))) return 0;
+  }
+  return 1;
+}
+
+/* Move the chunks (with PML, a Lorentzian, a source and a flux plane,
+   decimated if decimated, so that the chunks move in the middle of its
+   k steps) between the processes during the run; the fields must not
+   change. */
+int test_rebalance(bool decimated, const char *mydirname) {
+  const double a = 10.0;
+  const grid_volume gv = vol2d(5.0, 2.0, a);
+  structure s(gv, one, pml(0.5, X), identity(), 4);
+  structure s1(gv, one, pml(0.5, X), identity(), 1);
+  s.add_susceptibility(left_half, E_stuff, lorentzian_susceptibility(1.0, 0.1));
+  s1.add_susceptibility(left_half, E_stuff, lorentzian_susceptibility(1.0, 0.1));
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+
+  fields f(&s), f1(&s1);
+  f.use_rebalancing(1.0, 10); // also move chunks whenever it helps
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.3, 0.9));
+  f1.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.3, 0.9));
+  if (decimated) { // every 5 steps
+    f.use_dft_decimation(2.0);
+    f1.use_dft_decimation(2.0);
+  }
+  const volume plane(vec(3.5, 0.0), vec(3.5, 2.0));
+  dft_flux flux = f.add_dft_flux_plane(plane, 0.6, 1.0, 5);
+  dft_flux flux1 = f1.add_dft_flux_plane(plane, 0.6, 1.0, 5);
+
+  int procs[4];
+  while (f.time() < 20) {
+    if (f.t == 57) { // move every chunk to the next process
+      for (int i = 0; i < f.num_chunks; i++)
+	procs[i] = (f.chunks[i]->n_proc() + 1) % count_processors();
+      f.move_chunks(procs);
+    }
+    f.step();
+    f1.step();
+    if (!compare_point(f, f1, vec(0.5, 0.5))) return 0;
+    if (!compare_point(f, f1, vec(3.7, 1.1))) return 0;
+  }
+  double *fl = flux.flux(), *fl1 = flux1.flux();
+  for (int i = 0; i < 5; i++)
+    if (!compare(fl[i], fl1[i], "flux")) return 0;
+  delete[] fl;
+  delete[] fl1;
+  return 1;
+}
+
+/* Step fields in s and s1, which should give the same results, with
+   the same Ez and Hz point sources until t = 15, comparing them at the
+   npts points pts after every step. */
+int compare_twin_fields(structure &s, structure &s1, const char *mydirname,
+			const vec *pts, int npts) {
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+  fields f(&s), f1(&s1);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.3, 0.9));
+  f1.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.3, 0.9));
+  f.add_point_source(Hz, 0.8, 0.6, 0.0, 4.0, vec(1.3, 0.9));
+  f1.add_point_source(Hz, 0.8, 0.6, 0.0, 4.0, vec(1.3, 0.9));
+  while (f.time() < 15) {
+    f.step();
+    f1.step();
+    for (int i = 0; i < npts; i++)
+      if (!compare_point(f, f1, pts[i])) return 0;
+  }
+  return 1;
+}
+
+/* Store chi1inv by material index (with subpixel-averaged interfaces,
+   off-diagonal chi1inv and PML); the fields must not change. */
+int test_material_index(const char *mydirname) {
+  const double a = 10.0;
+  const grid_volume gv = vol2d(3.0, 2.0, a);
+  structure s(gv, targets, pml(0.5), identity(), 3, 0.5, true);
+  structure s1(gv, targets, pml(0.5), identity(), 3, 0.5, true);
+  s.use_material_index();
+
+  if (!compare(s.get_eps(vec(1.72, 0.1)), s1.get_eps(vec(1.72, 0.1)), "eps"))
+    return 0;
+
+  const vec pts[3] = {vec(0.5, 0.5), vec(0.72, 0.1), vec(2.3, 1.4)};
+  return compare_twin_fields(s, s1, mydirname, pts, 3);
+}
+
+/* a Lorentzian whose polarization update_eh can't fuse into the
+   E = chi1inv * (D - P) update, so that it forms D - P in f_minus_p */
+class unfused_lorentzian : public lorentzian_susceptibility {
+public:
+  unfused_lorentzian(double omega_0, double gamma, bool drude = false)
+    : lorentzian_susceptibility(omega_0, gamma, drude) {}
+  virtual susceptibility *clone() const {
+    return new unfused_lorentzian(*this); }
+  virtual bool get_P_arrays(realnum *P[NUM_FIELD_COMPONENTS][2],
+			    void *P_internal_data) const {
+    (void) P; (void) P_internal_data; return false; }
+};
+
+/* Subtract the polarizations of a Lorentzian and a Drude pole in the
+   E update (with PML), rather than in f_minus_p; the fields must not
+   change.  With the same sigma the two poles are merged into one
+   multipole_susceptibility, while with drude_sigma = one they stay
+   separate Lorentzians. */
+int test_fused_P(double drude_sigma(const vec &), const char *mydirname) {
+  const double a = 10.0;
+  const grid_volume gv = vol2d(5.0, 2.0, a);
+  structure s(gv, targets, pml(0.5), identity(), 2);
+  structure s1(gv, targets, pml(0.5), identity(), 2);
+  s.add_susceptibility(left_half, E_stuff, lorentzian_susceptibility(1.0, 0.1));
+  s.add_susceptibility(drude_sigma, E_stuff,
+		       lorentzian_susceptibility(1e-5, 0.2, true));
+  s1.add_susceptibility(left_half, E_stuff, unfused_lorentzian(1.0, 0.1));
+  s1.add_susceptibility(drude_sigma, E_stuff,
+			unfused_lorentzian(1e-5, 0.2, true));
+  const bool merged = dynamic_cast<multipole_susceptibility*>
+    (s.chunks[0]->chiP[E_stuff]) != NULL;
+  if (merged != (drude_sigma == left_half)) {
+    master_printf("Drude pole was %smerged into the Lorentzian\n",
+		  merged ? "" : "not ");
+    return 0;
+  }
+
+  const vec pts[3] = {vec(0.5, 0.5), vec(2.3, 1.4), vec(3.7, 1.1)};
+  return compare_twin_fields(s, s1, mydirname, pts, 3);
+}
+
+double left_half_x3(const vec &pt) { return 3 * left_half(pt); }
+double left_half_x025(const vec &pt) { return 0.25 * left_half(pt); }
+
+/* Lorentzians with proportional sigma are merged into one
+   multipole_susceptibility; the fields must not change. */
+int test_multipole(const char *mydirname) {
+  const double a = 10.0;
+  const grid_volume gv = vol2d(5.0, 2.0, a);
+  structure s(gv, targets, pml(0.5), identity(), 2);
+  structure s1(gv, targets, pml(0.5), identity(), 2);
+  s.add_susceptibility(left_half, E_stuff, lorentzian_susceptibility(1.0, 0.1));
+  s.add_susceptibility(left_half_x3, E_stuff,
+		       lorentzian_susceptibility(0.5, 0.05));
+  s.add_susceptibility(left_half_x025, E_stuff,
+		       lorentzian_susceptibility(2.0, 0.3));
+  s.add_susceptibility(left_half, E_stuff,
+		       lorentzian_susceptibility(1e-5, 0.2, true));
+  s1.add_susceptibility(left_half, E_stuff, unfused_lorentzian(1.0, 0.1));
+  s1.add_susceptibility(left_half_x3, E_stuff, unfused_lorentzian(0.5, 0.05));
+  s1.add_susceptibility(left_half_x025, E_stuff, unfused_lorentzian(2.0, 0.3));
+  s1.add_susceptibility(left_half, E_stuff,
+			unfused_lorentzian(1e-5, 0.2, true));
+  const multipole_susceptibility *mp = dynamic_cast<multipole_susceptibility*>
+    (s.chunks[0]->chiP[E_stuff]);
+  if (!mp || mp->num_poles() != 4 || mp->next) {
+    master_printf("Lorentzians were not merged into one multipole\n");
+    return 0;
+  }
+
+  const vec pts[3] = {vec(0.5, 0.5), vec(2.3, 1.4), vec(3.7, 1.1)};
+  return compare_twin_fields(s, s1, mydirname, pts, 3);
+}
+
+/* an L-level atom (L <= 4) pumped from level 0 to level L-1 and
+   decaying down the ladder, with lasing transitions between
+   neighboring levels */
+static multilevel_susceptibility ladder_atom(int L, bool batched) {
+  const int T = L - 1;
+  const double rate = 0.05;
+  realnum Gamma[16], N0[4], alpha[12], omega[3], gamma[3], sigmat[15];
+  for (int i = 0; i < L*L; ++i) Gamma[i] = 0;
+  for (int i = 0; i < L*T; ++i) alpha[i] = 0;
+  Gamma[0] = rate; Gamma[(L-1)*L] = -rate; // pump 0 -> L-1
+  for (int l = 1; l < L; ++l) { // decay l -> l-1
+    Gamma[l*L + l] += rate * l;
+    Gamma[(l-1)*L + l] -= rate * l;
+  }
+  for (int t = 0; t < T; ++t) {
+    alpha[t*T + t] = 1.0 / (t + 1);
+    alpha[(t+1)*T + t] = -1.0 / (t + 1);
+    omega[t] = 0.7 + 0.2 * t;
+    gamma[t] = 0.1;
+    for (int i = 0; i < 5; ++i) sigmat[t*5 + i] = 1.0 + 0.1 * i;
+  }
+  for (int l = 0; l < L; ++l) N0[l] = 1.0 - 0.2 * l;
+  multilevel_susceptibility atom(L, T, Gamma, N0, alpha, omega, gamma, sigmat);
+  atom.batched = batched;
+  return atom;
+}
+
+int test_multilevel(int L, const char *mydirname) {
+  const double a = 10.0;
+  const grid_volume gv = vol2d(5.0, 2.0, a);
+  structure s(gv, targets, pml(0.5), identity(), 2);
+  structure s1(gv, targets, pml(0.5), identity(), 2);
+  s.add_susceptibility(left_half, E_stuff, ladder_atom(L, true));
+  s1.add_susceptibility(left_half, E_stuff, ladder_atom(L, false));
+
+  const vec pts[3] = {vec(0.5, 0.5), vec(1.7, 1.4), vec(3.7, 1.1)};
+  return compare_twin_fields(s, s1, mydirname, pts, 3);
+}
+
 int main(int argc, char **argv) {
   initialize mpi(argc, argv);
   quiet = true;
@@ -367,5 +623,19 @@ int main(int argc, char **argv) {
     if (!test_periodic_tm(one, s, mydirname))
       abort("error in test_periodic_tm vacuum\n");
 
+  if (!test_cost_model(mydirname)) abort("error in test_cost_model\n");
+  if (!test_rebalance(false, mydirname)) abort("error in test_rebalance\n");
+  if (!test_rebalance(true, mydirname))
+    abort("error in test_rebalance decimated\n");
+  if (!test_material_index(mydirname))
+    abort("error in test_material_index\n");
+  if (!test_fused_P(left_half, mydirname))
+    abort("error in test_fused_P with merged poles\n");
+  if (!test_fused_P(one, mydirname))
+    abort("error in test_fused_P with separate poles\n");
+  if (!test_multipole(mydirname)) abort("error in test_multipole\n");
+  for (int L = 2; L <= 4; ++L)
+    if (!test_multilevel(L, mydirname)) abort("error in test_multilevel\n");
+
   return 0;
 }